@@ -6,6 +6,20 @@
  */
 
 #include "ruby.h"
+#include "ruby/thread.h"
+#ifdef HAVE_RUBY_RACTOR_H
+#include "ruby/ractor.h"
+#endif
+#ifdef HAVE_RUBY_FIBER_SCHEDULER_H
+#include "ruby/io.h"
+#include "ruby/fiber/scheduler.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <strings.h>
+#include <unistd.h>
 
 /* 
  * Older versions of OpenAFS, like the one in Debian etch, haven't
@@ -21,21 +35,94 @@
 #include <afs/ptuser.h>
 #include <afs/com_err.h>
 
-static int afs_library_initialized;
+#include "entry_table.h"
+#include "group_graph.h"
+#include "member_set.h"
+#include "pr_cache.h"
+#include "pr_call.h"
+#include "pr_trace.h"
+#include "privacy_flags.h"
+
+static int afs_library_initialized;	/* configuration fixed */
+static int afs_library_connected;	/* pr_Initialize() has been called */
+static int afs_library_forked;		/* after our parent connected */
+static struct {
+	int seclevel;
+	const char *confdir;
+	const char *cell;		/* or NULL for the local cell */
+} afs_connect_config;
+static int afs_cache_loaded;		/* from vCacheFile */
+static pid_t afs_cache_pid;		/* by this process, to save at exit */
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
 
 struct protection_object {
 	struct prcheckentry e;
 	int deleted;
 };
 
-#define	PF_STATUS_ANY	0x80
-#define	PF_STATUS_MEM	0x40
-#define	PF_OWNED_ANY	0x20
-#define	PF_MEMBER_ANY	0x10
-#define	PF_MEMBER_MEM	0x08
-#define	PF_ADD_ANY	0x04
-#define	PF_ADD_MEM	0x02
-#define	PF_REMOVE_MEM	0x01
+struct member_set_object {
+	struct member_set ms;
+	int iterating;		/* nonzero while #each is running */
+};
+
+/*
+ * Frozen ProtectionObjects and MemberSets may be shared between Ractors;
+ * every method that changes one checks that it is not frozen first.
+ */
+#ifndef RUBY_TYPED_FROZEN_SHAREABLE
+#define	RUBY_TYPED_FROZEN_SHAREABLE	0
+#endif
+
+static size_t po_memsize(const void *p);
+static void memberset_free(void *p);
+static size_t memberset_memsize_internal(const void *p);
+static void entrytable_free(void *p);
+static size_t entrytable_memsize_internal(const void *p);
+static void groupgraph_free(void *p);
+static size_t groupgraph_memsize_internal(const void *p);
+
+static const rb_data_type_t po_data_type = {
+	"AFS::ProtectionObject",
+	{ NULL, RUBY_TYPED_DEFAULT_FREE, po_memsize, },
+	NULL, NULL,
+	RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_FROZEN_SHAREABLE
+};
+
+static const rb_data_type_t memberset_data_type = {
+	"AFS::MemberSet",
+	{ NULL, memberset_free, memberset_memsize_internal, },
+	NULL, NULL,
+	RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_FROZEN_SHAREABLE
+};
+
+/* EntryTables are frozen as soon as they are loaded. */
+static const rb_data_type_t entrytable_data_type = {
+	"AFS::EntryTable",
+	{ NULL, entrytable_free, entrytable_memsize_internal, },
+	NULL, NULL,
+	RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_FROZEN_SHAREABLE
+};
+
+/* So are GroupGraphs. */
+static const rb_data_type_t groupgraph_data_type = {
+	"AFS::GroupGraph",
+	{ NULL, groupgraph_free, groupgraph_memsize_internal, },
+	NULL, NULL,
+	RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_FROZEN_SHAREABLE
+};
+
+#define	GetProtectionObject(obj, po) \
+	TypedData_Get_Struct((obj), struct protection_object, &po_data_type, \
+	    (po))
+#define	GetMemberSet(obj, mso) \
+	TypedData_Get_Struct((obj), struct member_set_object, \
+	    &memberset_data_type, (mso))
+#define	GetEntryTable(obj, t) \
+	TypedData_Get_Struct((obj), struct entry_table, \
+	    &entrytable_data_type, (t))
+#define	GetGroupGraph(obj, gg) \
+	TypedData_Get_Struct((obj), struct group_graph, \
+	    &groupgraph_data_type, (gg))
 
 /*
  * The Module object for this module will be stored here by Init_AFS()
@@ -53,6 +140,9 @@ VALUE eAFSLibraryError = Qnil;
 VALUE cProtectionObject = Qnil;
 VALUE cUser = Qnil;
 VALUE cGroup = Qnil;
+VALUE cMemberSet = Qnil;
+VALUE cEntryTable = Qnil;
+VALUE cGroupGraph = Qnil;
 
 /*
  * Likewise the Symbol objects.
@@ -64,6 +154,7 @@ VALUE sWorld = Qnil;
 VALUE vSecLevel = Qnil;
 VALUE vCellName = Qnil;
 VALUE vConfDir = Qnil;
+VALUE vCacheFile = Qnil;
 
 /*
  * Singleton methods
@@ -74,6 +165,34 @@ static VALUE afs_get_cellname(VALUE self);
 static VALUE afs_set_cellname(VALUE self, VALUE newval);
 static VALUE afs_get_confdir(VALUE self);
 static VALUE afs_set_confdir(VALUE self, VALUE newval);
+static VALUE afs_get_worker_threads(VALUE self);
+static VALUE afs_set_worker_threads(VALUE self, VALUE newval);
+static VALUE afs_reinitialize(VALUE self);
+static VALUE afs_get_read_limits(VALUE self);
+static VALUE afs_set_read_limits(VALUE self, VALUE newval);
+static VALUE afs_get_write_limits(VALUE self);
+static VALUE afs_set_write_limits(VALUE self, VALUE newval);
+static VALUE afs_call_stats(VALUE self);
+static VALUE afs_record_trace(int argc, VALUE *argv, VALUE self);
+static VALUE afs_replay_trace(int argc, VALUE *argv, VALUE self);
+static VALUE afs_stop_trace(VALUE self);
+static VALUE afs_trace_stats(VALUE self);
+static VALUE afs_get_cache_file(VALUE self);
+static VALUE afs_set_cache_file(VALUE self, VALUE newval);
+static VALUE afs_get_cache_max_age(VALUE self);
+static VALUE afs_set_cache_max_age(VALUE self, VALUE newval);
+static VALUE afs_load_cache(VALUE self);
+static VALUE afs_save_cache(VALUE self);
+static VALUE afs_clear_cache(VALUE self);
+static VALUE afs_cache_stats(VALUE self);
+static void afs_cache_at_exit(VALUE unused);
+static void afs_atfork_prepare(void);
+static void afs_atfork_parent(void);
+static void afs_atfork_child(void);
+
+static afs_int32 execute_rpc(struct pr_call *c);
+static afs_int32 connect_rpc(void);
+static VALUE shareable_config(VALUE v);
 
 static VALUE po_new(VALUE self, VALUE id_or_name);
 static VALUE po_delete(VALUE self, VALUE id_or_name);
@@ -81,6 +200,15 @@ static VALUE user_new(VALUE self, VALUE id_or_name);
 static VALUE user_create(int argc, VALUE *argv, VALUE self);
 static VALUE group_new(VALUE self, VALUE id_or_name);
 static VALUE group_create(int argc, VALUE *argv, VALUE self);
+static VALUE user_create_id(int argc, VALUE *argv, VALUE self);
+static VALUE group_create_id(int argc, VALUE *argv, VALUE self);
+static VALUE po_change_entry(int argc, VALUE *argv, VALUE self);
+static VALUE po_set_fields(int argc, VALUE *argv, VALUE self);
+static VALUE group_add_member_by_name(VALUE self, VALUE group,
+    VALUE member);
+static VALUE group_remove_member_by_name(VALUE self, VALUE group,
+    VALUE member);
+static VALUE translate_many(VALUE ary);
 static VALUE po_translate(VALUE self, VALUE name_or_id);
 static VALUE group_find_all(VALUE self);
 static VALUE po_find_all(VALUE self);
@@ -89,6 +217,8 @@ static VALUE user_get_max_id(VALUE self);
 static VALUE user_set_max_id(VALUE self, VALUE newval);
 static VALUE group_get_max_id(VALUE self);
 static VALUE group_set_max_id(VALUE self, VALUE newval);
+static VALUE user_memberships_transitive_many(int argc, VALUE *argv,
+    VALUE self);
 
 /*
  * Methods
@@ -97,11 +227,17 @@ static VALUE po_add_to_group(VALUE self, VALUE group);
 static VALUE po_remove_from_group(VALUE self, VALUE group);
 static VALUE po_delete_instance(VALUE self);
 static VALUE po_deleted_p(VALUE self);
+static VALUE po_refresh(VALUE self);
 static VALUE group_add_member(VALUE self, VALUE user);
 static VALUE group_remove_member(VALUE self, VALUE user);
 static VALUE group_members(VALUE self);
+static VALUE group_each_member(int argc, VALUE *argv, VALUE self);
 static VALUE user_memberships(VALUE self);
+static VALUE user_memberships_transitive(VALUE self);
+static VALUE user_memberships_transitive_ids(VALUE self);
 static VALUE po_get_creator(VALUE self);
+static VALUE po_get_creator_id(VALUE self);
+static VALUE po_get_owner_id(VALUE self);
 static VALUE group_get_owner(VALUE self);
 static VALUE group_set_owner(VALUE self, VALUE newowner);
 static VALUE group_has_member_p(VALUE self, VALUE other);
@@ -120,12 +256,76 @@ static VALUE group_get_user_quota(VALUE self);
 static VALUE group_set_user_quota(VALUE self, VALUE newval);
 static VALUE group_get_user_count(VALUE self);
 static VALUE po_equal(VALUE self, VALUE other);
+static VALUE group_member_set(VALUE self);
+static VALUE group_member_set_of(VALUE self, VALUE group);
+
+/*
+ * MemberSet methods
+ */
+static VALUE memberset_alloc(VALUE klass);
+static VALUE memberset_initialize(int argc, VALUE *argv, VALUE self);
+static VALUE memberset_initialize_copy(VALUE self, VALUE orig);
+static VALUE memberset_add(VALUE self, VALUE id);
+static VALUE memberset_delete(VALUE self, VALUE id);
+static VALUE memberset_include_p(VALUE self, VALUE id);
+static VALUE memberset_include_many(VALUE self, VALUE ids);
+static VALUE memberset_size(VALUE self);
+static VALUE memberset_empty_p(VALUE self);
+static VALUE memberset_each(VALUE self);
+static VALUE memberset_to_a(VALUE self);
+static VALUE memberset_union(VALUE self, VALUE other);
+static VALUE memberset_intersection(VALUE self, VALUE other);
+static VALUE memberset_difference(VALUE self, VALUE other);
+static VALUE memberset_equal(VALUE self, VALUE other);
+static VALUE memberset_memsize(VALUE self);
+static VALUE memberset_inspect(VALUE self);
+
+/*
+ * EntryTable methods
+ */
+static VALUE entrytable_alloc(VALUE klass);
+static VALUE entrytable_initialize(int argc, VALUE *argv, VALUE self);
+static VALUE entrytable_s_load(int argc, VALUE *argv, VALUE klass);
+static VALUE entrytable_size(VALUE self);
+static VALUE entrytable_aref(VALUE self, VALUE id_or_name);
+static VALUE entrytable_include_p(VALUE self, VALUE id_or_name);
+static VALUE entrytable_id_of(VALUE self, VALUE name);
+static VALUE entrytable_name_of(VALUE self, VALUE id);
+static VALUE entrytable_each(VALUE self);
+static VALUE entrytable_memsize(VALUE self);
+static VALUE entrytable_inspect(VALUE self);
+
+/*
+ * GroupGraph methods
+ */
+static VALUE groupgraph_alloc(VALUE klass);
+static VALUE groupgraph_initialize(int argc, VALUE *argv, VALUE self);
+static VALUE groupgraph_size(VALUE self);
+static VALUE groupgraph_aref(VALUE self, VALUE id_or_name);
+static VALUE groupgraph_subgroups(VALUE self, VALUE id_or_name);
+static VALUE groupgraph_cycles(VALUE self);
+static VALUE groupgraph_each(VALUE self);
+static VALUE groupgraph_memsize(VALUE self);
+static VALUE groupgraph_inspect(VALUE self);
+
+/*
+ * PrivacyFlags methods
+ */
+static VALUE pf_to_s_method(VALUE self, VALUE ival);
+static VALUE s_to_pf_method(VALUE self, VALUE sval);
+static VALUE pf_to_s_many(VALUE self, VALUE flags);
+static VALUE s_to_pf_many(int argc, VALUE *argv, VALUE self);
+static VALUE pf_audit(int argc, VALUE *argv, VALUE self);
 
 void
 Init_AFS(void)
 {
 	VALUE mSecLevel = Qnil;
 
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+	rb_ext_ractor_safe(true);
+#endif
+
 	mAFS = rb_define_module("AFS");
 	mSecLevel = rb_define_module_under(mAFS, "SecLevel");
 
@@ -136,8 +336,9 @@ Init_AFS(void)
 	rb_global_variable(&vSecLevel);
 	rb_global_variable(&vCellName);
 	rb_global_variable(&vConfDir);
+	rb_global_variable(&vCacheFile);
 	vSecLevel = INT2FIX(1);
-	vConfDir = rb_str_new2(AFSDIR_CLIENT_ETC_DIR);
+	vConfDir = shareable_config(rb_str_new2(AFSDIR_CLIENT_ETC_DIR));
 
 	rb_define_singleton_method(mAFS, "security_level", afs_get_seclevel, 0);
 	rb_define_singleton_method(mAFS, "security_level=", afs_set_seclevel,
@@ -146,6 +347,39 @@ Init_AFS(void)
 	rb_define_singleton_method(mAFS, "cell_name=", afs_set_cellname, 1);
 	rb_define_singleton_method(mAFS, "config_dir", afs_get_confdir, 0);
 	rb_define_singleton_method(mAFS, "config_dir=", afs_set_confdir, 1);
+	rb_define_singleton_method(mAFS, "worker_threads",
+	    afs_get_worker_threads, 0);
+	rb_define_singleton_method(mAFS, "worker_threads=",
+	    afs_set_worker_threads, 1);
+	rb_define_singleton_method(mAFS, "reinitialize", afs_reinitialize, 0);
+	rb_define_singleton_method(mAFS, "read_limits", afs_get_read_limits, 0);
+	rb_define_singleton_method(mAFS, "read_limits=",
+	    afs_set_read_limits, 1);
+	rb_define_singleton_method(mAFS, "write_limits",
+	    afs_get_write_limits, 0);
+	rb_define_singleton_method(mAFS, "write_limits=",
+	    afs_set_write_limits, 1);
+	rb_define_singleton_method(mAFS, "call_stats", afs_call_stats, 0);
+	rb_define_singleton_method(mAFS, "record_trace", afs_record_trace, -1);
+	rb_define_singleton_method(mAFS, "replay_trace", afs_replay_trace, -1);
+	rb_define_singleton_method(mAFS, "stop_trace", afs_stop_trace, 0);
+	rb_define_singleton_method(mAFS, "trace_stats", afs_trace_stats, 0);
+	rb_define_singleton_method(mAFS, "cache_file", afs_get_cache_file, 0);
+	rb_define_singleton_method(mAFS, "cache_file=", afs_set_cache_file,
+	    1);
+	rb_define_singleton_method(mAFS, "cache_max_age",
+	    afs_get_cache_max_age, 0);
+	rb_define_singleton_method(mAFS, "cache_max_age=",
+	    afs_set_cache_max_age, 1);
+	rb_define_singleton_method(mAFS, "load_cache", afs_load_cache, 0);
+	rb_define_singleton_method(mAFS, "save_cache", afs_save_cache, 0);
+	rb_define_singleton_method(mAFS, "clear_cache", afs_clear_cache, 0);
+	rb_define_singleton_method(mAFS, "cache_stats", afs_cache_stats, 0);
+	rb_set_end_proc(afs_cache_at_exit, Qnil);
+	pr_call_set_executor(execute_rpc);
+	pr_call_set_connect(connect_rpc);
+	pthread_atfork(afs_atfork_prepare, afs_atfork_parent,
+	    afs_atfork_child);
 
 	eProgrammerError = rb_define_class_under(mAFS, "ProgrammerError",
 	    rb_eRuntimeError);
@@ -161,7 +395,12 @@ Init_AFS(void)
 	    po_translate, 1);
 	rb_define_singleton_method(cProtectionObject, "find_all", po_find_all,
 				   0);
+	rb_define_singleton_method(cProtectionObject, "change_entry",
+	    po_change_entry, -1);
+	rb_define_singleton_method(cProtectionObject, "set_fields",
+	    po_set_fields, -1);
 	rb_define_method(cProtectionObject, "delete", po_delete_instance, 0);
+	rb_define_method(cProtectionObject, "refresh", po_refresh, 0);
 	rb_define_method(cProtectionObject, "deleted?", po_deleted_p, 0);
 	rb_define_method(cProtectionObject, "==", po_equal, 1);
 	rb_define_method(cProtectionObject, "===", po_equal, 1);
@@ -178,18 +417,30 @@ Init_AFS(void)
 	rb_define_method(cProtectionObject, "remove_from_group",
 	    po_remove_from_group, 1);
 	rb_define_method(cProtectionObject, "creator", po_get_creator, 0);
+	rb_define_method(cProtectionObject, "creator_id", po_get_creator_id,
+	    0);
+	rb_define_method(cProtectionObject, "owner_id", po_get_owner_id, 0);
 
 	/* Group methods */
 	cGroup = rb_define_class_under(mAFS, "Group", cProtectionObject);
 	rb_define_singleton_method(cGroup, "new", group_new, 1);
 	rb_define_singleton_method(cGroup, "create", group_create, -1);
+	rb_define_singleton_method(cGroup, "create_id", group_create_id, -1);
+	rb_define_singleton_method(cGroup, "add_member",
+	    group_add_member_by_name, 2);
+	rb_define_singleton_method(cGroup, "remove_member",
+	    group_remove_member_by_name, 2);
 	rb_define_singleton_method(cGroup, "find_all", group_find_all, 0);
 	rb_define_singleton_method(cGroup, "max_id", group_get_max_id, 0);
 	rb_define_singleton_method(cGroup, "max_id=", group_set_max_id, 1);
+	rb_define_singleton_method(cGroup, "member_set", group_member_set_of,
+	    1);
 	rb_define_method(cGroup, "add_member", group_add_member, 1);
 	rb_define_alias(cGroup, "<<", "add_member");
 	rb_define_method(cGroup, "remove_member", group_remove_member, 1);
 	rb_define_method(cGroup, "members", group_members, 0);
+	rb_define_method(cGroup, "each_member", group_each_member, -1);
+	rb_define_method(cGroup, "member_set", group_member_set, 0);
 	rb_define_method(cGroup, "has_member?", group_has_member_p, 1);
 	rb_define_method(cGroup, "owner", group_get_owner, 0);
 	rb_define_method(cGroup, "owner=", group_set_owner, 1);
@@ -201,14 +452,84 @@ Init_AFS(void)
 	cUser = rb_define_class_under(mAFS, "User", cProtectionObject);
 	rb_define_singleton_method(cUser, "new", user_new, 1);
 	rb_define_singleton_method(cUser, "create", user_create, -1);
+	rb_define_singleton_method(cUser, "create_id", user_create_id, -1);
 	rb_define_singleton_method(cUser, "find_all", user_find_all, 0);
 	rb_define_singleton_method(cUser, "max_id", user_get_max_id, 0);
 	rb_define_singleton_method(cUser, "max_id=", user_set_max_id, 1);
+	rb_define_singleton_method(cUser, "memberships_transitive",
+	    user_memberships_transitive_many, -1);
 	rb_define_method(cUser, "memberships", user_memberships, 0);
+	rb_define_method(cUser, "each_membership", group_each_member, -1);
+	rb_define_method(cUser, "membership_set", group_member_set, 0);
+	rb_define_method(cUser, "memberships_transitive",
+	    user_memberships_transitive, 0);
+	rb_define_method(cUser, "memberships_transitive_ids",
+	    user_memberships_transitive_ids, 0);
 	rb_define_method(cUser, "group_quota", user_get_group_quota, 0);
 	rb_define_method(cUser, "group_quota=", user_set_group_quota, 1);
 	rb_define_method(cUser, "group_count", user_get_group_count, 0);
 
+	/* MemberSet methods */
+	cMemberSet = rb_define_class_under(mAFS, "MemberSet", rb_cObject);
+	rb_include_module(cMemberSet, rb_mEnumerable);
+	rb_define_alloc_func(cMemberSet, memberset_alloc);
+	rb_define_method(cMemberSet, "initialize", memberset_initialize, -1);
+	rb_define_method(cMemberSet, "initialize_copy",
+	    memberset_initialize_copy, 1);
+	rb_define_method(cMemberSet, "add", memberset_add, 1);
+	rb_define_alias(cMemberSet, "<<", "add");
+	rb_define_method(cMemberSet, "delete", memberset_delete, 1);
+	rb_define_method(cMemberSet, "include?", memberset_include_p, 1);
+	rb_define_alias(cMemberSet, "member?", "include?");
+	rb_define_alias(cMemberSet, "===", "include?");
+	rb_define_method(cMemberSet, "include_many", memberset_include_many,
+	    1);
+	rb_define_method(cMemberSet, "size", memberset_size, 0);
+	rb_define_alias(cMemberSet, "length", "size");
+	rb_define_method(cMemberSet, "empty?", memberset_empty_p, 0);
+	rb_define_method(cMemberSet, "each", memberset_each, 0);
+	rb_define_method(cMemberSet, "to_a", memberset_to_a, 0);
+	rb_define_method(cMemberSet, "|", memberset_union, 1);
+	rb_define_alias(cMemberSet, "union", "|");
+	rb_define_alias(cMemberSet, "+", "|");
+	rb_define_method(cMemberSet, "&", memberset_intersection, 1);
+	rb_define_alias(cMemberSet, "intersection", "&");
+	rb_define_method(cMemberSet, "-", memberset_difference, 1);
+	rb_define_alias(cMemberSet, "difference", "-");
+	rb_define_method(cMemberSet, "==", memberset_equal, 1);
+	rb_define_method(cMemberSet, "memsize", memberset_memsize, 0);
+	rb_define_method(cMemberSet, "inspect", memberset_inspect, 0);
+
+	/* EntryTable */
+	cEntryTable = rb_define_class_under(mAFS, "EntryTable", rb_cObject);
+	rb_include_module(cEntryTable, rb_mEnumerable);
+	rb_define_alloc_func(cEntryTable, entrytable_alloc);
+	rb_define_method(cEntryTable, "initialize", entrytable_initialize, -1);
+	rb_define_singleton_method(cEntryTable, "load", entrytable_s_load, -1);
+	rb_define_method(cEntryTable, "size", entrytable_size, 0);
+	rb_define_alias(cEntryTable, "length", "size");
+	rb_define_method(cEntryTable, "[]", entrytable_aref, 1);
+	rb_define_method(cEntryTable, "include?", entrytable_include_p, 1);
+	rb_define_method(cEntryTable, "id_of", entrytable_id_of, 1);
+	rb_define_method(cEntryTable, "name_of", entrytable_name_of, 1);
+	rb_define_method(cEntryTable, "each", entrytable_each, 0);
+	rb_define_method(cEntryTable, "memsize", entrytable_memsize, 0);
+	rb_define_method(cEntryTable, "inspect", entrytable_inspect, 0);
+
+	/* GroupGraph */
+	cGroupGraph = rb_define_class_under(mAFS, "GroupGraph", rb_cObject);
+	rb_include_module(cGroupGraph, rb_mEnumerable);
+	rb_define_alloc_func(cGroupGraph, groupgraph_alloc);
+	rb_define_method(cGroupGraph, "initialize", groupgraph_initialize, -1);
+	rb_define_method(cGroupGraph, "size", groupgraph_size, 0);
+	rb_define_alias(cGroupGraph, "length", "size");
+	rb_define_method(cGroupGraph, "[]", groupgraph_aref, 1);
+	rb_define_method(cGroupGraph, "subgroups", groupgraph_subgroups, 1);
+	rb_define_method(cGroupGraph, "cycles", groupgraph_cycles, 0);
+	rb_define_method(cGroupGraph, "each", groupgraph_each, 0);
+	rb_define_method(cGroupGraph, "memsize", groupgraph_memsize, 0);
+	rb_define_method(cGroupGraph, "inspect", groupgraph_inspect, 0);
+
 	/* PrivacyFlags constants */
 	mPrivacyFlags = rb_define_module_under(mAFS, "PrivacyFlags");
 #define PF(name)	\
@@ -222,15 +543,60 @@ Init_AFS(void)
 	PF(ADD_MEM);
 	PF(REMOVE_MEM);
 #undef PF
+#define PF_METHOD(name, func, argc)					\
+	rb_define_method(mPrivacyFlags, name, func, argc);		\
+	rb_define_singleton_method(mPrivacyFlags, name, func, argc)
+	PF_METHOD("pf_to_s", pf_to_s_method, 1);
+	PF_METHOD("s_to_pf", s_to_pf_method, 1);
+	PF_METHOD("pf_to_s_many", pf_to_s_many, 1);
+	PF_METHOD("s_to_pf_many", s_to_pf_many, -1);
+#undef PF_METHOD
+	rb_define_singleton_method(mPrivacyFlags, "audit", pf_audit, -1);
 }
 
-static void
-assert_not_initialized(const char *setting)
+/*
+ * The configuration and the library state are shared by every Ractor,
+ * so they are only touched with config_lock held.  Configuration values
+ * are always frozen, and so are shareable.
+ */
+static VALUE
+shareable_config(VALUE v)
+{
+	if (TYPE(v) == T_STRING)
+		v = rb_str_new_frozen(v);
+#ifdef HAVE_RUBY_RACTOR_H
+	v = rb_ractor_make_shareable(v);
+#endif
+	return (v);
+}
+
+static VALUE
+get_config(VALUE *var)
+{
+	VALUE v;
+
+	pthread_mutex_lock(&config_lock);
+	v = *var;
+	pthread_mutex_unlock(&config_lock);
+	return (v);
+}
+
+static VALUE
+set_config(VALUE *var, VALUE newval, const char *setting)
 {
-	if (afs_library_initialized)
+	int initialized;
+
+	newval = shareable_config(newval);
+	pthread_mutex_lock(&config_lock);
+	initialized = afs_library_initialized;
+	if (!initialized)
+		*var = newval;
+	pthread_mutex_unlock(&config_lock);
+	if (initialized)
 		rb_raise(eProgrammerError,
 		    "cannot alter %s after AFS library has been initialized",
 		    setting);
+	return (newval);
 }
 
 static void
@@ -241,6 +607,25 @@ assert_not_deleted(struct protection_object *po)
 			 "attempted use of deleted ProtectionObject");
 }
 
+/*
+ * Like assert_not_deleted(), for methods that change the object.
+ */
+static void
+assert_modifiable(VALUE self, struct protection_object *po)
+{
+	assert_not_deleted(po);
+	rb_check_frozen(self);
+}
+
+static void
+assert_not_forked(void)
+{
+	if (afs_library_forked)
+		rb_raise(eProgrammerError,
+		    "AFS library connected before this process forked; "
+		    "fork workers before the first call to the ptserver");
+}
+
 static void
 assert_success(int error, const char *function)
 {
@@ -249,167 +634,903 @@ assert_success(int error, const char *function)
 		    afs_error_message(error));
 }
 
+/*
+ * The first call fixes the configuration, and notes what pr_Initialize
+ * needs from it.  The strings are frozen, can no longer be replaced, and
+ * are pinned as global variables, so they may be read without the
+ * interpreter lock; the setters have already checked that they are
+ * NUL-terminated without any embedded NULs.  The connection itself is
+ * made by connect_rpc(), only once a call has to go to the ptserver.
+ *
+ * A child process cannot use the connection its parent made, nor make
+ * a new one: the RX threads behind it do not survive fork(), and the
+ * library cannot be started twice.  So a process forked after its
+ * parent connected may not make calls at all.  One forked before that
+ * connects for itself, so a parent may warm up first, by loading the
+ * cache file (AFS.load_cache), an EntryTable from an afs-ptdump
+ * snapshot, or anything the cache can answer, and then fork.  While a
+ * trace is being replayed no connection is needed, and the child may
+ * go on.
+ *
+ * The cache file, if there is one, is read the first time through (and
+ * not again after a fork, since the child already has the cache in
+ * memory).  A missing file is an empty cache; one that can't be used is
+ * warned about and ignored.
+ */
 static void
 ensure_initialized(void)
 {
+	int error;
+
+	if (pr_trace_replaying())
+		return;
+	error = 0;
+	assert_not_forked();
+	pthread_mutex_lock(&config_lock);
 	if (!afs_library_initialized) {
-		pr_Initialize(FIX2INT(vSecLevel),
-		    StringValueCStr(vConfDir),
-		    vCellName == Qnil ? NULL : StringValueCStr(vCellName));
+		afs_connect_config.seclevel = FIX2INT(vSecLevel);
+		afs_connect_config.confdir = RSTRING_PTR(vConfDir);
+		afs_connect_config.cell = vCellName == Qnil ? NULL :
+		    RSTRING_PTR(vCellName);
 		afs_library_initialized = 1;
 	}
+	if (!afs_cache_loaded && vCacheFile != Qnil) {
+		pr_cache_start();
+		error = pr_cache_load(RSTRING_PTR(vCacheFile));
+		afs_cache_loaded = 1;
+		afs_cache_pid = getpid();
+	}
+	pthread_mutex_unlock(&config_lock);
+	if (error == -1)
+		rb_warn("%s: not an AFS cache file", RSTRING_PTR(vCacheFile));
+	else if (error != 0 && error != ENOENT)
+		rb_warn("%s: %s", RSTRING_PTR(vCacheFile), strerror(error));
+}
+
+/*
+ * Connect to the ptserver, if that has not been done yet, for a call
+ * that pr_call_run() is about to make.  This runs without the
+ * interpreter lock, so it uses only the copy of the configuration made
+ * by ensure_initialized().  A failure is the call's, and the next call
+ * tries again.
+ */
+static afs_int32
+connect_rpc(void)
+{
+	afs_int32 error;
+
+	error = 0;
+	pthread_mutex_lock(&config_lock);
+	if (!afs_library_connected) {
+		error = pr_Initialize(afs_connect_config.seclevel,
+		    afs_connect_config.confdir,
+		    (char *)afs_connect_config.cell);
+		afs_library_connected = (error == 0);
+	}
+	pthread_mutex_unlock(&config_lock);
+	return (error);
+}
+
+/*
+ * AFS.reinitialize: drop the connection to the protection server; the
+ * next call makes a new one with the same configuration.  Not in a
+ * forked child, for the reasons given above.
+ */
+static VALUE
+afs_reinitialize(VALUE self)
+{
+	assert_not_forked();
+	pthread_mutex_lock(&config_lock);
+	if (afs_library_connected)
+		pr_End();
+	afs_library_connected = 0;
+	pthread_mutex_unlock(&config_lock);
+	ensure_initialized();
+	return (Qnil);
+}
+
+/*
+ * Neither config_lock nor the worker pool's lock may be held by some
+ * other thread across fork(), or the child would find it locked for
+ * good.  The child also has none of the pool's threads, and if the
+ * library had connected, no usable connection (see above).
+ */
+static void
+afs_atfork_prepare(void)
+{
+	pthread_mutex_lock(&config_lock);
+	pr_call_atfork_prepare();
+}
+
+static void
+afs_atfork_parent(void)
+{
+	pr_call_atfork_parent();
+	pthread_mutex_unlock(&config_lock);
+}
+
+static void
+afs_atfork_child(void)
+{
+	pr_call_atfork_child();
+	pthread_mutex_init(&config_lock, NULL);
+	afs_library_forked = afs_library_connected;
+}
+
+/*
+ * All protection database calls go through here (see pr_call.h).  The
+ * call itself is made without holding the interpreter lock, so other
+ * Ruby threads keep running while we wait on the ptserver.  If the
+ * current fiber is non-blocking and a Fiber scheduler is installed, the
+ * call is instead handed to a worker thread and the fiber waits for it
+ * through the scheduler, which runs other fibers in the meantime.
+ *
+ * A call still waiting for admission is cancelled if the thread is
+ * interrupted (by a signal, Thread#raise or Timeout), so that a rate
+ * limit or a congested ptserver cannot make it deaf to them.  Ruby
+ * raises whatever is pending once the call returns; if nothing is (a
+ * trap handler ran, say), a call that was turned away is made again.
+ */
+static void *
+run_rpc_nogvl(void *arg)
+{
+	pr_call_run((struct pr_call *)arg);
+	return (NULL);
+}
+
+static void
+cancel_rpc(void *arg)
+{
+	pr_call_cancel((struct pr_call *)arg);
+}
+
+static int
+rpc_turned_away(struct pr_call *c)
+{
+	if (!c->cancelled || c->error != EINTR)
+		return (0);
+	c->cancelled = 0;
+	c->error = 0;
+	return (1);
+}
+
+static void *
+wait_rpc_nogvl(void *arg)
+{
+	pr_call_wait((struct pr_call *)arg);
+	return (NULL);
+}
+
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+/*
+ * The calls a scheduler's fibers hand to the worker pool share a single
+ * pipe, kept with the scheduler, to which each worker writes a byte as
+ * it finishes a call.  Only one of the waiting fibers (the poller) waits
+ * for the pipe; it drains it, unblocks the fibers whose calls are done,
+ * and hands the job on to another fiber once its own call is done.  A
+ * thread thus needs two descriptors however many calls it has in
+ * flight, and they are made close-on-exec.
+ */
+struct fiber_wakeup;
+
+struct fiber_rpc {
+	struct pr_call *c;
+	struct fiber_wakeup *w;
+	VALUE scheduler;
+	VALUE fiber;
+	int woken;		/* unblocked, but not yet run */
+	struct fiber_rpc *next;
+};
+
+struct fiber_wakeup {
+	VALUE io;		/* the read end */
+	int read_fd;
+	int write_fd;
+	pid_t pid;		/* that made the pipe */
+	struct fiber_rpc *waiters;
+	struct fiber_rpc *poller;
+};
+
+static void
+fiber_wakeup_mark(void *p)
+{
+	rb_gc_mark(((struct fiber_wakeup *)p)->io);
+}
+
+/* Every call using the pipe is done by the time its scheduler is freed. */
+static void
+fiber_wakeup_free(void *p)
+{
+	struct fiber_wakeup *w = p;
+
+	if (w->write_fd >= 0)
+		close(w->write_fd);
+	xfree(w);
+}
+
+static const rb_data_type_t fiber_wakeup_data_type = {
+	"AFS::FiberWakeup",
+	{ fiber_wakeup_mark, fiber_wakeup_free, NULL, },
+	NULL, NULL,
+	RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+/*
+ * The pipe for "scheduler", made if need be.  One inherited across fork()
+ * is replaced, since the parent's workers may still write to it and the
+ * fibers that were waiting on it are not coming back.
+ */
+static struct fiber_wakeup *
+fiber_wakeup(VALUE scheduler)
+{
+	struct fiber_wakeup *w;
+	VALUE obj;
+	int fds[2], e;
+
+	obj = rb_attr_get(scheduler, rb_intern("__afs_fiber_wakeup__"));
+	if (obj == Qnil) {
+		obj = TypedData_Make_Struct(0, struct fiber_wakeup,
+		    &fiber_wakeup_data_type, w);
+		w->io = Qnil;
+		w->read_fd = w->write_fd = -1;
+		rb_ivar_set(scheduler, rb_intern("__afs_fiber_wakeup__"),
+		    obj);
+	} else
+		TypedData_Get_Struct(obj, struct fiber_wakeup,
+		    &fiber_wakeup_data_type, w);
+	if (w->write_fd >= 0 && w->pid == getpid())
+		return (w);
+
+	if (w->write_fd >= 0) {
+		rb_io_close(w->io);
+		close(w->write_fd);
+		w->io = Qnil;
+		w->read_fd = w->write_fd = -1;
+	}
+	w->waiters = w->poller = NULL;
+	if (rb_cloexec_pipe(fds) != 0)
+		rb_sys_fail("pipe");
+	if (fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0 ||
+	    fcntl(fds[1], F_SETFL, O_NONBLOCK) != 0) {
+		e = errno;
+		close(fds[0]);
+		close(fds[1]);
+		rb_syserr_fail(e, "fcntl");
+	}
+	w->io = rb_io_fdopen(fds[0], O_RDONLY, NULL);
+	w->read_fd = fds[0];
+	w->write_fd = fds[1];
+	w->pid = getpid();
+	return (w);
+}
+
+/*
+ * Unblock the fibers whose calls are done and, if there is no poller,
+ * one whose call is not, to take over.
+ */
+static void
+fiber_wakeup_waiters(struct fiber_wakeup *w)
+{
+	struct fiber_rpc *f;
+	int handoff;
+
+	handoff = (w->poller == NULL);
+	for (f = w->waiters; f != NULL; f = f->next) {
+		if (f->woken || f == w->poller)
+			continue;
+		if (!pr_call_done(f->c)) {
+			if (!handoff)
+				continue;
+			handoff = 0;
+		}
+		f->woken = 1;
+		rb_fiber_scheduler_unblock(f->scheduler, w->io, f->fiber);
+	}
+}
+
+static VALUE
+fiber_rpc_wait(VALUE arg)
+{
+	struct fiber_rpc *f = (struct fiber_rpc *)arg;
+	struct fiber_wakeup *w = f->w;
+	ssize_t n;
+	char buf[64];
+
+	while (!pr_call_done(f->c)) {
+		if (w->poller == NULL)
+			w->poller = f;
+		if (w->poller != f) {
+			rb_fiber_scheduler_block(f->scheduler, w->io, Qnil);
+			f->woken = 0;
+			continue;
+		}
+		rb_fiber_scheduler_io_wait(f->scheduler, w->io,
+		    RB_INT2NUM(RUBY_IO_READABLE), Qnil);
+		/* We hold the write end, so there is no end of file. */
+		while ((n = read(w->read_fd, buf, sizeof(buf))) > 0 ||
+		    (n < 0 && errno == EINTR))
+			continue;
+		if (errno != EAGAIN)
+			rb_sys_fail("read");
+		fiber_wakeup_waiters(w);
+	}
+	return (Qnil);
+}
+
+/*
+ * If the fiber is unwinding (say, from a timeout) before the call is
+ * done, the call is cancelled, but one already made cannot be, so we
+ * must still wait for the worker to finish with it before its memory
+ * goes away.  With no poller (this fiber was one, or was woken to
+ * become one only to find its call done), the job is passed on first.
+ */
+static VALUE
+fiber_rpc_cleanup(VALUE arg)
+{
+	struct fiber_rpc *f = (struct fiber_rpc *)arg;
+	struct fiber_wakeup *w = f->w;
+	struct fiber_rpc **fp;
+
+	for (fp = &w->waiters; *fp != NULL; fp = &(*fp)->next)
+		if (*fp == f) {
+			*fp = f->next;
+			break;
+		}
+	if (w->poller == f)
+		w->poller = NULL;
+	if (w->poller == NULL)
+		fiber_wakeup_waiters(w);
+	if (!pr_call_done(f->c)) {
+		pr_call_cancel(f->c);
+		rb_thread_call_without_gvl(wait_rpc_nogvl, f->c,
+		    cancel_rpc, f->c);
+	}
+	return (Qnil);
+}
+
+/*
+ * Returns -1 (having done nothing) if no worker could take the call.
+ */
+static int
+fiber_rpc(struct pr_call *c, VALUE scheduler)
+{
+	struct fiber_rpc f;
+
+	f.c = c;
+	f.w = fiber_wakeup(scheduler);
+	f.scheduler = scheduler;
+	f.fiber = rb_fiber_current();
+	f.woken = 0;
+	c->wakeup_fd = f.w->write_fd;
+	if (pr_call_submit(c) != 0) {
+		c->wakeup_fd = -1;
+		return (-1);
+	}
+	f.next = f.w->waiters;
+	f.w->waiters = &f;
+	rb_ensure(fiber_rpc_wait, (VALUE)&f, fiber_rpc_cleanup, (VALUE)&f);
+	return (0);
+}
+#endif
+
+static afs_int32
+execute_rpc(struct pr_call *c)
+{
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+	VALUE scheduler;
+
+	scheduler = rb_fiber_scheduler_current();
+	if (scheduler != Qnil && fiber_rpc(c, scheduler) == 0)
+		return (c->error);
+#endif
+	do
+		rb_thread_call_without_gvl(run_rpc_nogvl, c, cancel_rpc, c);
+	while (rpc_turned_away(c));
+	return (c->error);
 }
 
 static VALUE
 afs_get_seclevel(VALUE self)
 {
-	return vSecLevel;
+	return (get_config(&vSecLevel));
 }
 
 static VALUE
 afs_set_seclevel(VALUE self, VALUE newval)
 {
-	assert_not_initialized("security level");
 	Check_Type(newval, T_FIXNUM);
-	return (vSecLevel = newval);
+	return (set_config(&vSecLevel, newval, "security level"));
 }
 
 static VALUE
 afs_get_cellname(VALUE self)
 {
-	return vCellName;
+	return (get_config(&vCellName));
 }
 
 static VALUE
 afs_set_cellname(VALUE self, VALUE newval)
 {
-	assert_not_initialized("cell name");
-	if (newval != Qnil)
+	if (newval != Qnil) {
 		Check_Type(newval, T_STRING);
-	SafeStringValue(newval);
-	return (vCellName = newval);
+		StringValueCStr(newval);
+	}
+	return (set_config(&vCellName, newval, "cell name"));
 }
 
 static VALUE
 afs_get_confdir(VALUE self)
 {
-	return vConfDir;
+	return (get_config(&vConfDir));
 }
 
 static VALUE
 afs_set_confdir(VALUE self, VALUE newval)
 {
-	assert_not_initialized("configuration directory");
 	if (newval == Qnil) {
 		newval = rb_str_new2(AFSDIR_CLIENT_ETC_DIR);
 	} else {
 		Check_Type(newval, T_STRING);
-		SafeStringValue(newval);
+		StringValueCStr(newval);
 	}
-	return (vConfDir = newval);
+	return (set_config(&vConfDir, newval, "configuration directory"));
 }
 
+/*
+ * The number of worker threads available to make calls on behalf of
+ * fibers running under a Fiber scheduler, which bounds how many such
+ * calls can be outstanding at once.
+ */
 static VALUE
-po_new_internal(VALUE klass)
+afs_get_worker_threads(VALUE self)
 {
-	struct protection_object *po;
-	VALUE obj;
-
-	obj = Data_Make_Struct(klass, struct protection_object, NULL,
-			       free, po);
-	return (obj);
+	return (INT2NUM(pr_call_workers()));
 }
 
-static void
-assert_name_ok(VALUE obj)
+static VALUE
+afs_set_worker_threads(VALUE self, VALUE newval)
 {
-	SafeStringValue(obj);
-	if (RSTRING_LEN(obj) >= PR_MAXNAMELEN)
-		rb_raise(eAFSLibraryError,
-		    "protection object name too long (%lu >= %lu)",
-		    (unsigned long)RSTRING_LEN(obj),
-		    (unsigned long)PR_MAXNAMELEN);
+	if (pr_call_set_workers(NUM2INT(newval)) != 0)
+		rb_raise(rb_eArgError, "need at least one worker thread");
+	return (newval);
 }
 
+/*
+ * Admission control (see pr_call.c).  The limits are Hashes with the
+ * keys :max_concurrency, :min_concurrency, :rate, :burst and
+ * :latency_target; keys left out of a new setting are unchanged.
+ */
+#define	SYM(name)	ID2SYM(rb_intern(name))
+
 static VALUE
-get_name(VALUE source)
+get_limits(int writes)
 {
-	if (TYPE(source) == T_STRING)
-		return (source);
-	else
-		return (rb_funcall(source, rb_intern("name"), 0));
+	struct pr_limit_config cfg;
+	VALUE h;
+
+	pr_call_get_limits(writes, &cfg);
+	h = rb_hash_new();
+	rb_hash_aset(h, SYM("max_concurrency"), INT2NUM(cfg.max_concurrency));
+	rb_hash_aset(h, SYM("min_concurrency"), INT2NUM(cfg.min_concurrency));
+	rb_hash_aset(h, SYM("rate"), DBL2NUM(cfg.rate));
+	rb_hash_aset(h, SYM("burst"), DBL2NUM(cfg.burst));
+	rb_hash_aset(h, SYM("latency_target"), DBL2NUM(cfg.latency_target));
+	return (h);
 }
 
-static VALUE
-po_new(VALUE self, VALUE id_or_name)
+static int
+check_limit_key(VALUE key, VALUE val, VALUE known)
 {
-	struct protection_object *po;
-	VALUE obj;
-	afs_int32 id;
-	int error;
-
-	ensure_initialized();
-	if (TYPE(id_or_name) == T_STRING) {
-		assert_name_ok(id_or_name);
-		error = pr_SNameToId(StringValueCStr(id_or_name), &id);
-		assert_success(error, "pr_SNameToId");
-	} else {
-		id = NUM2INT(id_or_name);
-	}
-
-	obj = po_new_internal(id < 0 ? cGroup : cUser);
-	Data_Get_Struct(obj, struct protection_object, po);
-
-	error = pr_ListEntry(id, &po->e);
-	assert_success(error, "pr_ListEntry");
-	po->deleted = 0;
+	if (rb_hash_lookup2(known, key, Qundef) == Qundef)
+		rb_raise(rb_eArgError, "unknown limit %"PRIsVALUE, key);
+	return (ST_CONTINUE);
+}
 
-	return (obj);
+static VALUE
+set_limits(int writes, VALUE newval)
+{
+	struct pr_limit_config cfg;
+	VALUE v;
+
+	Check_Type(newval, T_HASH);
+	rb_hash_foreach(newval, check_limit_key, get_limits(writes));
+	pr_call_get_limits(writes, &cfg);
+#define	LIMIT(name, conv)						\
+	if ((v = rb_hash_lookup2(newval, SYM(#name), Qundef)) != Qundef) \
+		cfg.name = conv(v)
+	LIMIT(max_concurrency, NUM2INT);
+	LIMIT(min_concurrency, NUM2INT);
+	LIMIT(rate, NUM2DBL);
+	LIMIT(burst, NUM2DBL);
+	LIMIT(latency_target, NUM2DBL);
+#undef LIMIT
+	if (pr_call_set_limits(writes, &cfg) != 0)
+		rb_raise(rb_eArgError, "invalid %s limits",
+		    writes ? "write" : "read");
+	return (newval);
 }
 
 static VALUE
-po_delete(VALUE self, VALUE id_or_name)
+afs_get_read_limits(VALUE self)
 {
-	int error;
+	return (get_limits(0));
+}
 
-	ensure_initialized();
-	if (TYPE(id_or_name) == T_STRING) {
-		assert_name_ok(id_or_name);
-		error = pr_Delete(StringValueCStr(id_or_name));
-		assert_success(error, "pr_Delete");
-	} else {
-		error = pr_DeleteByID(NUM2INT(id_or_name));
-		assert_success(error, "pr_DeleteByID");
-	}
+static VALUE
+afs_set_read_limits(VALUE self, VALUE newval)
+{
+	return (set_limits(0, newval));
+}
 
-	return Qnil;
+static VALUE
+afs_get_write_limits(VALUE self)
+{
+	return (get_limits(1));
 }
 
 static VALUE
-user_new(VALUE self, VALUE id_or_name)
+afs_set_write_limits(VALUE self, VALUE newval)
 {
-	VALUE rv;
-	struct protection_object *po;
+	return (set_limits(1, newval));
+}
 
-	rv = po_new(self, id_or_name);
-	Data_Get_Struct(rv, struct protection_object, po);
-	if (po->e.id < 0) {
-		rb_raise(eAFSLibraryError,
-			 "`%s' (id %ld) exists but is not a user",
-			 po->e.name, (long)po->e.id);
-	}
-	return (rv);
+static VALUE
+limit_stats(int writes)
+{
+	struct pr_limit_stats st;
+	VALUE h;
+
+	pr_call_limit_stats(writes, &st);
+	h = rb_hash_new();
+	rb_hash_aset(h, SYM("calls"), ULONG2NUM(st.calls));
+	rb_hash_aset(h, SYM("errors"), ULONG2NUM(st.errors));
+	rb_hash_aset(h, SYM("congested"), ULONG2NUM(st.congested));
+	rb_hash_aset(h, SYM("decreases"), ULONG2NUM(st.decreases));
+	rb_hash_aset(h, SYM("waits"), ULONG2NUM(st.waits));
+	rb_hash_aset(h, SYM("wait_time"), DBL2NUM(st.wait_time));
+	rb_hash_aset(h, SYM("latency"), DBL2NUM(st.latency));
+	rb_hash_aset(h, SYM("best_latency"), DBL2NUM(st.best_latency));
+	rb_hash_aset(h, SYM("limit"), DBL2NUM(st.limit));
+	rb_hash_aset(h, SYM("in_flight"), INT2NUM(st.inflight));
+	return (h);
 }
 
+/*
+ * AFS.call_stats: {read: {...}, write: {...}}, counted since the
+ * extension was loaded.
+ */
 static VALUE
-group_new(VALUE self, VALUE id_or_name)
+afs_call_stats(VALUE self)
 {
-	VALUE rv;
-	struct protection_object *po;
+	VALUE h;
 
-	rv = po_new(self, id_or_name);
-	Data_Get_Struct(rv, struct protection_object, po);
-	if (po->e.id >= 0) {
+	h = rb_hash_new();
+	rb_hash_aset(h, SYM("read"), limit_stats(0));
+	rb_hash_aset(h, SYM("write"), limit_stats(1));
+	return (h);
+}
+
+/*
+ * Recording and replaying calls (see pr_trace.h).  Given a block, the
+ * trace is stopped again when it returns.
+ */
+static void
+check_trace(int error, VALUE path)
+{
+	if (error > 0)
+		rb_syserr_fail_str(error, path);
+	if (error < 0)
+		rb_raise(eAFSLibraryError, "%"PRIsVALUE": not an RPC trace",
+		    path);
+}
+
+static VALUE
+trace_stop(VALUE unused)
+{
+	pr_trace_stop();
+	return (Qnil);
+}
+
+/*
+ * AFS.record_trace(path, key = nil) [{ ... }]: with a key (a non-empty
+ * String), names are replaced by hashes made with it; keep it secret,
+ * and give it to AFS.replay_trace to replay calls that take names.
+ */
+static VALUE
+afs_record_trace(int argc, VALUE *argv, VALUE self)
+{
+	VALUE path, key;
+
+	rb_scan_args(argc, argv, "11", &path, &key);
+	FilePathValue(path);
+	if (RTEST(key) && (TYPE(key) != T_STRING || RSTRING_LEN(key) == 0))
+		rb_raise(rb_eArgError, "anonymizing a trace takes a key");
+	check_trace(pr_trace_record(StringValueCStr(path), RTEST(key),
+	    RTEST(key) ? StringValueCStr(key) : NULL), path);
+	if (rb_block_given_p())
+		return (rb_ensure(rb_yield, Qnil, trace_stop, Qnil));
+	return (Qnil);
+}
+
+/*
+ * AFS.replay_trace(path, scale = 1.0, key = nil) [{ ... }]: answer calls
+ * from the trace, each after the latency it was recorded with times
+ * "scale".  "key" is the one an anonymized trace was recorded with.
+ */
+static VALUE
+afs_replay_trace(int argc, VALUE *argv, VALUE self)
+{
+	VALUE path, vscale, key;
+	double scale;
+
+	rb_scan_args(argc, argv, "12", &path, &vscale, &key);
+	FilePathValue(path);
+	scale = NIL_P(vscale) ? 1.0 : NUM2DBL(vscale);
+	if (scale < 0)
+		rb_raise(rb_eArgError, "negative latency scale");
+	check_trace(pr_trace_replay(StringValueCStr(path), scale,
+	    NIL_P(key) ? NULL : StringValueCStr(key)), path);
+	if (rb_block_given_p())
+		return (rb_ensure(rb_yield, Qnil, trace_stop, Qnil));
+	return (Qnil);
+}
+
+static VALUE
+afs_stop_trace(VALUE self)
+{
+	return (trace_stop(Qnil));
+}
+
+/*
+ * AFS.trace_stats: {calls: {"pr_NameToId" => n, ...}, missing: n,
+ * latency: seconds} for the current or last trace.
+ */
+static VALUE
+afs_trace_stats(VALUE self)
+{
+	struct pr_trace_stats st;
+	VALUE h, calls;
+	int i;
+
+	pr_trace_get_stats(&st);
+	calls = rb_hash_new();
+	for (i = 0; i < PR_NOPS; i++)
+		if (st.calls[i] != 0)
+			rb_hash_aset(calls, rb_str_new2(pr_op_names[i]),
+			    ULONG2NUM(st.calls[i]));
+	h = rb_hash_new();
+	rb_hash_aset(h, SYM("calls"), calls);
+	rb_hash_aset(h, SYM("missing"), ULONG2NUM(st.missing));
+	rb_hash_aset(h, SYM("latency"), DBL2NUM(st.latency));
+	return (h);
+}
+
+/*
+ * The warm-start cache (see pr_cache.h).  AFS.cache_file must be set
+ * before the first call is made; the cache is loaded from it then, and
+ * saved back to it when the interpreter exits.
+ */
+static VALUE
+afs_get_cache_file(VALUE self)
+{
+	return (get_config(&vCacheFile));
+}
+
+static VALUE
+afs_set_cache_file(VALUE self, VALUE newval)
+{
+	if (newval != Qnil) {
+		FilePathValue(newval);
+		StringValueCStr(newval);
+	}
+	return (set_config(&vCacheFile, newval, "cache file"));
+}
+
+/*
+ * Cached answers older than this many seconds are fetched again; this
+ * may be changed at any time.
+ */
+static VALUE
+afs_get_cache_max_age(VALUE self)
+{
+	return (LONG2NUM(pr_cache_max_age()));
+}
+
+static VALUE
+afs_set_cache_max_age(VALUE self, VALUE newval)
+{
+	long age;
+
+	if ((age = NUM2LONG(newval)) < 0)
+		rb_raise(rb_eArgError, "negative cache age");
+	pr_cache_set_max_age(age);
+	return (newval);
+}
+
+/*
+ * AFS.load_cache: read the cache file now, without connecting to the
+ * ptserver, as the first call would; a parent can do this before it
+ * forks workers that share what was loaded.
+ */
+static VALUE
+afs_load_cache(VALUE self)
+{
+	if (get_config(&vCacheFile) == Qnil)
+		rb_raise(eProgrammerError, "no cache file has been set");
+	ensure_initialized();
+	return (Qnil);
+}
+
+/* AFS.save_cache: save the cache now rather than only at exit. */
+static VALUE
+afs_save_cache(VALUE self)
+{
+	VALUE path;
+	int error;
+
+	if ((path = get_config(&vCacheFile)) == Qnil)
+		rb_raise(eProgrammerError, "no cache file has been set");
+	if ((error = pr_cache_save(RSTRING_PTR(path))) != 0)
+		rb_syserr_fail_str(error, path);
+	return (Qnil);
+}
+
+static VALUE
+afs_clear_cache(VALUE self)
+{
+	pr_cache_clear();
+	return (Qnil);
+}
+
+/*
+ * AFS.cache_stats: counts since the extension was loaded, and what the
+ * cache holds now.
+ */
+static VALUE
+afs_cache_stats(VALUE self)
+{
+	struct pr_cache_stats st;
+	VALUE h;
+
+	pr_cache_get_stats(&st);
+	h = rb_hash_new();
+	rb_hash_aset(h, SYM("hits"), ULONG2NUM(st.hits));
+	rb_hash_aset(h, SYM("misses"), ULONG2NUM(st.misses));
+	rb_hash_aset(h, SYM("expired"), ULONG2NUM(st.expired));
+	rb_hash_aset(h, SYM("invalidations"), ULONG2NUM(st.invalidations));
+	rb_hash_aset(h, SYM("names"), ULONG2NUM(st.names));
+	rb_hash_aset(h, SYM("entries"), ULONG2NUM(st.entries));
+	return (h);
+}
+
+/*
+ * Save the cache at exit, but only from the process that loaded it: a
+ * child forked later runs the same end procs, and would otherwise
+ * write the parent's cache out again every time one of them exits.
+ */
+static void
+afs_cache_at_exit(VALUE unused)
+{
+	VALUE path;
+	int error, loaded;
+
+	pthread_mutex_lock(&config_lock);
+	loaded = afs_cache_loaded && afs_cache_pid == getpid();
+	path = vCacheFile;
+	pthread_mutex_unlock(&config_lock);
+	if (!loaded || path == Qnil)
+		return;
+	if ((error = pr_cache_save(RSTRING_PTR(path))) != 0)
+		rb_warn("%s: %s", RSTRING_PTR(path), strerror(error));
+}
+
+static size_t
+po_memsize(const void *p)
+{
+	return (sizeof(struct protection_object));
+}
+
+static VALUE
+po_new_internal(VALUE klass)
+{
+	struct protection_object *po;
+	VALUE obj;
+
+	obj = TypedData_Make_Struct(klass, struct protection_object,
+				    &po_data_type, po);
+	return (obj);
+}
+
+static void
+assert_name_ok(VALUE obj)
+{
+	SafeStringValue(obj);
+	if (RSTRING_LEN(obj) >= PR_MAXNAMELEN)
+		rb_raise(eAFSLibraryError,
+		    "protection object name too long (%lu >= %lu)",
+		    (unsigned long)RSTRING_LEN(obj),
+		    (unsigned long)PR_MAXNAMELEN);
+}
+
+static VALUE
+get_name(VALUE source)
+{
+	if (TYPE(source) == T_STRING)
+		return (source);
+	else
+		return (rb_funcall(source, rb_intern("name"), 0));
+}
+
+static VALUE
+po_new(VALUE self, VALUE id_or_name)
+{
+	struct protection_object *po;
+	VALUE obj;
+	afs_int32 id;
+	int error;
+
+	ensure_initialized();
+	if (TYPE(id_or_name) == T_STRING) {
+		assert_name_ok(id_or_name);
+		error = rpc_SNameToId(StringValueCStr(id_or_name), &id);
+		assert_success(error, "pr_SNameToId");
+	} else {
+		id = NUM2INT(id_or_name);
+	}
+
+	obj = po_new_internal(id < 0 ? cGroup : cUser);
+	GetProtectionObject(obj, po);
+
+	error = rpc_ListEntry(id, &po->e);
+	assert_success(error, "pr_ListEntry");
+	po->deleted = 0;
+
+	return (obj);
+}
+
+static VALUE
+po_delete(VALUE self, VALUE id_or_name)
+{
+	int error;
+
+	ensure_initialized();
+	if (TYPE(id_or_name) == T_STRING) {
+		assert_name_ok(id_or_name);
+		error = rpc_Delete(StringValueCStr(id_or_name));
+		assert_success(error, "pr_Delete");
+	} else {
+		error = rpc_DeleteByID(NUM2INT(id_or_name));
+		assert_success(error, "pr_DeleteByID");
+	}
+
+	return Qnil;
+}
+
+static VALUE
+user_new(VALUE self, VALUE id_or_name)
+{
+	VALUE rv;
+	struct protection_object *po;
+
+	rv = po_new(self, id_or_name);
+	GetProtectionObject(rv, po);
+	if (po->e.id < 0) {
+		rb_raise(eAFSLibraryError,
+			 "`%s' (id %ld) exists but is not a user",
+			 po->e.name, (long)po->e.id);
+	}
+	return (rv);
+}
+
+static VALUE
+group_new(VALUE self, VALUE id_or_name)
+{
+	VALUE rv;
+	struct protection_object *po;
+
+	rv = po_new(self, id_or_name);
+	GetProtectionObject(rv, po);
+	if (po->e.id >= 0) {
 
 		rb_raise(eAFSLibraryError,
 			 "`%s' (id %ld) exists but is not a group",
@@ -422,10 +1543,10 @@ group_new(VALUE self, VALUE id_or_name)
  * Create a user.
  * One argument (the name) is mandatory.
  * The second argument (the desired ID) is optional.
- * Returns an AFS::User object.
+ * Returns the new user's ptsid.
  */
-static VALUE
-user_create(int argc, VALUE *argv, VALUE self)
+static afs_int32
+create_user_internal(int argc, VALUE *argv)
 {
 	afs_int32 id;
 	int error;
@@ -443,644 +1564,2532 @@ user_create(int argc, VALUE *argv, VALUE self)
 		id = 0;		/* special flag to pr_CreateUser */
 	assert_name_ok(argv[0]);
 	ensure_initialized();
-	error = pr_CreateUser(StringValueCStr(argv[0]), &id);
+	error = rpc_CreateUser(StringValueCStr(argv[0]), &id);
 	assert_success(error, "pr_CreateUser");
+	return (id);
+}
+
+/*
+ * Create a user, returning an AFS::User object.
+ */
+static VALUE
+user_create(int argc, VALUE *argv, VALUE self)
+{
+	return (po_new(self, INT2NUM(create_user_internal(argc, argv))));
+}
+
+/*
+ * Create a user, returning just the ptsid; this saves looking up the
+ * new entry when the caller has no use for it.
+ */
+static VALUE
+user_create_id(int argc, VALUE *argv, VALUE self)
+{
+	return (INT2NUM(create_user_internal(argc, argv)));
+}
+
+/*
+ * Create a group.
+ * One argument (the name) in mandatory.
+ * The second argument (the ID) and the third argument (the owner) are
+ * optional.
+ * Returns the new group's ptsid.
+ */
+static afs_int32
+create_group_internal(int argc, VALUE *argv)
+{
+	afs_int32 id;
+	int error;
+	char *owner;
+	VALUE oobj;
+
+	if (argc < 1 || argc > 3)
+		rb_raise(rb_eArgError, 
+			 "wrong number of arguments (%d for 3)", argc);
+	if (argc == 3 && argv[2] != Qnil) {
+		oobj = get_name(argv[2]);
+		assert_name_ok(oobj);
+		owner = StringValueCStr(oobj);
+	} else
+		owner = NULL;
+
+	if (argc >= 2 && argv[1] != Qnil) {
+		id = NUM2INT(argv[1]);
+		if (id >= 0)
+			rb_raise(eAFSLibraryError,
+				 "ptsid (%ld) must be negative for groups",
+				 (long)id);
+	} else
+		id = 0;		/* special flag to pr_CreateGroup */
+	assert_name_ok(argv[0]);
+	ensure_initialized();
+	error = rpc_CreateGroup(StringValueCStr(argv[0]), owner, &id);
+	assert_success(error, "pr_CreateGroup");
+	return (id);
+}
+
+static VALUE
+group_create(int argc, VALUE *argv, VALUE self)
+{
+	return (po_new(self, INT2NUM(create_group_internal(argc, argv))));
+}
+
+static VALUE
+group_create_id(int argc, VALUE *argv, VALUE self)
+{
+	return (INT2NUM(create_group_internal(argc, argv)));
+}
+
+/*
+ * The following singleton methods change an entry identified only by
+ * name (or ptsid), without creating a ProtectionObject for it or
+ * reading it back afterwards.  They exist for bulk updates (see
+ * AFS.batch), where the caller can re-read what it needs once at the
+ * end.
+ */
+
+/*
+ * ProtectionObject.change_entry(name, newname = nil, newid = nil,
+ *     newowner = nil)
+ */
+static VALUE
+po_change_entry(int argc, VALUE *argv, VALUE self)
+{
+	VALUE name, newname, newowner;
+	afs_int32 newid;
+	int error;
+
+	if (argc < 1 || argc > 4)
+		rb_raise(rb_eArgError,
+			 "wrong number of arguments (%d for 4)", argc);
+	name = get_name(argv[0]);
+	assert_name_ok(name);
+	newname = (argc >= 2 && argv[1] != Qnil) ? argv[1] : rb_str_new2("");
+	assert_name_ok(newname);
+	if (argc >= 3 && argv[2] != Qnil)
+		newid = NUM2INT(argv[2]);
+	newowner = (argc >= 4 && argv[3] != Qnil) ? get_name(argv[3]) : Qnil;
+	if (newowner != Qnil)
+		assert_name_ok(newowner);
+
+	ensure_initialized();
+	/* bogus interface: newname must be passed as "" rather than NULL */
+	error = rpc_ChangeEntry(StringValueCStr(name),
+				StringValueCStr(newname),
+				(argc >= 3 && argv[2] != Qnil) ? &newid : NULL,
+				newowner == Qnil ? NULL :
+				StringValueCStr(newowner));
+	assert_success(error, "pr_ChangeEntry");
+	return (Qnil);
+}
+
+/*
+ * ProtectionObject.set_fields(id_or_name, flags, ngroups = nil,
+ *     nusers = nil)
+ * Any of the fields may be nil to leave it unchanged.
+ */
+static VALUE
+po_set_fields(int argc, VALUE *argv, VALUE self)
+{
+	struct protection_object *po;
+	afs_int32 id, mask, flags, ngroups, nusers;
+	int error;
+
+	if (argc < 2 || argc > 4)
+		rb_raise(rb_eArgError,
+			 "wrong number of arguments (%d for 4)", argc);
+	mask = flags = ngroups = nusers = 0;
+	if (argv[1] != Qnil) {
+		mask |= PR_SF_ALLBITS;
+		flags = NUM2INT(argv[1]);
+	}
+	if (argc >= 3 && argv[2] != Qnil) {
+		mask |= PR_SF_NGROUPS;
+		ngroups = NUM2INT(argv[2]);
+	}
+	if (argc >= 4 && argv[3] != Qnil) {
+		mask |= PR_SF_NUSERS;
+		nusers = NUM2INT(argv[3]);
+	}
+
+	ensure_initialized();
+	if (TYPE(argv[0]) == T_STRING) {
+		assert_name_ok(argv[0]);
+		error = rpc_SNameToId(StringValueCStr(argv[0]), &id);
+		/* Unknown names come back as ANONYMOUSID. */
+		if (error == 0 && id == ANONYMOUSID &&
+		    strcasecmp(StringValueCStr(argv[0]), "anonymous") != 0)
+			error = PRNOENT;
+		assert_success(error, "pr_SNameToId");
+	} else if (rb_obj_is_kind_of(argv[0], cProtectionObject)) {
+		GetProtectionObject(argv[0], po);
+		id = po->e.id;
+	} else
+		id = NUM2INT(argv[0]);
+	error = rpc_SetFieldsEntry(id, mask, flags, ngroups, nusers);
+	assert_success(error, "pr_SetFieldsEntry");
+	return (Qnil);
+}
+
+/*
+ * Group.add_member(group, member) and Group.remove_member(group, member)
+ */
+static VALUE
+group_add_member_by_name(VALUE self, VALUE group, VALUE member)
+{
+	VALUE gname, mname;
+	int error;
+
+	gname = get_name(group);
+	mname = get_name(member);
+	assert_name_ok(gname);
+	assert_name_ok(mname);
+	ensure_initialized();
+	error = rpc_AddToGroup(StringValueCStr(mname), StringValueCStr(gname));
+	assert_success(error, "pr_AddToGroup");
+	return (Qnil);
+}
+
+static VALUE
+group_remove_member_by_name(VALUE self, VALUE group, VALUE member)
+{
+	VALUE gname, mname;
+	int error;
+
+	gname = get_name(group);
+	mname = get_name(member);
+	assert_name_ok(gname);
+	assert_name_ok(mname);
+	ensure_initialized();
+	error = rpc_RemoveUserFromGroup(StringValueCStr(mname),
+					StringValueCStr(gname));
+	assert_success(error, "pr_RemoveUserFromGroup");
+	return (Qnil);
+}
+
+/*
+ * ProtectionObject.translate(array): translate every element of an Array
+ * of names and ids, using as few pr_NameToId calls for the names and
+ * pr_IdToName calls for the ids as PR_MAXLIST allows.  Anything that
+ * does not exist translates to nil.
+ */
+static void
+names_to_ids(namelist *names, afs_int32 *out)
+{
+	namelist chunk;
+	idlist ids;
+	u_int i, n;
+	int error;
+
+	for (i = 0; i < names->namelist_len; i += n) {
+		n = names->namelist_len - i;
+		if (n > PR_MAXLIST)
+			n = PR_MAXLIST;
+		chunk.namelist_len = n;
+		chunk.namelist_val = names->namelist_val + i;
+		ids.idlist_len = 0;
+		ids.idlist_val = NULL;
+		error = rpc_NameToId(&chunk, &ids);
+		if (error == 0 && ids.idlist_len != n) {
+			free(ids.idlist_val);
+			rb_raise(eAFSLibraryError,
+			    "pr_NameToId: %u ids for %u names",
+			    (unsigned)ids.idlist_len, n);
+		}
+		assert_success(error, "pr_NameToId");
+		memcpy(out + i, ids.idlist_val, n * sizeof(*out));
+		free(ids.idlist_val);
+	}
+}
+
+static void
+ids_to_names(idlist *ids, prname *out)
+{
+	namelist names;
+	idlist chunk;
+	u_int i, n;
+	int error;
+
+	for (i = 0; i < ids->idlist_len; i += n) {
+		n = ids->idlist_len - i;
+		if (n > PR_MAXLIST)
+			n = PR_MAXLIST;
+		chunk.idlist_len = n;
+		chunk.idlist_val = ids->idlist_val + i;
+		names.namelist_len = 0;
+		names.namelist_val = NULL;
+		error = rpc_IdToName(&chunk, &names);
+		if (error == 0 && names.namelist_len != n) {
+			free(names.namelist_val);
+			rb_raise(eAFSLibraryError,
+			    "pr_IdToName: %u names for %u ids",
+			    (unsigned)names.namelist_len, n);
+		}
+		assert_success(error, "pr_IdToName");
+		memcpy(out + i, names.namelist_val, n * sizeof(*out));
+		free(names.namelist_val);
+	}
+}
+
+static VALUE
+translate_many(VALUE ary)
+{
+	VALUE rv, nbuf, ibuf, rnbuf, ribuf, v;
+	namelist names;
+	idlist ids;
+	afs_int32 *nameids;
+	prname *idnames;
+	long i, n, j, k;
+	char num[16];
+
+	n = RARRAY_LEN(ary);
+	names.namelist_len = 0;
+	names.namelist_val = ALLOCV_N(prname, nbuf, n);
+	ids.idlist_len = 0;
+	ids.idlist_val = ALLOCV_N(afs_int32, ibuf, n);
+	for (i = 0; i < n; i++) {
+		v = RARRAY_AREF(ary, i);
+		if (TYPE(v) == T_STRING) {
+			assert_name_ok(v);
+			strncpy(names.namelist_val[names.namelist_len++],
+				StringValueCStr(v), PR_MAXNAMELEN);
+		} else
+			ids.idlist_val[ids.idlist_len++] = NUM2INT(v);
+	}
+	nameids = ALLOCV_N(afs_int32, ribuf, names.namelist_len);
+	idnames = ALLOCV_N(prname, rnbuf, ids.idlist_len);
+	names_to_ids(&names, nameids);
+	ids_to_names(&ids, idnames);
+
+	/*
+	 * Unknown names come back as ANONYMOUSID, and unknown ids as
+	 * their own decimal representation.
+	 */
+	rv = rb_ary_new_capa(n);
+	for (i = j = k = 0; i < n; i++) {
+		v = RARRAY_AREF(ary, i);
+		if (TYPE(v) == T_STRING) {
+			if (nameids[j] == ANONYMOUSID &&
+			    strcmp(names.namelist_val[j], "anonymous") != 0)
+				rb_ary_push(rv, Qnil);
+			else
+				rb_ary_push(rv, INT2NUM(nameids[j]));
+			j++;
+		} else {
+			snprintf(num, sizeof(num), "%ld",
+				 (long)ids.idlist_val[k]);
+			if (strcmp(idnames[k], num) == 0)
+				rb_ary_push(rv, Qnil);
+			else
+				rb_ary_push(rv, rb_str_new2(idnames[k]));
+			k++;
+		}
+	}
+	ALLOCV_END(rnbuf);
+	ALLOCV_END(ribuf);
+	ALLOCV_END(ibuf);
+	ALLOCV_END(nbuf);
+	return (rv);
+}
+
+static VALUE
+po_translate(VALUE self, VALUE id_or_name)
+{
+	VALUE obj;
+	afs_int32 id;
+	int error;
+	char name[PR_MAXNAMELEN + 1];
+
+	ensure_initialized();
+	if (TYPE(id_or_name) == T_ARRAY)
+		return (translate_many(id_or_name));
+	if (TYPE(id_or_name) == T_STRING) {
+		assert_name_ok(id_or_name);
+		error = rpc_SNameToId(StringValueCStr(id_or_name), &id);
+		assert_success(error, "pr_SNameToId");
+		obj = INT2NUM(id);
+	} else {
+		error = rpc_SIdToName(NUM2INT(id_or_name), name);
+		assert_success(error, "pr_SIdToName");
+		name[PR_MAXNAMELEN] = '\0'; /* make sure it's terminated */
+		obj = rb_str_new2(name);
+	}
+
+	return (obj);
+}
+
+/*
+ * Get a list of protection objects, yielding them one at a time (if a block 
+ * is given) or returning them in an array (otherwise).
+ */
+static VALUE
+find_all_internal(VALUE self, int flags)
+{
+	afs_int32 index, nentries, nextindex, error;
+	struct prlistentries *e;
+	VALUE ary, obj;
+	int block_given, i;
+	struct protection_object *po;
+
+	ensure_initialized();
+	block_given = rb_block_given_p();
+	if (!block_given)
+		ary = rb_ary_new();
+	else
+		ary = Qnil;
+
+	nextindex = 0;
+	do {
+		e = NULL;
+		index = nextindex;
+		error = rpc_ListEntries(flags, index, &nentries, &e, 
+					&nextindex);
+		assert_success(error, "pr_ListEntries");
+
+		for (i = 0; i < nentries; i++) {
+			/*
+			 * Avoid making a pr_ListEntry call for each
+			 * object returned by copying the data from
+			 * our "struct prlistentries" into the object's
+			 * "struct prcheckentry" manually.  (They are
+			 * actually identical structures, but we can't
+			 * depend on this.)
+			 */
+			obj = po_new_internal(e[i].id < 0 ? cGroup : cUser);
+			GetProtectionObject(obj, po);
+			po->e.flags = e[i].flags;
+			po->e.id = e[i].id;
+			po->e.owner = e[i].owner;
+			po->e.creator = e[i].creator;
+			po->e.ngroups = e[i].ngroups;
+			po->e.nusers = e[i].nusers;
+			po->e.count = e[i].count;
+			strncpy(po->e.name, e[i].name, PR_MAXNAMELEN);
+
+			if (block_given)
+				rb_yield(obj);
+			else
+				rb_ary_push(ary, obj);
+		}
+
+		if (e != NULL)
+			free(e);
+	} while (nextindex > index);
+	return (ary);
+}
+
+static VALUE
+group_find_all(VALUE self)
+{
+	return (find_all_internal(self, PRGROUPS));
+}
+
+static VALUE
+user_find_all(VALUE self)
+{
+	return (find_all_internal(self, PRUSERS));
+}
+
+static VALUE
+po_find_all(VALUE self)
+{
+	return (find_all_internal(self, PRGROUPS | PRUSERS));
+}
+
+static VALUE
+group_get_max_id(VALUE self)
+{
+	afs_int32 max_id;
+	int error;
+
+	ensure_initialized();
+	error = rpc_ListMaxGroupId(&max_id);
+	assert_success(error, "pr_ListMaxGroupId");
+	return (INT2NUM(max_id));
+}
+
+static VALUE
+user_get_max_id(VALUE self)
+{
+	afs_int32 max_id;
+	int error;
+
+	ensure_initialized();
+	error = rpc_ListMaxUserId(&max_id);
+	assert_success(error, "pr_ListMaxUserId");
+	return (INT2NUM(max_id));
+}
+
+static VALUE
+group_set_max_id(VALUE self, VALUE newval)
+{
+	afs_int32 max_id;
+	int error;
+
+	max_id = NUM2INT(newval);
+	ensure_initialized();
+	error = rpc_SetMaxGroupId(max_id);
+	assert_success(error, "pr_SetMaxGroupId");
+	return (INT2NUM(max_id));
+}
+
+static VALUE
+user_set_max_id(VALUE self, VALUE newval)
+{
+	afs_int32 max_id;
+	int error;
+
+	max_id = NUM2INT(newval);
+	ensure_initialized();
+	error = rpc_SetMaxUserId(max_id);
+	assert_success(error, "pr_SetMaxUserId");
+	return (INT2NUM(max_id));
+}
+
+static VALUE
+po_add_to_group(VALUE self, VALUE group)
+{
+	struct protection_object *po;
+	int error;
+	VALUE gname;
+
+	GetProtectionObject(self, po);
+	assert_not_deleted(po);
+
+	gname = get_name(group);
+	assert_name_ok(gname);
+	ensure_initialized();
+	error = rpc_AddToGroup(po->e.name, StringValueCStr(gname));
+	assert_success(error, "pr_AddToGroup");
+	return (group_new(cGroup, gname));
+}
+
+static VALUE
+po_remove_from_group(VALUE self, VALUE group)
+{
+	struct protection_object *po;
+	int error;
+	VALUE gname;
+
+	GetProtectionObject(self, po);
+	assert_not_deleted(po);
+
+	gname = get_name(group);
+	assert_name_ok(gname);
+	ensure_initialized();
+	error = rpc_RemoveUserFromGroup(po->e.name, StringValueCStr(gname));
+	assert_success(error, "pr_RemoveUserFromGroup");
+	return (group_new(cGroup, gname));
+}
+
+static VALUE
+group_add_member(VALUE self, VALUE member)
+{
+	struct protection_object *po;
+	int error;
+	VALUE poname;
+
+	GetProtectionObject(self, po);
+	assert_not_deleted(po);
+	poname = get_name(member);
+	ensure_initialized();
+	assert_name_ok(poname);
+	error = rpc_AddToGroup(po->e.name, StringValueCStr(poname));
+	assert_success(error, "pr_AddToGroup");
+	return (self);
+}
+
+static VALUE
+group_remove_member(VALUE self, VALUE member)
+{
+	struct protection_object *po;
+	int error;
+	VALUE poname;
+
+	GetProtectionObject(self, po);
+	assert_not_deleted(po);
+	poname = get_name(member);
+	ensure_initialized();
+	assert_name_ok(poname);
+	error = rpc_RemoveUserFromGroup(po->e.name, StringValueCStr(poname));
+	assert_success(error, "pr_RemoveUserFromGroup");
+	return (self);
+}
+
+/*
+ * Fetch the ids of the members of a group (or of the groups a user
+ * belongs to).  The caller must free ids->idlist_val.
+ */
+static void
+member_ids(afs_int32 id, idlist *ids)
+{
+	enum pr_op failed;
+	int error;
+
+	ensure_initialized();
+	error = pr_call_member_ids(id, ids, &failed);
+	assert_success(error, failed == PR_OP_NAMETOID ?
+	    "pr_NameToId" : "pr_ListMembers");
+}
+
+/*
+ * Members are turned into objects a window at a time: the ids in the
+ * window are looked up (if the library only gave us names), then the
+ * window's pr_ListEntry calls are all queued on the worker pool at once,
+ * and the objects are handed over before the next window is started.
+ * So however large the group, at most a window's worth of entries and
+ * objects is held at once besides the member list itself, and that is
+ * four bytes per member where ubik_PR_ListElements is available.
+ * Members deleted since the list was fetched are skipped.
+ */
+#define	MEMBER_WINDOW	512
+
+struct member_stream {
+	afs_int32 id;
+	long window;
+	void (*fn)(VALUE obj, VALUE arg);
+	VALUE arg;
+#ifdef HAVE_UBIK_PR_LISTELEMENTS
+	prlist elist;
+#else
+	namelist names;
+	idlist ids;
+#endif
+	struct pr_call *calls;
+	struct prcheckentry *entries;
+	long n;			/* calls in the current window */
+};
+
+static void *
+member_window_wait_nogvl(void *arg)
+{
+	struct member_stream *ms = arg;
+	long i;
+
+	for (i = 0; i < ms->n; i++)
+		pr_call_wait(&ms->calls[i]);
+	return (NULL);
+}
+
+static void
+member_window_cancel(void *arg)
+{
+	struct member_stream *ms = arg;
+	long i;
+
+	for (i = 0; i < ms->n; i++)
+		pr_call_cancel(&ms->calls[i]);
+}
+
+static void
+member_window_fetch(struct member_stream *ms, const afs_int32 *ids, long n)
+{
+	struct pr_call *c;
+	long i;
+	int queued, again;
+
+	queued = 1;
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+	/* Let the scheduler run other fibers while each call is made. */
+	if (rb_fiber_scheduler_current() != Qnil)
+		queued = 0;
+#endif
+	for (i = 0; i < n; i++) {
+		c = &ms->calls[i];
+		pr_call_init(c, PR_OP_LISTENTRY);
+		c->id = ids[i];
+		c->entry = &ms->entries[i];
+		if (!queued || pr_call_submit(c) != 0) {
+			pr_call_execute(c);
+			c->done = 1;
+		}
+		ms->n = i + 1;
+	}
+	do {
+		rb_thread_call_without_gvl(member_window_wait_nogvl, ms,
+		    member_window_cancel, ms);
+		/* Interrupted with nothing to raise: go on where we were. */
+		again = 0;
+		for (i = 0; i < n; i++) {
+			c = &ms->calls[i];
+			if (!rpc_turned_away(c))
+				continue;
+			if (!queued || pr_call_submit(c) != 0) {
+				pr_call_execute(c);
+				c->done = 1;
+			}
+			again = 1;
+		}
+	} while (again);
+}
+
+static void
+member_window_deliver(struct member_stream *ms)
+{
+	struct protection_object *po;
+	afs_int32 error;
+	VALUE obj;
+	long i;
+
+	for (i = 0; i < ms->n; i++) {
+		error = ms->calls[i].error;
+		if (error == PRNOENT)
+			continue;
+		assert_success(error, "pr_ListEntry");
+		obj = po_new_internal(ms->calls[i].id < 0 ? cGroup : cUser);
+		GetProtectionObject(obj, po);
+		po->e = ms->entries[i];
+		po->deleted = 0;
+		(*ms->fn)(obj, ms->arg);
+	}
+	ms->n = 0;
+}
+
+static VALUE
+member_stream_body(VALUE arg)
+{
+	struct member_stream *ms = (struct member_stream *)arg;
+	afs_int32 error;
+	long i, n, len;
+#ifdef HAVE_UBIK_PR_LISTELEMENTS
+	afs_int32 over;
+
+	over = 0;
+	error = rpc_ListElements(ms->id, &ms->elist, &over);
+	/* Don't pass off a list the ptserver cut short as the whole. */
+	if (error == 0 && over != 0)
+		error = PRTOOMANY;
+	assert_success(error, "pr_ListMembers");
+	len = ms->elist.prlist_len;
+#else
+	namelist chunk;
+	long j, k;
+
+	error = rpc_IDListMembers(ms->id, &ms->names);
+	assert_success(error, "pr_ListMembers");
+	len = ms->names.namelist_len;
+#endif
+	ms->calls = ALLOC_N(struct pr_call, ms->window);
+	ms->entries = ALLOC_N(struct prcheckentry, ms->window);
+#ifdef HAVE_UBIK_PR_LISTELEMENTS
+	for (i = 0; i < len; i += n) {
+		n = len - i < ms->window ? len - i : ms->window;
+		member_window_fetch(ms, ms->elist.prlist_val + i, n);
+		member_window_deliver(ms);
+	}
+#else
+	/*
+	 * Names are turned into ids PR_MAXLIST at a time, whatever the
+	 * window, and each lot is then looked up a window at a time.
+	 */
+	for (i = 0; i < len; i += n) {
+		n = len - i < PR_MAXLIST ? len - i : PR_MAXLIST;
+		chunk.namelist_len = n;
+		chunk.namelist_val = ms->names.namelist_val + i;
+		error = rpc_NameToId(&chunk, &ms->ids);
+		assert_success(error, "pr_NameToId");
+		if (ms->ids.idlist_len != (u_int)n)
+			rb_raise(eAFSLibraryError, "pr_NameToId: "
+			    "wrong number of ids returned");
+		for (j = 0; j < n; j += k) {
+			k = n - j < ms->window ? n - j : ms->window;
+			member_window_fetch(ms, ms->ids.idlist_val + j, k);
+			member_window_deliver(ms);
+		}
+		free(ms->ids.idlist_val);
+		ms->ids.idlist_val = NULL;
+		ms->ids.idlist_len = 0;
+	}
+#endif
+	return (Qnil);
+}
+
+static VALUE
+member_stream_free(VALUE arg)
+{
+	struct member_stream *ms = (struct member_stream *)arg;
+	long i;
+
+	/*
+	 * If we are unwinding, the pool may not be done with the window;
+	 * what has not been made yet need not be.
+	 */
+	for (i = 0; i < ms->n; i++)
+		pr_call_cancel(&ms->calls[i]);
+	for (i = 0; i < ms->n; i++)
+		pr_call_wait(&ms->calls[i]);
+#ifdef HAVE_UBIK_PR_LISTELEMENTS
+	free(ms->elist.prlist_val);
+#else
+	free(ms->names.namelist_val);
+	free(ms->ids.idlist_val);
+#endif
+	xfree(ms->calls);
+	xfree(ms->entries);
+	return (Qnil);
+}
+
+static void
+member_stream(VALUE self, long window, void (*fn)(VALUE, VALUE), VALUE arg)
+{
+	struct protection_object *po;
+	struct member_stream ms;
+
+	GetProtectionObject(self, po);
+	assert_not_deleted(po);
+	if (window < 1)
+		rb_raise(rb_eArgError, "window must be at least 1");
+
+	memset(&ms, 0, sizeof(ms));
+	ms.id = po->e.id;
+	ms.window = window;
+	ms.fn = fn;
+	ms.arg = arg;
+	ensure_initialized();
+	rb_ensure(member_stream_body, (VALUE)&ms, member_stream_free,
+	    (VALUE)&ms);
+}
+
+static void
+member_yield(VALUE obj, VALUE unused)
+{
+	rb_yield(obj);
+}
+
+static void
+member_push(VALUE obj, VALUE ary)
+{
+	rb_ary_push(ary, obj);
+}
+
+static VALUE
+group_members(VALUE self)
+{
+	VALUE ary;
+
+	if (rb_block_given_p()) {
+		member_stream(self, MEMBER_WINDOW, member_yield, Qnil);
+		return (Qnil);
+	}
+	ary = rb_ary_new();
+	member_stream(self, MEMBER_WINDOW, member_push, ary);
+	return (ary);
+}
+
+/*
+ * group.each_member(window = 512) { |member| ... }: like members, but
+ * never builds an Array; without a block, returns an Enumerator.
+ * "window" is how many members are looked up at once.
+ */
+static VALUE
+group_each_member(int argc, VALUE *argv, VALUE self)
+{
+	VALUE window;
+
+	RETURN_ENUMERATOR(self, argc, argv);
+	rb_scan_args(argc, argv, "01", &window);
+	member_stream(self, NIL_P(window) ? MEMBER_WINDOW : NUM2LONG(window),
+	    member_yield, Qnil);
+	return (self);
+}
+
+/*
+ * For the moment at least, group_members() and user_memberships() have
+ * identical implementations.
+ */
+static VALUE
+user_memberships(VALUE self)
+{
+	return (group_members(self));
+}
+
+/*
+ * Fetch the ids of every group a user is effectively a member of,
+ * supergroups and the system:anyuser/system:authuser pseudo-groups
+ * included, using the ptserver's current protection set (CPS) rather
+ * than walking the membership graph.  The user's own id is dropped.
+ * The caller must free cps->prlist_val.
+ */
+static void
+cps_group_ids(afs_int32 id, prlist *cps)
+{
+	int error;
+	unsigned int i, n;
+
+	cps->prlist_len = 0;
+	cps->prlist_val = NULL;
+	ensure_initialized();
+	error = rpc_GetCPS(id, cps);
+	if (error != 0 && cps->prlist_val != NULL)
+		free(cps->prlist_val);
+	assert_success(error, "pr_GetCPS");
+	for (i = n = 0; i < cps->prlist_len; i++)
+		if (cps->prlist_val[i] < 0)
+			cps->prlist_val[n++] = cps->prlist_val[i];
+	cps->prlist_len = n;
+}
+
+/*
+ * Turn a CPS into an Array of ids, or of Groups if "cache" is a Hash;
+ * the Hash is used to look up each distinct group only once.
+ */
+static VALUE
+cps_to_ary(prlist *cps, VALUE cache)
+{
+	VALUE ary, id, obj;
+	unsigned int i;
+
+	ary = rb_ary_new_capa(cps->prlist_len);
+	for (i = 0; i < cps->prlist_len; i++) {
+		id = INT2NUM(cps->prlist_val[i]);
+		if (cache == Qnil) {
+			rb_ary_push(ary, id);
+			continue;
+		}
+		obj = rb_hash_lookup2(cache, id, Qundef);
+		if (obj == Qundef) {
+			obj = po_new(cGroup, id);
+			rb_hash_aset(cache, id, obj);
+		}
+		rb_ary_push(ary, obj);
+	}
+	return (ary);
+}
+
+static VALUE
+cps_ary_free(VALUE arg)
+{
+	prlist *cps = (prlist *)arg;
+
+	if (cps->prlist_val != NULL)
+		free(cps->prlist_val);
+	cps->prlist_val = NULL;
+	return (Qnil);
+}
+
+struct cps_to_ary_args {
+	prlist *cps;
+	VALUE cache;
+};
+
+static VALUE
+cps_to_ary_body(VALUE arg)
+{
+	struct cps_to_ary_args *a = (struct cps_to_ary_args *)arg;
+
+	return (cps_to_ary(a->cps, a->cache));
+}
+
+/* cps_to_ary(), freeing the CPS even if a lookup raises. */
+static VALUE
+cps_to_ary_free(prlist *cps, VALUE cache)
+{
+	struct cps_to_ary_args a;
+
+	a.cps = cps;
+	a.cache = cache;
+	return (rb_ensure(cps_to_ary_body, (VALUE)&a, cps_ary_free,
+			  (VALUE)cps));
+}
+
+/*
+ * All groups this user is a member of, directly or through supergroups,
+ * in one RPC.  Yields each Group if a block is given.
+ */
+static VALUE
+user_memberships_transitive(VALUE self)
+{
+	struct protection_object *po;
+	prlist cps;
+	VALUE ary;
+	long i;
+
+	GetProtectionObject(self, po);
+	assert_not_deleted(po);
+	cps_group_ids(po->e.id, &cps);
+	ary = cps_to_ary_free(&cps, rb_hash_new());
+	if (!rb_block_given_p())
+		return (ary);
+	for (i = 0; i < RARRAY_LEN(ary); i++)
+		rb_yield(RARRAY_AREF(ary, i));
+	return (Qnil);
+}
+
+/* As above, but returning only the group ids. */
+static VALUE
+user_memberships_transitive_ids(VALUE self)
+{
+	struct protection_object *po;
+	prlist cps;
+
+	GetProtectionObject(self, po);
+	assert_not_deleted(po);
+	cps_group_ids(po->e.id, &cps);
+	return (cps_to_ary_free(&cps, Qnil));
+}
+
+/*
+ * User.memberships_transitive(users, hydrate = false)
+ * Batched form of User#memberships_transitive.  "users" is an Array of
+ * Users, ptsids or names; all the names are translated with a single
+ * pr_NameToId call, and then one pr_GetCPS call is made per user.
+ * Returns a Hash mapping each element of "users" to an Array of group
+ * ids, or of Groups if "hydrate" is true (each distinct group is looked
+ * up only once).
+ */
+static VALUE
+user_memberships_transitive_many(int argc, VALUE *argv, VALUE self)
+{
+	VALUE users, cache, rv, buf, nbuf, ibuf, v;
+	struct protection_object *po;
+	afs_int32 *uids, *ids;
+	namelist names;
+	prlist cps;
+	long i, n, j;
+
+	if (argc < 1 || argc > 2)
+		rb_raise(rb_eArgError,
+			 "wrong number of arguments (%d for 2)", argc);
+	/* A copy, so that no other thread can change it under us. */
+	users = rb_ary_dup(rb_convert_type(argv[0], T_ARRAY, "Array",
+					   "to_a"));
+	cache = (argc == 2 && RTEST(argv[1])) ? rb_hash_new() : Qnil;
+	n = RARRAY_LEN(users);
+	uids = ALLOCV_N(afs_int32, buf, n);
+
+	ensure_initialized();
+	names.namelist_len = 0;
+	names.namelist_val = ALLOCV_N(prname, nbuf, n);
+	for (i = 0; i < n; i++) {
+		v = RARRAY_AREF(users, i);
+		if (TYPE(v) == T_STRING) {
+			assert_name_ok(v);
+			strncpy(names.namelist_val[names.namelist_len++],
+				StringValueCStr(v), PR_MAXNAMELEN);
+		} else if (rb_obj_is_kind_of(v, cProtectionObject)) {
+			GetProtectionObject(v, po);
+			uids[i] = po->e.id;
+		} else
+			uids[i] = NUM2INT(v);
+	}
+	if (names.namelist_len > 0) {
+		ids = ALLOCV_N(afs_int32, ibuf, names.namelist_len);
+		names_to_ids(&names, ids);
+		for (i = j = 0; i < n; i++)
+			if (TYPE(RARRAY_AREF(users, i)) == T_STRING)
+				uids[i] = ids[j++];
+		ALLOCV_END(ibuf);
+	}
+	ALLOCV_END(nbuf);
+
+	rv = rb_hash_new();
+	for (i = 0; i < n; i++) {
+		v = RARRAY_AREF(users, i);
+		if (TYPE(v) == T_STRING && uids[i] == ANONYMOUSID)
+			rb_raise(eAFSLibraryError, "no such user `%s'",
+				 StringValueCStr(v));
+		cps_group_ids(uids[i], &cps);
+		rb_hash_aset(rv, v, cps_to_ary_free(&cps, cache));
+	}
+	ALLOCV_END(buf);
+	return (rv);
+}
+
+/* The member ids of the entry "id", as an AFS::MemberSet. */
+static VALUE
+member_set_of(afs_int32 id)
+{
+	struct member_set_object *mso;
+	VALUE obj;
+	idlist ids;
+	int error;
+
+	member_ids(id, &ids);
+	obj = memberset_alloc(cMemberSet);
+	GetMemberSet(obj, mso);
+	error = ms_build(&mso->ms, ids.idlist_val, ids.idlist_len);
+	if (ids.idlist_val != NULL)
+		free(ids.idlist_val);
+	if (error != 0)
+		rb_memerror();
+	return (obj);
+}
+
+/*
+ * Like group_members(), but return the member ids as an AFS::MemberSet
+ * without looking up each member.
+ */
+static VALUE
+group_member_set(VALUE self)
+{
+	struct protection_object *po;
+
+	GetProtectionObject(self, po);
+	assert_not_deleted(po);
+	return (member_set_of(po->e.id));
+}
+
+/*
+ * Group.member_set(group): the same for a Group, ptsid or name, without
+ * making a Group first (which would cost a pr_ListEntry call).
+ */
+static VALUE
+group_member_set_of(VALUE self, VALUE group)
+{
+	struct protection_object *po;
+	afs_int32 id;
+	int error;
+
+	if (rb_obj_is_kind_of(group, cProtectionObject)) {
+		GetProtectionObject(group, po);
+		assert_not_deleted(po);
+		id = po->e.id;
+	} else if (TYPE(group) == T_STRING) {
+		assert_name_ok(group);
+		ensure_initialized();
+		error = rpc_SNameToId(StringValueCStr(group), &id);
+		assert_success(error, "pr_SNameToId");
+		if (id == ANONYMOUSID)
+			rb_raise(eAFSLibraryError, "no such group `%s'",
+				 StringValueCStr(group));
+	} else
+		id = NUM2INT(group);
+	return (member_set_of(id));
+}
+
+static VALUE
+group_get_owner(VALUE self)
+{
+	struct protection_object *po;
+
+	GetProtectionObject(self, po);
+	return (po_new(cProtectionObject, INT2NUM(po->e.owner)));
+}
+
+static VALUE
+group_set_owner(VALUE self, VALUE newowner)
+{
+	struct protection_object *po;
+	struct prcheckentry e;
+	VALUE name;
+	int error;
+
+	GetProtectionObject(self, po);
+	assert_modifiable(self, po);
+	name = get_name(newowner);
+
+	assert_name_ok(name);
+	ensure_initialized();
+	/* bogus interface: newname must be passed as "" rather than NULL */
+	error = rpc_ChangeEntry(po->e.name, "", NULL, StringValueCStr(name));
+	assert_success(error, "pr_ChangeEntry");
+
+	error = rpc_ListEntry(po->e.id, &e);
+	assert_success(error, "pr_ListEntry");
+	po->e.owner = e.owner;
+
+	return (name);
+}
+
+static VALUE
+group_has_member_p(VALUE self, VALUE other)
+{
+	struct protection_object *po;
+	int error;
+	VALUE name;
+	afs_int32 flag;
+
+	GetProtectionObject(self, po);
+	assert_not_deleted(po);
+	name = get_name(other);
+	assert_name_ok(name);
+	ensure_initialized();
+	error = rpc_IsAMemberOf(StringValueCStr(name), po->e.name, &flag);
+	assert_success(error, "pr_IsAMemberOf");
+	return (flag ? Qtrue : Qfalse);
+}
+
+static VALUE
+po_is_member_p(VALUE self, VALUE group)
+{
+	struct protection_object *po;
+	int error;
+	VALUE name;
+	afs_int32 flag;
+
+	GetProtectionObject(self, po);
+	assert_not_deleted(po);
+	name = get_name(group);
+	assert_name_ok(name);
+	ensure_initialized();
+	error = rpc_IsAMemberOf(po->e.name, StringValueCStr(name), &flag);
+	assert_success(error, "pr_IsAMemberOf");
+	return (flag ? Qtrue : Qfalse);
+}
+
+static VALUE
+po_delete_instance(VALUE self)
+{
+	struct protection_object *po;
+	int error;
+
+	GetProtectionObject(self, po);
+	assert_modifiable(self, po);
+	ensure_initialized();
+	error = rpc_DeleteByID(po->e.id);
+	assert_success(error, "pr_DeleteByID");
+	po->deleted = 1;
+	rb_obj_freeze(self);
+	return (self);
+}
+
+/*
+ * Re-read the entry from the protection database.
+ */
+static VALUE
+po_refresh(VALUE self)
+{
+	struct protection_object *po;
+	int error;
+
+	GetProtectionObject(self, po);
+	assert_modifiable(self, po);
+	ensure_initialized();
+	pr_cache_forget(po->e.id);
+	error = rpc_ListEntry(po->e.id, &po->e);
+	assert_success(error, "pr_ListEntry");
+	return (self);
+}
+
+static VALUE
+po_deleted_p(VALUE self)
+{
+	struct protection_object *po;
+
+	GetProtectionObject(self, po);
+	return (po->deleted ? Qtrue : Qfalse);
+}
+
+static VALUE
+po_get_id(VALUE self)
+{
+	struct protection_object *po;
+
+	GetProtectionObject(self, po);
+	return (INT2NUM(po->e.id));
+}
+
+static VALUE
+po_set_id(VALUE self, VALUE newval)
+{
+	struct protection_object *po;
+	int error;
+	afs_int32 newval_i;
+
+	GetProtectionObject(self, po);
+	assert_modifiable(self, po);
+	ensure_initialized();
+	newval_i = NUM2INT(newval);
+	/* bogus interface: newname must be passed as "" rather than NULL */
+	error = rpc_ChangeEntry(po->e.name, "", &newval_i, NULL);
+	assert_success(error, "pr_ChangeEntry");
+	po->e.id = newval_i;
+	return (INT2NUM(newval_i));
+}
+
+static VALUE
+po_get_name(VALUE self)
+{
+	struct protection_object *po;
+
+	GetProtectionObject(self, po);
+	return (rb_str_new2(po->e.name));
+}
+
+static VALUE
+po_set_name(VALUE self, VALUE newval)
+{
+	struct protection_object *po;
+	int error;
+
+	GetProtectionObject(self, po);
+	assert_modifiable(self, po);
+	ensure_initialized();
+	assert_name_ok(newval);
+	error = rpc_ChangeEntry(po->e.name, StringValueCStr(newval),
+				NULL, NULL);
+	assert_success(error, "pr_ChangeEntry");
+	error = rpc_ListEntry(po->e.id, &po->e);
+	assert_success(error, "pr_ListEntry");
+	return (newval);
+}
+
+static VALUE
+po_get_flags(VALUE self)
+{
+	struct protection_object *po;
+
+	GetProtectionObject(self, po);
+	return (INT2NUM(po->e.flags));
+}
+
+static VALUE
+po_set_flags(VALUE self, VALUE newval)
+{
+	struct protection_object *po;
+	afs_int32 error, flags;
+
+	GetProtectionObject(self, po);
+	assert_modifiable(self, po);
+	flags = NUM2INT(newval);
+
+	ensure_initialized();
+	error = rpc_SetFieldsEntry(po->e.id, PR_SF_ALLBITS, flags, 0, 0);
+	assert_success(error, "pr_SetFieldsEntry");
+	po->e.flags = flags;
+	return (newval);
+}
+
+static VALUE
+po_get_creator(VALUE self)
+{
+	struct protection_object *po;
+
+	GetProtectionObject(self, po);
+	return (po_new(cProtectionObject, INT2NUM(po->e.creator)));
+}
+
+/*
+ * The raw ids behind #creator and #owner, which avoid looking up the
+ * referenced entry.
+ */
+static VALUE
+po_get_creator_id(VALUE self)
+{
+	struct protection_object *po;
+
+	GetProtectionObject(self, po);
+	return (INT2NUM(po->e.creator));
+}
+
+static VALUE
+po_get_owner_id(VALUE self)
+{
+	struct protection_object *po;
+
+	GetProtectionObject(self, po);
+	return (INT2NUM(po->e.owner));
+}
+
+static VALUE
+po_ownerships(VALUE self)
+{
+	struct protection_object *po;
+	int block_given, error, i;
+	VALUE ary, obj;
+	namelist owned;
+	idlist owned_ids;
+	afs_int32 id, more;
+
+	block_given = rb_block_given_p();
+	if (block_given)
+		ary = Qnil;
+	else
+		ary = rb_ary_new();
+	more = 0;
+
+	GetProtectionObject(self, po);
+	assert_not_deleted(po);
+	ensure_initialized();
+
+	do {
+		owned.namelist_len = 0;
+		owned.namelist_val = NULL;
+		error = rpc_ListOwned(po->e.id, &owned, &more);
+		assert_success(error, "pr_ListOwned");
+		if (owned.namelist_len > 0) {
+			owned_ids.idlist_len = 0;
+			owned_ids.idlist_val = NULL;
+			error = rpc_NameToId(&owned, &owned_ids);
+			assert_success(error, "pr_NameToId");
+			for (i = 0; i < owned_ids.idlist_len; i++) {
+				id = owned_ids.idlist_val[i];
+				obj = po_new(cProtectionObject, INT2NUM(id));
+				if (block_given)
+					rb_yield(obj);
+				else
+					rb_ary_push(ary, obj);
+			}
+			if (owned_ids.idlist_val != NULL)
+				free(owned_ids.idlist_val);
+		}
+		if (owned.namelist_val != NULL)
+			free(owned.namelist_val);
+	} while (more);
+	return (ary);
+}
+
+static VALUE
+user_get_group_quota(VALUE self)
+{
+	struct protection_object *po;
+
+	GetProtectionObject(self, po);
+	assert_not_deleted(po);
+	return (INT2NUM(po->e.ngroups));
+}
+
+static VALUE
+user_set_group_quota(VALUE self, VALUE newval)
+{
+	struct protection_object *po;
+	afs_int32 error, ngroups;
+
+	GetProtectionObject(self, po);
+	assert_modifiable(self, po);
+	ngroups = NUM2INT(newval);
+
+	ensure_initialized();
+	error = rpc_SetFieldsEntry(po->e.id, PR_SF_NGROUPS, 0, ngroups, 0);
+	assert_success(error, "pr_SetFieldsEntry");
+	po->e.ngroups = ngroups;
+	return (newval);
+}
+
+static VALUE
+user_get_group_count(VALUE self)
+{
+	struct protection_object *po;
+
+	GetProtectionObject(self, po);
+	assert_not_deleted(po);
+	return (INT2NUM(po->e.count));
+}
+
+static VALUE
+group_get_user_quota(VALUE self)
+{
+	struct protection_object *po;
+
+	GetProtectionObject(self, po);
+	assert_not_deleted(po);
+	return (INT2NUM(po->e.nusers));
+}
+
+static VALUE
+group_set_user_quota(VALUE self, VALUE newval)
+{
+	struct protection_object *po;
+	afs_int32 error, nusers;
+
+	GetProtectionObject(self, po);
+	assert_modifiable(self, po);
+	nusers = NUM2INT(newval);
+
+	ensure_initialized();
+	error = rpc_SetFieldsEntry(po->e.id, PR_SF_NUSERS, 0, 0, nusers);
+	assert_success(error, "pr_SetFieldsEntry");
+	po->e.nusers = nusers;
+	return (newval);
+}
+
+static VALUE
+group_get_user_count(VALUE self)
+{
+	struct protection_object *po;
+
+	GetProtectionObject(self, po);
+	assert_not_deleted(po);
+	return (INT2NUM(po->e.count));
+}
+
+static VALUE
+po_equal(VALUE self, VALUE other)
+{
+	struct protection_object *po1, *po2;
+
+	if (CLASS_OF(other) != CLASS_OF(self))
+		return (Qfalse);
+	GetProtectionObject(self, po1);
+	GetProtectionObject(other, po2);
+	return (po1->e.id == po2->e.id ? Qtrue : Qfalse);
+}
+
+
+/*
+ * AFS::MemberSet: a compressed set of ptsids (see member_set.h).
+ * Elements may be given either as Integers or as ProtectionObjects.
+ */
+static void
+memberset_free(void *p)
+{
+	struct member_set_object *mso = p;
+
+	ms_clear(&mso->ms);
+	xfree(mso);
+}
+
+static size_t
+memberset_memsize_internal(const void *p)
+{
+	const struct member_set_object *mso = p;
+
+	return (sizeof(*mso) + ms_memsize(&mso->ms));
+}
+
+static VALUE
+memberset_alloc(VALUE klass)
+{
+	struct member_set_object *mso;
+	VALUE obj;
+
+	obj = TypedData_Make_Struct(klass, struct member_set_object,
+				    &memberset_data_type, mso);
+	ms_init(&mso->ms);
+	mso->iterating = 0;
+	return (obj);
+}
+
+static struct member_set_object *
+get_member_set(VALUE obj)
+{
+	struct member_set_object *mso;
+
+	if (!rb_obj_is_kind_of(obj, cMemberSet))
+		rb_raise(rb_eTypeError, "expected AFS::MemberSet, got %s",
+			 rb_obj_classname(obj));
+	GetMemberSet(obj, mso);
+	return (mso);
+}
+
+static void
+assert_not_iterating(VALUE self, struct member_set_object *mso)
+{
+	rb_check_frozen(self);
+	if (mso->iterating)
+		rb_raise(rb_eRuntimeError,
+			 "can't modify MemberSet during iteration");
+}
+
+static afs_int32
+memberset_value_id(VALUE v)
+{
+	struct protection_object *po;
+
+	if (rb_obj_is_kind_of(v, cProtectionObject)) {
+		GetProtectionObject(v, po);
+		return (po->e.id);
+	}
+	return (NUM2INT(v));
+}
+
+/*
+ * MemberSet.new(ids = nil): the optional argument may be any Enumerable
+ * of ids or ProtectionObjects.
+ */
+static VALUE
+memberset_initialize(int argc, VALUE *argv, VALUE self)
+{
+	struct member_set_object *mso;
+	VALUE ary, buf;
+	int32_t *ids;
+	long i, n;
+	int error;
+
+	if (argc > 1)
+		rb_raise(rb_eArgError,
+			 "wrong number of arguments (%d for 1)", argc);
+	GetMemberSet(self, mso);
+	assert_not_iterating(self, mso);
+	if (argc == 0 || argv[0] == Qnil)
+		return (self);
+
+	ary = rb_check_array_type(argv[0]);
+	if (ary == Qnil)
+		ary = rb_convert_type(argv[0], T_ARRAY, "Array", "to_a");
+	n = RARRAY_LEN(ary);
+	ids = ALLOCV_N(int32_t, buf, n);
+	for (i = 0; i < n; i++)
+		ids[i] = memberset_value_id(RARRAY_AREF(ary, i));
+	error = ms_build(&mso->ms, ids, n);
+	ALLOCV_END(buf);
+	if (error != 0)
+		rb_memerror();
+	return (self);
+}
+
+static VALUE
+memberset_initialize_copy(VALUE self, VALUE orig)
+{
+	struct member_set_object *mso, *src;
+
+	GetMemberSet(self, mso);
+	assert_not_iterating(self, mso);
+	src = get_member_set(orig);
+	ms_clear(&mso->ms);
+	if (ms_copy(&mso->ms, &src->ms) != 0)
+		rb_memerror();
+	return (self);
+}
+
+static VALUE
+memberset_add(VALUE self, VALUE id)
+{
+	struct member_set_object *mso;
+
+	GetMemberSet(self, mso);
+	assert_not_iterating(self, mso);
+	if (ms_add(&mso->ms, memberset_value_id(id)) != 0)
+		rb_memerror();
+	return (self);
+}
+
+static VALUE
+memberset_delete(VALUE self, VALUE id)
+{
+	struct member_set_object *mso;
+
+	GetMemberSet(self, mso);
+	assert_not_iterating(self, mso);
+	if (ms_remove(&mso->ms, memberset_value_id(id)) != 0)
+		rb_memerror();
+	return (self);
+}
+
+static VALUE
+memberset_include_p(VALUE self, VALUE id)
+{
+	struct member_set_object *mso;
+
+	GetMemberSet(self, mso);
+	return (ms_contains(&mso->ms, memberset_value_id(id)) ?
+		Qtrue : Qfalse);
+}
+
+/*
+ * MemberSet#include_many(ids): whether each of an Array of ids or
+ * ProtectionObjects is in the set, as an Array of true and false.
+ */
+static VALUE
+memberset_include_many(VALUE self, VALUE ids)
+{
+	struct member_set_object *mso;
+	VALUE ary;
+	long i, n;
+
+	GetMemberSet(self, mso);
+	ids = rb_convert_type(ids, T_ARRAY, "Array", "to_a");
+	n = RARRAY_LEN(ids);
+	ary = rb_ary_new_capa(n);
+	for (i = 0; i < n; i++)
+		rb_ary_push(ary, ms_contains(&mso->ms,
+		    memberset_value_id(RARRAY_AREF(ids, i))) ?
+		    Qtrue : Qfalse);
+	return (ary);
+}
+
+static VALUE
+memberset_size(VALUE self)
+{
+	struct member_set_object *mso;
+
+	GetMemberSet(self, mso);
+	return (SIZET2NUM(ms_cardinality(&mso->ms)));
+}
+
+static VALUE
+memberset_empty_p(VALUE self)
+{
+	struct member_set_object *mso;
+
+	GetMemberSet(self, mso);
+	return (mso->ms.nc == 0 ? Qtrue : Qfalse);
+}
+
+static int
+memberset_yield(int32_t id, void *arg)
+{
+	rb_yield(INT2NUM(id));
+	return (0);
+}
 
-	return (po_new(self, INT2NUM(id)));
+static VALUE
+memberset_each_body(VALUE self)
+{
+	struct member_set_object *mso;
+
+	GetMemberSet(self, mso);
+	ms_each(&mso->ms, memberset_yield, NULL);
+	return (self);
 }
 
-/*
- * Create a group.
- * One argument (the name) in mandatory.
- * The second argument (the ID) and the third argument (the owner) are
- * optional.
- */
 static VALUE
-group_create(int argc, VALUE *argv, VALUE self)
+memberset_each_ensure(VALUE self)
 {
-	afs_int32 id;
-	int error;
-	char *owner;
-	VALUE oobj;
+	struct member_set_object *mso;
 
-	if (argc < 1 || argc > 3)
-		rb_raise(rb_eArgError, 
-			 "wrong number of arguments (%d for 3)", argc);
-	if (argc == 3) {
-		oobj = get_name(argv[2]);
-		assert_name_ok(oobj);
-		owner = StringValueCStr(oobj);
-	} else
-		owner = NULL;
+	GetMemberSet(self, mso);
+	mso->iterating--;
+	return (Qnil);
+}
 
-	if (argc >= 2 && argv[1] != Qnil) {
-		id = NUM2INT(argv[1]);
-		if (id >= 0)
-			rb_raise(eAFSLibraryError,
-				 "ptsid (%ld) must be negative for groups",
-				 (long)id);
-	} else
-		id = 0;		/* special flag to pr_CreateGroup */
-	assert_name_ok(argv[0]);
-	ensure_initialized();
-	error = pr_CreateGroup(StringValueCStr(argv[0]), owner, &id);
-	assert_success(error, "pr_CreateGroup");
+static VALUE
+memberset_each(VALUE self)
+{
+	struct member_set_object *mso;
+
+	RETURN_SIZED_ENUMERATOR(self, 0, 0, memberset_size);
+	/* A frozen set cannot change, and may be shared with other Ractors. */
+	if (OBJ_FROZEN(self))
+		return (memberset_each_body(self));
+	GetMemberSet(self, mso);
+	mso->iterating++;
+	return (rb_ensure(memberset_each_body, self,
+			  memberset_each_ensure, self));
+}
 
-	return (po_new(self, INT2NUM(id)));
+static VALUE
+memberset_to_a(VALUE self)
+{
+	struct member_set_object *mso;
+	VALUE ary, buf;
+	int32_t *ids;
+	size_t i, n;
+
+	GetMemberSet(self, mso);
+	n = ms_cardinality(&mso->ms);
+	ids = ALLOCV_N(int32_t, buf, n);
+	ms_to_array(&mso->ms, ids);
+	ary = rb_ary_new_capa(n);
+	for (i = 0; i < n; i++)
+		rb_ary_push(ary, INT2NUM(ids[i]));
+	ALLOCV_END(buf);
+	return (ary);
 }
 
 static VALUE
-po_translate(VALUE self, VALUE id_or_name)
+memberset_setop(VALUE self, VALUE other,
+    int (*op)(struct member_set *, const struct member_set *,
+	const struct member_set *))
 {
+	struct member_set_object *a, *b, *r;
 	VALUE obj;
-	afs_int32 id;
-	int error;
-	char name[PR_MAXNAMELEN + 1];
-
-	ensure_initialized();
-	if (TYPE(id_or_name) == T_STRING) {
-		assert_name_ok(id_or_name);
-		error = pr_SNameToId(StringValueCStr(id_or_name), &id);
-		assert_success(error, "pr_SNameToId");
-		obj = INT2NUM(id);
-	} else {
-		error = pr_SIdToName(NUM2INT(id_or_name), name);
-		assert_success(error, "pr_SIdToName");
-		name[PR_MAXNAMELEN] = '\0'; /* make sure it's terminated */
-		obj = rb_str_new2(name);
-	}
 
+	a = get_member_set(self);
+	b = get_member_set(other);
+	obj = memberset_alloc(cMemberSet);
+	GetMemberSet(obj, r);
+	if (op(&r->ms, &a->ms, &b->ms) != 0)
+		rb_memerror();
 	return (obj);
 }
 
+static VALUE
+memberset_union(VALUE self, VALUE other)
+{
+	return (memberset_setop(self, other, ms_union));
+}
+
+static VALUE
+memberset_intersection(VALUE self, VALUE other)
+{
+	return (memberset_setop(self, other, ms_intersection));
+}
+
+static VALUE
+memberset_difference(VALUE self, VALUE other)
+{
+	return (memberset_setop(self, other, ms_difference));
+}
+
+static VALUE
+memberset_equal(VALUE self, VALUE other)
+{
+	struct member_set_object *a, *b;
+
+	if (!rb_obj_is_kind_of(other, cMemberSet))
+		return (Qfalse);
+	GetMemberSet(self, a);
+	GetMemberSet(other, b);
+	return (ms_equal(&a->ms, &b->ms) ? Qtrue : Qfalse);
+}
+
 /*
- * Get a list of protection objects, yielding them one at a time (if a block 
- * is given) or returning them in an array (otherwise).
+ * Bytes of heap used by the set's containers (not counting the Ruby
+ * object itself).
  */
 static VALUE
-find_all_internal(VALUE self, int flags)
+memberset_memsize(VALUE self)
 {
-	afs_int32 index, nentries, nextindex, error;
-	struct prlistentries *e;
-	VALUE ary, obj;
-	int block_given, i;
-	struct protection_object *po;
+	struct member_set_object *mso;
 
-	ensure_initialized();
-	block_given = rb_block_given_p();
-	if (!block_given)
-		ary = rb_ary_new();
-	else
-		ary = Qnil;
+	GetMemberSet(self, mso);
+	return (SIZET2NUM(ms_memsize(&mso->ms)));
+}
 
-	nextindex = 0;
-	do {
-		e = NULL;
-		index = nextindex;
-		error = pr_ListEntries(flags, index, &nentries, &e, 
-				       &nextindex);
-		assert_success(error, "pr_ListEntries");
+static VALUE
+memberset_inspect(VALUE self)
+{
+	struct member_set_object *mso;
 
-		for (i = 0; i < nentries; i++) {
-			/*
-			 * Avoid making a pr_ListEntry call for each
-			 * object returned by copying the data from
-			 * our "struct prlistentries" into the object's
-			 * "struct prcheckentry" manually.  (They are
-			 * actually identical structures, but we can't
-			 * depend on this.)
-			 */
-			obj = po_new_internal(e[i].id < 0 ? cGroup : cUser);
-			Data_Get_Struct(obj, struct protection_object, po);
-			po->e.flags = e[i].flags;
-			po->e.id = e[i].id;
-			po->e.owner = e[i].owner;
-			po->e.creator = e[i].creator;
-			po->e.ngroups = e[i].ngroups;
-			po->e.nusers = e[i].nusers;
-			po->e.count = e[i].count;
-			strncpy(po->e.name, e[i].name, PR_MAXNAMELEN);
+	GetMemberSet(self, mso);
+	return (rb_sprintf("#<%"PRIsVALUE" size=%lu>", rb_obj_class(self),
+			   (unsigned long)ms_cardinality(&mso->ms)));
+}
 
-			if (block_given)
-				rb_yield(obj);
-			else
-				rb_ary_push(ary, obj);
-		}
+/*
+ * AFS::EntryTable is a frozen snapshot of the protection database (see
+ * entry_table.h).  Load one before forking worker processes and they all
+ * share it; ProtectionObjects are made only for the entries asked for.
+ * Scanning the database connects to the ptserver, so workers forked
+ * after that can only read the table, not make calls of their own;
+ * EntryTable.load reads an afs-ptdump snapshot instead, and does not.
+ */
+static void
+entrytable_free(void *p)
+{
+	struct entry_table *t = p;
 
-		if (e != NULL)
-			free(e);
-	} while (nextindex > index);
-	return (ary);
+	et_free(t);
+	xfree(t);
 }
 
-static VALUE
-group_find_all(VALUE self)
+static size_t
+entrytable_memsize_internal(const void *p)
 {
-	return (find_all_internal(self, PRGROUPS));
+	const struct entry_table *t = p;
+
+	return (sizeof(*t) + et_memsize(t));
 }
 
 static VALUE
-user_find_all(VALUE self)
+entrytable_alloc(VALUE klass)
 {
-	return (find_all_internal(self, PRUSERS));
+	struct entry_table *t;
+	VALUE obj;
+
+	obj = TypedData_Make_Struct(klass, struct entry_table,
+				    &entrytable_data_type, t);
+	et_init(t);
+	return (obj);
 }
 
-static VALUE
-po_find_all(VALUE self)
+/* The pr_ListEntries flags for the entries of class "klass". */
+static int
+entrytable_flags(VALUE klass)
 {
-	return (find_all_internal(self, PRGROUPS | PRUSERS));
+	if (klass == cUser)
+		return (PRUSERS);
+	if (klass == cGroup)
+		return (PRGROUPS);
+	if (klass != cProtectionObject)
+		rb_raise(rb_eArgError, "expected AFS::User, AFS::Group, "
+			 "or AFS::ProtectionObject");
+	return (PRUSERS | PRGROUPS);
 }
 
+/*
+ * EntryTable.new(klass = AFS::ProtectionObject): load every entry that
+ * klass.find_all would return.
+ */
 static VALUE
-group_get_max_id(VALUE self)
+entrytable_initialize(int argc, VALUE *argv, VALUE self)
 {
-	afs_int32 max_id;
-	int error;
+	struct entry_table *t;
+	afs_int32 error;
+	int flags;
+
+	if (argc > 1)
+		rb_raise(rb_eArgError,
+			 "wrong number of arguments (%d for 1)", argc);
+	rb_check_frozen(self);
+	GetEntryTable(self, t);
+	flags = entrytable_flags(argc == 1 ? argv[0] : cProtectionObject);
 
 	ensure_initialized();
-	error = pr_ListMaxGroupId(&max_id);
-	assert_success(error, "pr_ListMaxGroupId");
-	return (INT2NUM(max_id));
+	error = et_load(t, flags);
+	if (error == -1)
+		rb_memerror();
+	assert_success(error, "pr_ListEntries");
+	rb_obj_freeze(self);
+	return (self);
 }
 
+/*
+ * EntryTable.load(path, klass = AFS::ProtectionObject): a table of the
+ * entries in an afs-ptdump snapshot, made without connecting to the
+ * ptserver, so that workers forked afterwards can still make calls.
+ */
 static VALUE
-user_get_max_id(VALUE self)
+entrytable_s_load(int argc, VALUE *argv, VALUE klass)
 {
-	afs_int32 max_id;
-	int error;
-
-	ensure_initialized();
-	error = pr_ListMaxUserId(&max_id);
-	assert_success(error, "pr_ListMaxUserId");
-	return (INT2NUM(max_id));
+	struct entry_table *t;
+	VALUE path, which, self;
+	afs_int32 error;
+
+	rb_scan_args(argc, argv, "11", &path, &which);
+	FilePathValue(path);
+	self = entrytable_alloc(klass);
+	GetEntryTable(self, t);
+	error = et_load_snapshot(t, StringValueCStr(path),
+	    entrytable_flags(NIL_P(which) ? cProtectionObject : which));
+	if (error == ENOMEM)
+		rb_memerror();
+	if (error == -1)
+		rb_raise(eAFSLibraryError,
+			 "%"PRIsVALUE": not an afs-ptdump snapshot", path);
+	if (error != 0)
+		rb_syserr_fail_str(error, path);
+	rb_obj_freeze(self);
+	return (self);
 }
 
 static VALUE
-group_set_max_id(VALUE self, VALUE newval)
+entrytable_po(const struct entry_table *t, const struct et_entry *ent)
 {
-	afs_int32 max_id;
-	int error;
+	struct protection_object *po;
+	const char *name;
+	size_t len;
+	VALUE obj;
 
-	max_id = NUM2INT(newval);
-	ensure_initialized();
-	error = pr_SetMaxGroupId(max_id);
-	assert_success(error, "pr_SetMaxGroupId");
-	return (INT2NUM(max_id));
+	obj = po_new_internal(ent->id < 0 ? cGroup : cUser);
+	GetProtectionObject(obj, po);
+	po->e.flags = ent->flags;
+	po->e.id = ent->id;
+	po->e.owner = ent->owner;
+	po->e.creator = ent->creator;
+	po->e.ngroups = ent->ngroups;
+	po->e.nusers = ent->nusers;
+	po->e.count = ent->count;
+	/* The table keeps no more than PR_MAXNAMELEN - 1 bytes of a name. */
+	name = ET_NAME(t, ent);
+	len = strnlen(name, PR_MAXNAMELEN - 1);
+	memcpy(po->e.name, name, len);
+	po->e.name[len] = '\0';
+	return (obj);
+}
+
+static const struct et_entry *
+entrytable_find(const struct entry_table *t, VALUE id_or_name)
+{
+	if (TYPE(id_or_name) == T_STRING)
+		return (et_find_name(t, StringValueCStr(id_or_name)));
+	return (et_find_id(t, NUM2INT(id_or_name)));
 }
 
 static VALUE
-user_set_max_id(VALUE self, VALUE newval)
+entrytable_size(VALUE self)
 {
-	afs_int32 max_id;
-	int error;
+	struct entry_table *t;
 
-	max_id = NUM2INT(newval);
-	ensure_initialized();
-	error = pr_SetMaxUserId(max_id);
-	assert_success(error, "pr_SetMaxUserId");
-	return (INT2NUM(max_id));
+	GetEntryTable(self, t);
+	return (SIZET2NUM(t->n));
 }
 
+/*
+ * table[id_or_name]: a new User or Group for the entry, or nil.
+ */
 static VALUE
-po_add_to_group(VALUE self, VALUE group)
+entrytable_aref(VALUE self, VALUE id_or_name)
 {
-	struct protection_object *po;
-	int error;
-	VALUE gname;
-
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
+	const struct et_entry *ent;
+	struct entry_table *t;
 
-	gname = get_name(group);
-	assert_name_ok(gname);
-	ensure_initialized();
-	error = pr_AddToGroup(po->e.name, StringValueCStr(gname));
-	assert_success(error, "pr_AddToGroup");
-	return (group_new(cGroup, gname));
+	GetEntryTable(self, t);
+	ent = entrytable_find(t, id_or_name);
+	return (ent != NULL ? entrytable_po(t, ent) : Qnil);
 }
 
 static VALUE
-po_remove_from_group(VALUE self, VALUE group)
+entrytable_include_p(VALUE self, VALUE id_or_name)
 {
-	struct protection_object *po;
-	int error;
-	VALUE gname;
+	struct entry_table *t;
 
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
+	GetEntryTable(self, t);
+	return (entrytable_find(t, id_or_name) != NULL ? Qtrue : Qfalse);
+}
 
-	gname = get_name(group);
-	assert_name_ok(gname);
-	ensure_initialized();
-	error = pr_RemoveUserFromGroup(po->e.name, StringValueCStr(gname));
-	assert_success(error, "pr_RemoveUserFromGroup");
-	return (group_new(cGroup, gname));
+static VALUE
+entrytable_id_of(VALUE self, VALUE name)
+{
+	const struct et_entry *ent;
+	struct entry_table *t;
+
+	GetEntryTable(self, t);
+	ent = et_find_name(t, StringValueCStr(name));
+	return (ent != NULL ? INT2NUM(ent->id) : Qnil);
 }
 
 static VALUE
-group_add_member(VALUE self, VALUE member)
+entrytable_name_of(VALUE self, VALUE id)
 {
-	struct protection_object *po;
-	int error;
-	VALUE poname;
+	const struct et_entry *ent;
+	struct entry_table *t;
 
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	poname = get_name(member);
-	ensure_initialized();
-	assert_name_ok(poname);
-	error = pr_AddToGroup(po->e.name, StringValueCStr(poname));
-	assert_success(error, "pr_AddToGroup");
-	return (self);
+	GetEntryTable(self, t);
+	ent = et_find_id(t, NUM2INT(id));
+	return (ent != NULL ? rb_str_new2(ET_NAME(t, ent)) : Qnil);
 }
 
+/*
+ * Yields a User or Group for each entry, in order of id.
+ */
 static VALUE
-group_remove_member(VALUE self, VALUE member)
+entrytable_each(VALUE self)
 {
-	struct protection_object *po;
-	int error;
-	VALUE poname;
+	struct entry_table *t;
+	size_t i;
 
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	poname = get_name(member);
-	ensure_initialized();
-	assert_name_ok(poname);
-	error = pr_RemoveUserFromGroup(po->e.name, StringValueCStr(poname));
-	assert_success(error, "pr_RemoveUserFromGroup");
+	RETURN_SIZED_ENUMERATOR(self, 0, 0, entrytable_size);
+	GetEntryTable(self, t);
+	for (i = 0; i < t->n; i++)
+		rb_yield(entrytable_po(t, &t->e[i]));
 	return (self);
 }
 
 static VALUE
-group_members(VALUE self)
+entrytable_memsize(VALUE self)
 {
-	struct protection_object *po;
-	int block_given, error, i;
-	VALUE ary, obj;
-	namelist members;
-	idlist member_ids;
+	struct entry_table *t;
 
-	block_given = rb_block_given_p();
-	if (block_given)
-		ary = Qnil;
-	else
-		ary = rb_ary_new();
-	members.namelist_len = 0;
-	members.namelist_val = NULL;
+	GetEntryTable(self, t);
+	return (SIZET2NUM(et_memsize(t)));
+}
 
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	ensure_initialized();
+static VALUE
+entrytable_inspect(VALUE self)
+{
+	struct entry_table *t;
 
-	error = pr_IDListMembers(po->e.id, &members);
-	assert_success(error, "pr_ListMembers");
-	if (members.namelist_len > 0) {
-		member_ids.idlist_len = 0;
-		member_ids.idlist_val = NULL;
-		error = pr_NameToId(&members, &member_ids);
-		assert_success(error, "pr_NameToId");
-		for (i = 0; i < member_ids.idlist_len; i++) {
-			obj = po_new(cProtectionObject, 
-				     INT2NUM(member_ids.idlist_val[i]));
-			if (block_given)
-				rb_yield(obj);
-			else
-				rb_ary_push(ary, obj);
-		}
-		if (member_ids.idlist_val != NULL)
-			free(member_ids.idlist_val);
-	}
-	if (members.namelist_val != NULL)
-		free(members.namelist_val);
-	return (ary);
+	GetEntryTable(self, t);
+	return (rb_sprintf("#<%"PRIsVALUE" size=%lu>", rb_obj_class(self),
+			   (unsigned long)t->n));
 }
 
 /*
- * For the moment at least, group_members() and user_memberships() have
- * identical implementations.
+ * AFS::GroupGraph analyzes how groups are nested in one another (see
+ * group_graph.h).  Each group is reported as a Hash, so the whole graph
+ * can go straight to JSON or CSV for a dashboard.
  */
-static VALUE
-user_memberships(VALUE self)
+static void
+groupgraph_free(void *p)
 {
-	return (group_members(self));
+	struct group_graph *gg = p;
+
+	gg_free(gg);
+	xfree(gg);
 }
 
-static VALUE
-group_get_owner(VALUE self)
+static size_t
+groupgraph_memsize_internal(const void *p)
 {
-	struct protection_object *po;
+	const struct group_graph *gg = p;
 
-	Data_Get_Struct(self, struct protection_object, po);
-	return (po_new(cProtectionObject, INT2NUM(po->e.owner)));
+	return (sizeof(*gg) + gg_memsize(gg));
 }
 
 static VALUE
-group_set_owner(VALUE self, VALUE newowner)
+groupgraph_alloc(VALUE klass)
 {
-	struct protection_object *po;
-	struct prcheckentry e;
-	VALUE name;
-	int error;
+	struct group_graph *gg;
+	VALUE obj;
 
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	name = get_name(newowner);
+	obj = TypedData_Make_Struct(klass, struct group_graph,
+				    &groupgraph_data_type, gg);
+	gg_init(gg);
+	return (obj);
+}
 
-	assert_name_ok(name);
-	ensure_initialized();
-	/* bogus interface: newname must be passed as "" rather than NULL */
-	error = pr_ChangeEntry(po->e.name, "", NULL, StringValueCStr(name));
-	assert_success(error, "pr_ChangeEntry");
+struct groupgraph_fetch {
+	struct group_graph *gg;
+	int jobs;
+	int error;
+};
 
-	error = pr_ListEntry(po->e.id, &e);
-	assert_success(error, "pr_ListEntry");
-	po->e.owner = e.owner;
+static void *
+groupgraph_fetch_nogvl(void *arg)
+{
+	struct groupgraph_fetch *f = arg;
 
-	return (name);
+	f->error = gg_fetch(f->gg, f->jobs);
+	return (NULL);
 }
 
-static VALUE
-group_has_member_p(VALUE self, VALUE other)
+static void
+groupgraph_cancel(void *arg)
 {
-	struct protection_object *po;
-	int error;
-	VALUE name;
-	afs_int32 flag;
-
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	name = get_name(other);
-	assert_name_ok(name);
-	ensure_initialized();
-	error = pr_IsAMemberOf(StringValueCStr(name), po->e.name, &flag);
-	assert_success(error, "pr_IsAMemberOf");
-	return (flag ? Qtrue : Qfalse);
+	((struct group_graph *)arg)->cancel = 1;
 }
 
+/*
+ * GroupGraph.new(jobs = AFS.worker_threads): list every group, fetch
+ * the members of up to "jobs" of them at a time, and analyze the
+ * result.  Groups whose members could not be listed are reported with
+ * the error and no members.
+ */
 static VALUE
-po_is_member_p(VALUE self, VALUE group)
+groupgraph_initialize(int argc, VALUE *argv, VALUE self)
 {
-	struct protection_object *po;
-	int error;
-	VALUE name;
-	afs_int32 flag;
+	struct groupgraph_fetch f;
+	struct group_graph *gg;
+	afs_int32 error;
+	VALUE jobs;
+
+	rb_scan_args(argc, argv, "01", &jobs);
+	rb_check_frozen(self);
+	GetGroupGraph(self, gg);
+	f.gg = gg;
+	f.jobs = NIL_P(jobs) ? pr_call_workers() : NUM2INT(jobs);
+	if (f.jobs < 1)
+		rb_raise(rb_eArgError, "need at least one job");
 
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	name = get_name(group);
-	assert_name_ok(name);
 	ensure_initialized();
-	error = pr_IsAMemberOf(po->e.name, StringValueCStr(name), &flag);
-	assert_success(error, "pr_IsAMemberOf");
-	return (flag ? Qtrue : Qfalse);
+	error = et_load(&gg->t, PRGROUPS);
+	if (error == -1)
+		rb_memerror();
+	assert_success(error, "pr_ListEntries");
+	/*
+	 * An interrupt makes the fetch give up, and Ruby raises it as soon
+	 * as the fetch returns.  If there was nothing to raise (a trap
+	 * handler ran, say), the fetch starts over.
+	 */
+	do {
+		gg->cancel = 0;
+		rb_thread_call_without_gvl(groupgraph_fetch_nogvl, &f,
+		    groupgraph_cancel, gg);
+	} while (gg->cancel);
+	if (f.error != 0 || gg_analyze(gg) != 0) {
+		gg_free(gg);
+		rb_memerror();
+	}
+	rb_obj_freeze(self);
+	return (self);
 }
 
-static VALUE
-po_delete_instance(VALUE self)
+static ssize_t
+groupgraph_find(const struct group_graph *gg, VALUE id_or_name)
 {
-	struct protection_object *po;
-	int error;
+	const struct et_entry *ent;
 
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	ensure_initialized();
-	error = pr_DeleteByID(po->e.id);
-	assert_success(error, "pr_DeleteByID");
-	po->deleted = 1;
-	rb_obj_freeze(self);
-	return (self);
+	if (TYPE(id_or_name) == T_STRING)
+		ent = et_find_name(&gg->t, StringValueCStr(id_or_name));
+	else
+		ent = et_find_id(&gg->t, NUM2INT(id_or_name));
+	return (ent != NULL ? ent - gg->t.e : -1);
 }
 
 static VALUE
-po_deleted_p(VALUE self)
+bounded(uint64_t v)
 {
-	struct protection_object *po;
+	return (v == GG_UNBOUNDED ? Qnil : ULL2NUM(v));
+}
 
-	Data_Get_Struct(self, struct protection_object, po);
-	return (po->deleted ? Qtrue : Qfalse);
+static VALUE
+groupgraph_report(const struct group_graph *gg, size_t i)
+{
+	const struct gg_node *node = &gg->g[i];
+	VALUE h;
+
+	h = rb_hash_new();
+	rb_hash_aset(h, SYM("id"), INT2NUM(gg->t.e[i].id));
+	rb_hash_aset(h, SYM("name"), rb_str_new2(ET_NAME(&gg->t, &gg->t.e[i])));
+	rb_hash_aset(h, SYM("depth"), UINT2NUM(node->depth));
+	rb_hash_aset(h, SYM("cycle"),
+	    node->cyclic ? UINT2NUM(node->scc) : Qnil);
+	rb_hash_aset(h, SYM("direct_users"), UINT2NUM(node->nusers));
+	rb_hash_aset(h, SYM("direct_groups"), UINT2NUM(node->nsub));
+	rb_hash_aset(h, SYM("transitive_users"), ULL2NUM(node->tusers));
+	rb_hash_aset(h, SYM("transitive_groups"), ULL2NUM(node->tgroups));
+	rb_hash_aset(h, SYM("expansion_calls"), bounded(node->calls));
+	rb_hash_aset(h, SYM("expanded_members"), bounded(node->expanded));
+	rb_hash_aset(h, SYM("error"), node->error == 0 ? Qnil :
+	    rb_str_new2(afs_error_message(node->error)));
+	return (h);
 }
 
 static VALUE
-po_get_id(VALUE self)
+groupgraph_size(VALUE self)
 {
-	struct protection_object *po;
+	struct group_graph *gg;
 
-	Data_Get_Struct(self, struct protection_object, po);
-	return (INT2NUM(po->e.id));
+	GetGroupGraph(self, gg);
+	return (SIZET2NUM(gg->t.n));
 }
 
+/*
+ * graph[id_or_name]: the report for one group, or nil.  The keys are
+ * :id, :name, :depth, :cycle (shared by every group in the same cycle,
+ * nil if in none), :direct_users, :direct_groups, :transitive_users,
+ * :transitive_groups, :expansion_calls and :expanded_members (nil if
+ * the expansion never ends), and :error.
+ */
 static VALUE
-po_set_id(VALUE self, VALUE newval)
+groupgraph_aref(VALUE self, VALUE id_or_name)
 {
-	struct protection_object *po;
-	int error;
-	afs_int32 newval_i;
+	struct group_graph *gg;
+	ssize_t i;
 
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	ensure_initialized();
-	newval_i = NUM2INT(newval);
-	/* bogus interface: newname must be passed as "" rather than NULL */
-	error = pr_ChangeEntry(po->e.name, "", &newval_i, NULL);
-	assert_success(error, "pr_ChangeEntry");
-	po->e.id = newval_i;
-	return (INT2NUM(newval_i));
+	GetGroupGraph(self, gg);
+	i = groupgraph_find(gg, id_or_name);
+	return (i >= 0 ? groupgraph_report(gg, i) : Qnil);
 }
 
+/*
+ * The names of the groups that are direct members of a group.
+ */
 static VALUE
-po_get_name(VALUE self)
+groupgraph_subgroups(VALUE self, VALUE id_or_name)
 {
-	struct protection_object *po;
+	const struct gg_node *node;
+	struct group_graph *gg;
+	VALUE ary;
+	ssize_t i;
+	uint32_t e;
+
+	GetGroupGraph(self, gg);
+	if ((i = groupgraph_find(gg, id_or_name)) < 0)
+		return (Qnil);
+	node = &gg->g[i];
+	ary = rb_ary_new2(node->nsub);
+	for (e = 0; e < node->nsub; e++)
+		rb_ary_push(ary, rb_str_new2(ET_NAME(&gg->t,
+		    &gg->t.e[gg->edges[node->sub + e]])));
+	return (ary);
+}
 
-	Data_Get_Struct(self, struct protection_object, po);
-	return (rb_str_new2(po->e.name));
+static int
+cycle_cmp(const void *a, const void *b)
+{
+	long x = RARRAY_LEN(*(const VALUE *)a);
+	long y = RARRAY_LEN(*(const VALUE *)b);
+
+	return (x > y ? -1 : x < y);
 }
 
+/*
+ * The names of the groups in each cycle, largest cycle first.
+ */
 static VALUE
-po_set_name(VALUE self, VALUE newval)
+groupgraph_cycles(VALUE self)
 {
-	struct protection_object *po;
-	int error;
-
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	ensure_initialized();
-	assert_name_ok(newval);
-	error = pr_ChangeEntry(po->e.name, StringValueCStr(newval),
-			       NULL, NULL);
-	assert_success(error, "pr_ChangeEntry");
-	error = pr_ListEntry(po->e.id, &po->e);
-	assert_success(error, "pr_ListEntry");
-	return (newval);
+	struct group_graph *gg;
+	VALUE by_scc, ary, names;
+	size_t i;
+
+	GetGroupGraph(self, gg);
+	by_scc = rb_hash_new();
+	for (i = 0; i < gg->t.n; i++) {
+		if (!gg->g[i].cyclic)
+			continue;
+		names = rb_hash_lookup(by_scc, UINT2NUM(gg->g[i].scc));
+		if (NIL_P(names)) {
+			names = rb_ary_new();
+			rb_hash_aset(by_scc, UINT2NUM(gg->g[i].scc), names);
+		}
+		rb_ary_push(names, rb_str_new2(ET_NAME(&gg->t, &gg->t.e[i])));
+	}
+	ary = rb_funcall(by_scc, rb_intern("values"), 0);
+	RARRAY_PTR_USE(ary, p,
+	    qsort(p, RARRAY_LEN(ary), sizeof(VALUE), cycle_cmp));
+	return (ary);
 }
 
+/*
+ * Yields the report for each group, in order of id.
+ */
 static VALUE
-po_get_flags(VALUE self)
+groupgraph_each(VALUE self)
 {
-	struct protection_object *po;
+	struct group_graph *gg;
+	size_t i;
 
-	Data_Get_Struct(self, struct protection_object, po);
-	return (INT2NUM(po->e.flags));
+	RETURN_SIZED_ENUMERATOR(self, 0, 0, groupgraph_size);
+	GetGroupGraph(self, gg);
+	for (i = 0; i < gg->t.n; i++)
+		rb_yield(groupgraph_report(gg, i));
+	return (self);
 }
 
 static VALUE
-po_set_flags(VALUE self, VALUE newval)
+groupgraph_memsize(VALUE self)
 {
-	struct protection_object *po;
-	afs_int32 error, flags;
-
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	flags = NUM2INT(newval);
+	struct group_graph *gg;
 
-	ensure_initialized();
-	error = pr_SetFieldsEntry(po->e.id, PR_SF_ALLBITS, flags, 0, 0);
-	assert_success(error, "pr_SetFieldsEntry");
-	po->e.flags = flags;
-	return (newval);
+	GetGroupGraph(self, gg);
+	return (SIZET2NUM(gg_memsize(gg)));
 }
 
 static VALUE
-po_get_creator(VALUE self)
+groupgraph_inspect(VALUE self)
 {
-	struct protection_object *po;
+	struct group_graph *gg;
 
-	Data_Get_Struct(self, struct protection_object, po);
-	return (po_new(cProtectionObject, INT2NUM(po->e.creator)));
+	GetGroupGraph(self, gg);
+	return (rb_sprintf("#<%"PRIsVALUE" size=%lu edges=%lu>",
+			   rb_obj_class(self), (unsigned long)gg->t.n,
+			   (unsigned long)gg->nedges));
 }
 
+/*
+ * AFS::PrivacyFlags converts between flag bits and their string form
+ * (see privacy_flags.h).  The methods can be called on the module or
+ * mixed in, as the Ruby versions they replace were.
+ */
 static VALUE
-po_ownerships(VALUE self)
+pf_string(afs_int32 flags)
 {
-	struct protection_object *po;
-	int block_given, error, i;
-	VALUE ary, obj;
-	namelist owned;
-	idlist owned_ids;
-	afs_int32 id, more;
+	char buf[PF_STRLEN + 1];
 
-	block_given = rb_block_given_p();
-	if (block_given)
-		ary = Qnil;
-	else
-		ary = rb_ary_new();
-	more = 0;
+	pf_to_s(flags, buf);
+	return (rb_str_new(buf, PF_STRLEN));
+}
 
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	ensure_initialized();
+static afs_int32
+pf_parse(VALUE sval)
+{
+	const char *bad;
+	afs_int32 flags;
+
+	StringValue(sval);
+	bad = pf_from_s(RSTRING_PTR(sval), RSTRING_LEN(sval), &flags);
+	if (bad != NULL)
+		rb_raise(eAFSLibraryError, "invalid privacy flag '%c'", *bad);
+	return (flags);
+}
 
-	do {
-		owned.namelist_len = 0;
-		owned.namelist_val = NULL;
-		error = pr_ListOwned(po->e.id, &owned, &more);
-		assert_success(error, "pr_ListOwned");
-		if (owned.namelist_len > 0) {
-			owned_ids.idlist_len = 0;
-			owned_ids.idlist_val = NULL;
-			error = pr_NameToId(&owned, &owned_ids);
-			assert_success(error, "pr_NameToId");
-			for (i = 0; i < owned_ids.idlist_len; i++) {
-				id = owned_ids.idlist_val[i];
-				obj = po_new(cProtectionObject, INT2NUM(id));
-				if (block_given)
-					rb_yield(obj);
-				else
-					rb_ary_push(ary, obj);
-			}
-			if (owned_ids.idlist_val != NULL)
-				free(owned_ids.idlist_val);
-		}
-		if (owned.namelist_val != NULL)
-			free(owned.namelist_val);
-	} while (more);
-	return (ary);
+/*
+ * Flags given as a String ("S-M--") or as an Integer.
+ */
+static afs_int32
+pf_value(VALUE v)
+{
+	return (TYPE(v) == T_STRING ? pf_parse(v) : NUM2INT(v));
 }
 
 static VALUE
-user_get_group_quota(VALUE self)
+pf_to_s_method(VALUE self, VALUE ival)
 {
-	struct protection_object *po;
-
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	return (INT2NUM(po->e.ngroups));
+	return (pf_string(NUM2INT(ival)));
 }
 
 static VALUE
-user_set_group_quota(VALUE self, VALUE newval)
+s_to_pf_method(VALUE self, VALUE sval)
 {
-	struct protection_object *po;
-	afs_int32 error, ngroups;
-
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	ngroups = NUM2INT(newval);
-
-	ensure_initialized();
-	error = pr_SetFieldsEntry(po->e.id, PR_SF_NGROUPS, 0, ngroups, 0);
-	assert_success(error, "pr_SetFieldsEntry");
-	po->e.ngroups = ngroups;
-	return (newval);
+	return (INT2FIX(pf_parse(sval)));
 }
 
+/*
+ * PrivacyFlags.pf_to_s_many(flags): the string forms of an Array of
+ * flags, or of a packed column of them (a String of one byte each).
+ */
 static VALUE
-user_get_group_count(VALUE self)
+pf_to_s_many(VALUE self, VALUE flags)
 {
-	struct protection_object *po;
-
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	return (INT2NUM(po->e.count));
+	const unsigned char *p;
+	VALUE ary;
+	long i, n;
+
+	if (TYPE(flags) == T_STRING) {
+		n = RSTRING_LEN(flags);
+		ary = rb_ary_new2(n);
+		for (i = 0; i < n; i++) {
+			p = (const unsigned char *)RSTRING_PTR(flags);
+			rb_ary_push(ary, pf_string(p[i]));
+		}
+		return (ary);
+	}
+	Check_Type(flags, T_ARRAY);
+	n = RARRAY_LEN(flags);
+	ary = rb_ary_new2(n);
+	for (i = 0; i < n; i++)
+		rb_ary_push(ary, pf_string(NUM2INT(RARRAY_AREF(flags, i))));
+	return (ary);
 }
 
+/*
+ * PrivacyFlags.s_to_pf_many(strings, packed = false): the flags for an
+ * Array of string forms, as an Array of Integers or, if "packed", as a
+ * String of one byte each.
+ */
 static VALUE
-group_get_user_quota(VALUE self)
+s_to_pf_many(int argc, VALUE *argv, VALUE self)
 {
-	struct protection_object *po;
+	VALUE strings, packed, rv;
+	long i, n;
+	char *p;
+
+	rb_scan_args(argc, argv, "11", &strings, &packed);
+	Check_Type(strings, T_ARRAY);
+	n = RARRAY_LEN(strings);
+	if (!RTEST(packed)) {
+		rv = rb_ary_new2(n);
+		for (i = 0; i < n; i++)
+			rb_ary_push(rv,
+			    INT2FIX(pf_parse(RARRAY_AREF(strings, i))));
+		return (rv);
+	}
+	rv = rb_str_new(NULL, n);
+	for (i = 0; i < n; i++) {
+		p = RSTRING_PTR(rv);
+		p[i] = (char)pf_parse(RARRAY_AREF(strings, i));
+	}
+	return (rv);
+}
 
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	return (INT2NUM(po->e.nusers));
+/*
+ * The audit keeps only the entries that break the policy, in C, until
+ * the scan is over; nothing Ruby is made for the others.
+ */
+struct pf_audit {
+	struct pf_policy policy;
+	struct prlistentries *bad;
+	unsigned *broken;
+	size_t n;
+	size_t cap;
+};
+
+static afs_int32
+pf_audit_page(const struct prlistentries *le, int n, void *arg)
+{
+	struct pf_audit *a = arg;
+	unsigned broken;
+	size_t ncap;
+	void *p;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if ((broken = pf_check(&a->policy, &le[i])) == 0)
+			continue;
+		if (a->n == a->cap) {
+			ncap = a->cap ? 2 * a->cap : 64;
+			if ((p = realloc(a->bad, ncap * sizeof(*a->bad))) ==
+			    NULL)
+				return (-1);
+			a->bad = p;
+			if ((p = realloc(a->broken,
+			    ncap * sizeof(*a->broken))) == NULL)
+				return (-1);
+			a->broken = p;
+			a->cap = ncap;
+		}
+		a->bad[a->n] = le[i];
+		a->broken[a->n] = broken;
+		a->n++;
+	}
+	return (0);
 }
 
-static VALUE
-group_set_user_quota(VALUE self, VALUE newval)
+static int
+pf_policy_key(VALUE key, VALUE val, VALUE arg)
 {
-	struct protection_object *po;
-	afs_int32 error, nusers;
+	struct pf_policy *p = (struct pf_policy *)arg;
+	int rule;
+
+	for (rule = 0; rule < PF_NRULES; rule++)
+		if (key == SYM(pf_rule_names[rule]))
+			break;
+	if (rule == PF_NRULES)
+		rb_raise(rb_eArgError, "unknown policy rule %"PRIsVALUE, key);
+	p->rules |= 1U << rule;
+	if (rule == PF_RULE_REQUIRE)
+		p->require = pf_value(val);
+	else if (rule == PF_RULE_FORBID)
+		p->forbid = pf_value(val);
+	else
+		p->limit[rule] = NUM2INT(val);
+	return (ST_CONTINUE);
+}
 
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	nusers = NUM2INT(newval);
+static VALUE
+pf_audit_report(VALUE arg)
+{
+	struct pf_audit *a = (struct pf_audit *)arg;
+	const struct prlistentries *le;
+	VALUE rv, h, broken;
+	int block_given, rule;
+	size_t i;
 
-	ensure_initialized();
-	error = pr_SetFieldsEntry(po->e.id, PR_SF_NUSERS, 0, 0, nusers);
-	assert_success(error, "pr_SetFieldsEntry");
-	po->e.nusers = nusers;
-	return (newval);
+	block_given = rb_block_given_p();
+	rv = block_given ? Qnil : rb_ary_new2(a->n);
+	for (i = 0; i < a->n; i++) {
+		le = &a->bad[i];
+		broken = rb_ary_new();
+		for (rule = 0; rule < PF_NRULES; rule++)
+			if (a->broken[i] & (1U << rule))
+				rb_ary_push(broken, SYM(pf_rule_names[rule]));
+		h = rb_hash_new();
+		rb_hash_aset(h, SYM("id"), INT2NUM(le->id));
+		rb_hash_aset(h, SYM("name"), rb_str_new2(le->name));
+		rb_hash_aset(h, SYM("flags"), pf_string(le->flags));
+		rb_hash_aset(h, SYM("ngroups"), INT2NUM(le->ngroups));
+		rb_hash_aset(h, SYM("nusers"), INT2NUM(le->nusers));
+		rb_hash_aset(h, SYM("count"), INT2NUM(le->count));
+		rb_hash_aset(h, SYM("broken"), broken);
+		if (block_given)
+			rb_yield(h);
+		else
+			rb_ary_push(rv, h);
+	}
+	return (rv);
 }
 
 static VALUE
-group_get_user_count(VALUE self)
+pf_audit_free(VALUE arg)
 {
-	struct protection_object *po;
+	struct pf_audit *a = (struct pf_audit *)arg;
 
-	Data_Get_Struct(self, struct protection_object, po);
-	assert_not_deleted(po);
-	return (INT2NUM(po->e.count));
+	free(a->bad);
+	free(a->broken);
+	return (Qnil);
 }
 
+/*
+ * PrivacyFlags.audit(policy, klass = AFS::ProtectionObject): scan the
+ * entries klass.find_all would return and report those that break the
+ * policy, a Hash whose keys are rules:
+ *
+ *   :require, :forbid	flags (a String or Integer) that must all be
+ *			set, or must all be clear
+ *   :min_ngroups, :max_ngroups, :min_nusers, :max_nusers
+ *			bounds on the group and user creation quotas
+ *   :min_count, :max_count
+ *			bounds on the membership count
+ *
+ * Each offending entry is yielded, or returned in an Array, as a Hash
+ * with keys :id, :name, :flags, :ngroups, :nusers, :count and :broken
+ * (the rules it breaks).
+ */
 static VALUE
-po_equal(VALUE self, VALUE other)
+pf_audit(int argc, VALUE *argv, VALUE self)
 {
-	struct protection_object *po1, *po2;
-
-	if (CLASS_OF(other) != CLASS_OF(self))
-		return (Qfalse);
-	Data_Get_Struct(self, struct protection_object, po1);
-	Data_Get_Struct(self, struct protection_object, po2);
-	return (po1->e.id == po2->e.id ? Qtrue : Qfalse);
+	struct pf_audit a;
+	afs_int32 error;
+	VALUE policy, klass;
+	int flags;
+
+	rb_scan_args(argc, argv, "11", &policy, &klass);
+	Check_Type(policy, T_HASH);
+	flags = PRUSERS | PRGROUPS;
+	if (klass == cUser)
+		flags = PRUSERS;
+	else if (klass == cGroup)
+		flags = PRGROUPS;
+	else if (!NIL_P(klass) && klass != cProtectionObject)
+		rb_raise(rb_eArgError, "expected AFS::User, AFS::Group, "
+			 "or AFS::ProtectionObject");
+
+	memset(&a, 0, sizeof(a));
+	rb_hash_foreach(policy, pf_policy_key, (VALUE)&a.policy);
+	ensure_initialized();
+	error = et_scan(flags, pf_audit_page, &a);
+	if (error != 0) {
+		pf_audit_free((VALUE)&a);
+		if (error == -1)
+			rb_memerror();
+		assert_success(error, "pr_ListEntries");
+	}
+	return (rb_ensure(pf_audit_report, (VALUE)&a, pf_audit_free,
+	    (VALUE)&a));
 }
 
 
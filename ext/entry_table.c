@@ -0,0 +1,348 @@
+/*
+ * entry_table.c: a read-only snapshot of the protection database
+ *
+ * See entry_table.h.  et_load() returns 0 on success, the error from
+ * pr_ListEntries if the scan failed, or -1 if memory could not be
+ * allocated; et_load_snapshot() returns 0, an errno value if the file
+ * could not be read, or -1 if it is not a snapshot.  On failure the
+ * table is left empty.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "entry_table.h"
+#include "pr_call.h"
+
+struct name_key {
+	const char *name;
+	uint32_t index;
+};
+
+void
+et_init(struct entry_table *t)
+{
+	memset(t, 0, sizeof(*t));
+}
+
+void
+et_free(struct entry_table *t)
+{
+	free(t->e);
+	free(t->by_name);
+	free(t->names);
+	et_init(t);
+}
+
+size_t
+et_memsize(const struct entry_table *t)
+{
+	return (t->n * (sizeof(struct et_entry) + sizeof(uint32_t)) +
+	    t->names_len);
+}
+
+static int
+compare_id(const void *a, const void *b)
+{
+	afs_int32 x = ((const struct et_entry *)a)->id;
+	afs_int32 y = ((const struct et_entry *)b)->id;
+
+	return (x < y ? -1 : x > y);
+}
+
+static int
+compare_name(const void *a, const void *b)
+{
+	return (strcmp(((const struct name_key *)a)->name,
+	    ((const struct name_key *)b)->name));
+}
+
+/*
+ * Grow *p (of *cap elements of the given size) to hold at least "need".
+ */
+static int
+grow(void *p, size_t *cap, size_t need, size_t size)
+{
+	size_t ncap;
+	void *np;
+
+	if (need <= *cap)
+		return (0);
+	ncap = *cap ? *cap : 1024;
+	while (ncap < need)
+		ncap *= 2;
+	np = realloc(*(void **)p, ncap * size);
+	if (np == NULL)
+		return (-1);
+	*(void **)p = np;
+	*cap = ncap;
+	return (0);
+}
+
+/*
+ * Page through the database with pr_ListEntries, passing each page to
+ * "fn".  A nonzero return from "fn" stops the scan and is returned.
+ */
+afs_int32
+et_scan(int flags, et_scan_fn fn, void *arg)
+{
+	afs_int32 index, nextindex, nentries, error;
+	struct prlistentries *le;
+
+	nextindex = 0;
+	do {
+		le = NULL;
+		index = nextindex;
+		error = rpc_ListEntries(flags, index, &nentries, &le,
+		    &nextindex);
+		if (error == 0)
+			error = (*fn)(le, nentries, arg);
+		free(le);
+		if (error != 0)
+			return (error);
+	} while (nextindex > index);
+	return (0);
+}
+
+struct load_state {
+	struct entry_table *t;
+	size_t ecap;
+	size_t ncap;
+};
+
+static afs_int32
+load_page(const struct prlistentries *le, int nentries, void *arg)
+{
+	struct load_state *ls = arg;
+	struct entry_table *t = ls->t;
+	struct et_entry *e;
+	size_t len;
+	int j;
+
+	if (grow(&t->e, &ls->ecap, t->n + nentries, sizeof(*t->e)) != 0)
+		return (-1);
+	for (j = 0; j < nentries; j++) {
+		len = strnlen(le[j].name, PR_MAXNAMELEN - 1);
+		if (grow(&t->names, &ls->ncap, t->names_len + len + 1, 1) != 0)
+			return (-1);
+		e = &t->e[t->n++];
+		e->id = le[j].id;
+		e->owner = le[j].owner;
+		e->creator = le[j].creator;
+		e->flags = le[j].flags;
+		e->ngroups = le[j].ngroups;
+		e->nusers = le[j].nusers;
+		e->count = le[j].count;
+		e->name = t->names_len;
+		memcpy(t->names + t->names_len, le[j].name, len);
+		t->names[t->names_len + len] = '\0';
+		t->names_len += len + 1;
+	}
+	return (0);
+}
+
+/*
+ * Sort the entries loaded into "t" and index their names.  Returns 0,
+ * or -1 if memory could not be allocated.
+ */
+static int
+finish(struct entry_table *t)
+{
+	struct name_key *keys;
+	size_t i;
+	void *p;
+
+	/* Trim the slack left by doubling. */
+	if (t->n > 0 && (p = realloc(t->e, t->n * sizeof(*t->e))) != NULL)
+		t->e = p;
+	if (t->names_len > 0 && (p = realloc(t->names, t->names_len)) != NULL)
+		t->names = p;
+
+	qsort(t->e, t->n, sizeof(*t->e), compare_id);
+	keys = malloc((t->n ? t->n : 1) * sizeof(*keys));
+	t->by_name = malloc((t->n ? t->n : 1) * sizeof(*t->by_name));
+	if (keys == NULL || t->by_name == NULL) {
+		free(keys);
+		return (-1);
+	}
+	for (i = 0; i < t->n; i++) {
+		keys[i].name = ET_NAME(t, &t->e[i]);
+		keys[i].index = i;
+	}
+	qsort(keys, t->n, sizeof(*keys), compare_name);
+	for (i = 0; i < t->n; i++)
+		t->by_name[i] = keys[i].index;
+	free(keys);
+	return (0);
+}
+
+afs_int32
+et_load(struct entry_table *t, int flags)
+{
+	struct load_state ls;
+	afs_int32 error;
+
+	et_free(t);
+	ls.t = t;
+	ls.ecap = ls.ncap = 0;
+	error = et_scan(flags, load_page, &ls);
+	if (error == 0)
+		error = finish(t);
+	if (error != 0)
+		et_free(t);
+	return (error);
+}
+
+static int
+get32(FILE *f, afs_int32 *v)
+{
+	unsigned char b[4];
+
+	if (fread(b, 1, 4, f) != 4)
+		return (-1);
+	*v = (afs_int32)((uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 |
+	    (uint32_t)b[2] << 8 | b[3]);
+	return (0);
+}
+
+/*
+ * Read one snapshot entry into "le", skipping its members.  Returns 1
+ * if there was one, 0 at the end of the file, or -1 if it is cut short
+ * or malformed.
+ */
+static int
+read_snapshot_entry(FILE *f, struct prlistentries *le)
+{
+	afs_int32 v[8];
+	int c, i, len;
+
+	if ((c = getc(f)) == EOF)
+		return (0);
+	ungetc(c, f);
+	for (i = 0; i < 8; i++)
+		if (get32(f, &v[i]) != 0)
+			return (-1);
+	if ((len = getc(f)) == EOF || len == 0 || len >= PR_MAXNAMELEN)
+		return (-1);
+	memset(le, 0, sizeof(*le));
+	if (fread(le->name, 1, len, f) != (size_t)len ||
+	    memchr(le->name, '\0', len) != NULL)
+		return (-1);
+	le->id = v[0];
+	le->owner = v[1];
+	le->creator = v[2];
+	le->flags = v[3];
+	le->ngroups = v[4];
+	le->nusers = v[5];
+	le->count = v[6];
+	/* Members, or -2 and the error that kept them from being listed. */
+	if (v[7] < -2 || fseek(f, v[7] == -2 ? 4 : v[7] == -1 ? 0 :
+	    (long)v[7] * 4, SEEK_CUR) != 0)
+		return (-1);
+	return (1);
+}
+
+/*
+ * Load the entries from an afs-ptdump snapshot (see ptdump.c) instead
+ * of scanning the database, keeping users, groups or both as "flags"
+ * says.  Nothing is asked of the ptserver.
+ */
+afs_int32
+et_load_snapshot(struct entry_table *t, const char *path, int flags)
+{
+	struct prlistentries le;
+	struct load_state ls;
+	char magic[sizeof(ET_SNAPSHOT_MAGIC) - 1];
+	afs_int32 version, error;
+	long size;
+	FILE *f;
+	int rv;
+
+	et_free(t);
+	if ((f = fopen(path, "rb")) == NULL)
+		return (errno);
+	error = -1;
+	if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET) != 0) {
+		error = errno;
+		goto done;
+	}
+	if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+	    memcmp(magic, ET_SNAPSHOT_MAGIC, sizeof(magic)) != 0 ||
+	    get32(f, &version) != 0 || version < 1 ||
+	    version > ET_SNAPSHOT_VERSION)
+		goto done;
+	ls.t = t;
+	ls.ecap = ls.ncap = 0;
+	while ((rv = read_snapshot_entry(f, &le)) == 1) {
+		if (!(flags & (le.id < 0 ? PRGROUPS : PRUSERS)))
+			continue;
+		if (load_page(&le, 1, &ls) != 0) {
+			rv = ENOMEM;
+			break;
+		}
+	}
+	/* Skipping members can run past the end of a truncated file. */
+	if (rv == 0 && ftell(f) != size)
+		rv = -1;
+	if (rv == 0)
+		error = finish(t) == 0 ? 0 : ENOMEM;
+	else if (rv == -1 && ferror(f))
+		error = errno ? errno : EIO;
+	else
+		error = rv;
+
+done:
+	fclose(f);
+	if (error != 0)
+		et_free(t);
+	return (error);
+}
+
+const struct et_entry *
+et_find_id(const struct entry_table *t, afs_int32 id)
+{
+	size_t lo, hi, mid;
+
+	lo = 0;
+	hi = t->n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (t->e[mid].id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < t->n && t->e[lo].id == id)
+		return (&t->e[lo]);
+	return (NULL);
+}
+
+const struct et_entry *
+et_find_name(const struct entry_table *t, const char *name)
+{
+	size_t lo, hi, mid;
+	int cmp;
+
+	lo = 0;
+	hi = t->n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = strcmp(ET_NAME(t, &t->e[t->by_name[mid]]), name);
+		if (cmp == 0)
+			return (&t->e[t->by_name[mid]]);
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (NULL);
+}
+
+/*
+ * Local variables:
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -0,0 +1,67 @@
+/*
+ * entry_table.h: a read-only snapshot of the protection database
+ *
+ * An entry table holds every entry returned by a pr_ListEntries scan in
+ * three flat allocations: the entries themselves, sorted by id; their
+ * names, packed end to end; and an index of the entries sorted by name.
+ * Lookups by id or by name are binary searches.  Nothing is written once
+ * the table has been built, so a table loaded before a server forks its
+ * workers stays shared between them, page for page, until it is freed.
+ * et_scan() does the same paging without keeping anything, for callers
+ * that only want to see each entry go past, and et_load_snapshot()
+ * builds a table from an afs-ptdump snapshot file without asking the
+ * ptserver anything.
+ *
+ * Nothing in here knows about Ruby.
+ */
+
+#ifndef ENTRY_TABLE_H
+#define ENTRY_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <afs/ptclient.h>
+#include <afs/ptuser.h>
+
+struct et_entry {
+	afs_int32 id;
+	afs_int32 owner;
+	afs_int32 creator;
+	afs_int32 flags;
+	afs_int32 ngroups;
+	afs_int32 nusers;
+	afs_int32 count;
+	uint32_t name;		/* offset into the name pool */
+};
+
+struct entry_table {
+	struct et_entry *e;	/* sorted by id */
+	uint32_t *by_name;	/* indices into e, sorted by name */
+	char *names;
+	size_t n;
+	size_t names_len;
+};
+
+#define	ET_NAME(t, ent)	((t)->names + (ent)->name)
+
+/* The start of an afs-ptdump snapshot file; see ptdump/ptdump.c. */
+#define	ET_SNAPSHOT_MAGIC	"AFSPTDMP"
+#define	ET_SNAPSHOT_VERSION	2
+
+typedef afs_int32 (*et_scan_fn)(const struct prlistentries *page, int n,
+	    void *arg);
+
+afs_int32 et_scan(int flags, et_scan_fn fn, void *arg);
+
+void	et_init(struct entry_table *t);
+void	et_free(struct entry_table *t);
+afs_int32 et_load(struct entry_table *t, int flags);
+afs_int32 et_load_snapshot(struct entry_table *t, const char *path,
+	    int flags);
+size_t	et_memsize(const struct entry_table *t);
+const struct et_entry *et_find_id(const struct entry_table *t, afs_int32 id);
+const struct et_entry *et_find_name(const struct entry_table *t,
+	    const char *name);
+
+#endif /* ENTRY_TABLE_H */
@@ -2,13 +2,104 @@ require 'mkmf'
 extension_name = 'AFS'
 dir_config('afs')
 $LIBPATH.push('/usr/lib/x86_64-linux-gnu/heimdal')
+$CPPFLAGS << ' -I/usr/include/heimdal'
 if (have_header('afs/ptuser.h') and
     have_library('resolv', 'res_search', 'resolv.h') and
     have_library('pthread', 'pthread_create', 'pthread.h') and
     have_library('roken', 'rk_socket') and
     have_library('hcrypto', 'hc_DES_cbc_encrypt') and
+    have_header('hcrypto/hmac.h') and
     have_library('afsrpc_pic', 'rx_SetNoJumbo', 'rx/rx.h') and
     have_library('afsauthent_pic', 'pr_Initialize', 'afs/ptuser.h'))
   have_func('afs_error_message', ['afs/stds.h', 'afs/com_err.h'])
+  have_func('ubik_PR_ListElements', ['afs/ptclient.h', 'afs/ptuser.h'])
+  have_header('ruby/ractor.h')
+  have_func('rb_ext_ractor_safe', 'ruby.h')
+  if have_header('ruby/fiber/scheduler.h')
+    have_func('rb_fiber_scheduler_current', 'ruby/fiber/scheduler.h')
+  end
   create_makefile(extension_name)
+
+  # afs-ptdump is built from the parts of the extension that don't use
+  # Ruby, and installed next to it.
+  File.open('Makefile', 'a') do |mf|
+    mf.print <<'MAKEFILE'
+
+PTDUMP_OBJS = ptdump.o pr_call.o pr_cache.o pr_trace.o entry_table.o
+
+all: afs-ptdump
+
+ptdump.o: $(srcdir)/ptdump/ptdump.c $(srcdir)/pr_call.h \
+		$(srcdir)/entry_table.h
+	$(ECHO) compiling $(<)
+	$(Q) $(CC) $(INCFLAGS) $(CPPFLAGS) $(CFLAGS) $(COUTFLAG)$@ \
+		-c $(CSRCFLAG)$<
+
+afs-ptdump: $(PTDUMP_OBJS)
+	$(ECHO) linking afs-ptdump
+	$(Q) $(CC) -o $@ $(PTDUMP_OBJS) $(LDFLAGS) $(LIBPATH) \
+		$(LOCAL_LIBS) $(LIBS)
+
+install-so: $(RUBYARCHDIR)/afs-ptdump
+$(RUBYARCHDIR)/afs-ptdump: afs-ptdump
+	-$(Q)$(MAKEDIRS) $(@D)
+	$(INSTALL_PROG) afs-ptdump $(@D)
+
+clean-so::
+	-$(Q)$(RM) afs-ptdump ptdump.o
+
+# "make check" runs the tests in ../test: the C ones test the parts
+# that don't need Ruby or a cell, and the Ruby ones load the extension
+# from this directory.
+TESTDIR = $(srcdir)/../test
+CHECK_PROGS = member_set_test pr_trace_test pr_cache_test entry_table_test \
+	group_graph_test
+
+check: $(CHECK_PROGS) $(DLLIB)
+	$(Q) for t in $(CHECK_PROGS); do ./$$t || exit 1; done
+	$(Q) for t in $(TESTDIR)/*_test.rb; do \
+		[ -f "$$t" ] || continue; \
+		$(RUBY) -I. -I$(srcdir)/../lib "$$t" || exit 1; \
+	done
+
+member_set_test: $(TESTDIR)/member_set_test.c member_set.o
+	$(ECHO) linking $@
+	$(Q) $(CC) $(INCFLAGS) -I$(TESTDIR) $(CPPFLAGS) $(CFLAGS) -o $@ \
+		$(TESTDIR)/member_set_test.c member_set.o
+
+CALL_TEST_OBJS = pr_call.o pr_cache.o pr_trace.o
+FIXTURE = $(TESTDIR)/pr_call_fixture.c
+
+pr_trace_test: $(TESTDIR)/pr_trace_test.c $(FIXTURE) $(CALL_TEST_OBJS)
+	$(ECHO) linking $@
+	$(Q) $(CC) $(INCFLAGS) -I$(TESTDIR) $(CPPFLAGS) $(CFLAGS) -o $@ \
+		$(TESTDIR)/pr_trace_test.c $(FIXTURE) $(CALL_TEST_OBJS) \
+		$(LDFLAGS) $(LIBPATH) $(LOCAL_LIBS) $(LIBS)
+
+pr_cache_test: $(TESTDIR)/pr_cache_test.c $(FIXTURE) $(CALL_TEST_OBJS)
+	$(ECHO) linking $@
+	$(Q) $(CC) $(INCFLAGS) -I$(TESTDIR) $(CPPFLAGS) $(CFLAGS) -o $@ \
+		$(TESTDIR)/pr_cache_test.c $(FIXTURE) $(CALL_TEST_OBJS) \
+		$(LDFLAGS) $(LIBPATH) $(LOCAL_LIBS) $(LIBS)
+
+ET_TEST_OBJS = entry_table.o $(CALL_TEST_OBJS)
+
+entry_table_test: $(TESTDIR)/entry_table_test.c $(ET_TEST_OBJS)
+	$(ECHO) linking $@
+	$(Q) $(CC) $(INCFLAGS) -I$(TESTDIR) $(CPPFLAGS) $(CFLAGS) -o $@ \
+		$(TESTDIR)/entry_table_test.c $(ET_TEST_OBJS) \
+		$(LDFLAGS) $(LIBPATH) $(LOCAL_LIBS) $(LIBS)
+
+GRAPH_TEST_OBJS = group_graph.o member_set.o $(ET_TEST_OBJS)
+
+group_graph_test: $(TESTDIR)/group_graph_test.c $(GRAPH_TEST_OBJS)
+	$(ECHO) linking $@
+	$(Q) $(CC) $(INCFLAGS) -I$(TESTDIR) $(CPPFLAGS) $(CFLAGS) -o $@ \
+		$(TESTDIR)/group_graph_test.c $(GRAPH_TEST_OBJS) \
+		$(LDFLAGS) $(LIBPATH) $(LOCAL_LIBS) $(LIBS)
+
+clean-so::
+	-$(Q)$(RM) $(CHECK_PROGS)
+MAKEFILE
+  end
 end
@@ -0,0 +1,479 @@
+/*
+ * group_graph.c: the supergroup graph of the protection database
+ *
+ * See group_graph.h.  The caller loads gg->t with the groups (with
+ * et_load(&gg->t, PRGROUPS)), then calls gg_fetch() and gg_analyze().
+ *
+ * Members are fetched a window of groups at a time: one IDListMembers
+ * call per group, all queued on the worker pool at once, and then a
+ * NameToId call for the members of the whole window that are not
+ * themselves groups.  Members that are groups are recognized by name
+ * in gg->t without asking the ptserver.
+ *
+ * The components are found with Tarjan's algorithm, which numbers them
+ * so that every component reached from another comes before it.  Each
+ * is then visited once, in that order, merging the member sets of the
+ * components below it into its own; a component's sets are freed as
+ * soon as the last component above it has taken them in.
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "group_graph.h"
+#include "member_set.h"
+#include "pr_call.h"
+
+#define	UNVISITED	UINT32_MAX
+
+void
+gg_init(struct group_graph *gg)
+{
+	memset(gg, 0, sizeof(*gg));
+	et_init(&gg->t);
+}
+
+void
+gg_free(struct group_graph *gg)
+{
+	et_free(&gg->t);
+	free(gg->g);
+	free(gg->edges);
+	free(gg->user_ids);
+	gg_init(gg);
+}
+
+size_t
+gg_memsize(const struct group_graph *gg)
+{
+	return (et_memsize(&gg->t) + gg->t.n * sizeof(struct gg_node) +
+	    gg->nedges * sizeof(uint32_t) + gg->nuser_ids * sizeof(int32_t));
+}
+
+/*
+ * Make room for "n" more "size"-byte things in the array at *p, which
+ * holds *len of them in room for *cap.
+ */
+static int
+reserve(void *p, size_t *cap, size_t len, size_t n, size_t size)
+{
+	size_t ncap;
+	void *np;
+
+	if (len + n <= *cap)
+		return (0);
+	ncap = *cap ? *cap : 256;
+	while (ncap < len + n)
+		ncap *= 2;
+	if ((np = realloc(*(void **)p, ncap * size)) == NULL)
+		return (-1);
+	*(void **)p = np;
+	*cap = ncap;
+	return (0);
+}
+
+struct window {
+	struct pr_call *calls;
+	namelist *members;
+	size_t size;
+
+	/* Members not found among the groups, and whose they are. */
+	namelist pending;
+	uint32_t *owner;
+	afs_int32 *ids;
+	size_t pending_cap;
+	size_t owner_cap;
+};
+
+/*
+ * Look up the pending names, PR_MAXLIST at a time.  Names that could
+ * not be looked up are left as ANONYMOUSID, with the error recorded
+ * against the groups they came from.
+ */
+static void
+resolve_pending(struct group_graph *gg, struct window *w)
+{
+	struct pr_call c;
+	namelist chunk;
+	idlist ids;
+	size_t i, j, n;
+
+	for (i = 0; i < w->pending.namelist_len; i += n) {
+		n = w->pending.namelist_len - i;
+		if (n > PR_MAXLIST)
+			n = PR_MAXLIST;
+		chunk.namelist_len = n;
+		chunk.namelist_val = w->pending.namelist_val + i;
+		ids.idlist_len = 0;
+		ids.idlist_val = NULL;
+		pr_call_init(&c, PR_OP_NAMETOID);
+		c.names = &chunk;
+		c.ids = &ids;
+		pr_call_run(&c);
+		for (j = 0; j < n; j++) {
+			if (c.error == 0 && j < ids.idlist_len)
+				w->ids[i + j] = ids.idlist_val[j];
+			else if (gg->g[w->owner[i + j]].error == 0)
+				gg->g[w->owner[i + j]].error = c.error;
+		}
+		free(ids.idlist_val);
+	}
+}
+
+/*
+ * Add the edges and user members of groups "base" through "base + n - 1"
+ * once their members have been listed.
+ */
+static int
+add_window(struct group_graph *gg, struct window *w, size_t base,
+    size_t n, size_t *edges_cap, size_t *users_cap)
+{
+	const struct et_entry *ent;
+	struct gg_node *node;
+	namelist *nl;
+	size_t i, k, p;
+	u_int j;
+
+	w->pending.namelist_len = 0;
+	for (k = 0; k < n; k++) {
+		node = &gg->g[base + k];
+		nl = &w->members[k];
+		node->error = w->calls[k].error;
+		node->sub = gg->nedges;
+		if (node->error != 0)
+			continue;
+		for (j = 0; j < nl->namelist_len; j++) {
+			ent = et_find_name(&gg->t, nl->namelist_val[j]);
+			if (ent != NULL) {
+				if (reserve(&gg->edges, edges_cap, gg->nedges,
+				    1, sizeof(uint32_t)) != 0)
+					return (-1);
+				gg->edges[gg->nedges++] = ent - gg->t.e;
+				node->nsub++;
+				continue;
+			}
+			i = w->pending.namelist_len;
+			if (reserve(&w->pending.namelist_val, &w->pending_cap,
+			    i, 1, sizeof(prname)) != 0 ||
+			    reserve(&w->owner, &w->owner_cap, i, 1,
+			    sizeof(uint32_t)) != 0)
+				return (-1);
+			memcpy(w->pending.namelist_val[i],
+			    nl->namelist_val[j], sizeof(prname));
+			w->owner[i] = base + k;
+			w->pending.namelist_len++;
+		}
+	}
+
+	free(w->ids);
+	w->ids = malloc((w->pending.namelist_len + 1) * sizeof(afs_int32));
+	if (w->ids == NULL)
+		return (-1);
+	for (i = 0; i < w->pending.namelist_len; i++)
+		w->ids[i] = ANONYMOUSID;
+	resolve_pending(gg, w);
+
+	/* A member that isn't in the database comes back as ANONYMOUSID. */
+	if (reserve(&gg->user_ids, users_cap, gg->nuser_ids,
+	    w->pending.namelist_len, sizeof(int32_t)) != 0)
+		return (-1);
+	p = 0;
+	for (k = 0; k < n; k++) {
+		node = &gg->g[base + k];
+		node->users = gg->nuser_ids;
+		for (; p < w->pending.namelist_len && w->owner[p] == base + k;
+		    p++)
+			if (w->ids[p] != ANONYMOUSID || strcmp(
+			    w->pending.namelist_val[p], "anonymous") == 0)
+				gg->user_ids[gg->nuser_ids++] = w->ids[p];
+		node->nusers = gg->nuser_ids - node->users;
+	}
+	return (0);
+}
+
+/*
+ * Fetch the members of every group in gg->t, keeping up to "jobs"
+ * calls outstanding at once.  A group whose members could not be
+ * listed is left with none, and the error in its node.
+ */
+int
+gg_fetch(struct group_graph *gg, int jobs)
+{
+	struct window w;
+	size_t base, n, k, edges_cap, users_cap;
+	int error;
+
+	free(gg->g);
+	free(gg->edges);
+	free(gg->user_ids);
+	gg->edges = NULL;
+	gg->user_ids = NULL;
+	gg->nedges = gg->nuser_ids = 0;
+	gg->nscc = 0;
+	gg->g = calloc(gg->t.n ? gg->t.n : 1, sizeof(struct gg_node));
+	memset(&w, 0, sizeof(w));
+	w.size = jobs > 0 ? jobs : 1;
+	w.calls = calloc(w.size, sizeof(*w.calls));
+	w.members = calloc(w.size, sizeof(*w.members));
+	if (gg->g == NULL || w.calls == NULL || w.members == NULL) {
+		error = -1;
+		goto out;
+	}
+
+	edges_cap = users_cap = 0;
+	error = 0;
+	for (base = 0; base < gg->t.n && error == 0; base += n) {
+		if (gg->cancel)
+			break;
+		n = gg->t.n - base;
+		if (n > w.size)
+			n = w.size;
+		for (k = 0; k < n; k++) {
+			w.members[k].namelist_len = 0;
+			w.members[k].namelist_val = NULL;
+			pr_call_init(&w.calls[k], PR_OP_IDLISTMEMBERS);
+			w.calls[k].id = gg->t.e[base + k].id;
+			w.calls[k].names = &w.members[k];
+			if (pr_call_submit(&w.calls[k]) != 0) {
+				pr_call_run(&w.calls[k]);
+				w.calls[k].done = 1;
+			}
+		}
+		for (k = 0; k < n; k++)
+			pr_call_wait(&w.calls[k]);
+		error = add_window(gg, &w, base, n, &edges_cap, &users_cap);
+		for (k = 0; k < n; k++)
+			free(w.members[k].namelist_val);
+	}
+
+out:
+	free(w.calls);
+	free(w.members);
+	free(w.pending.namelist_val);
+	free(w.owner);
+	free(w.ids);
+	return (error);
+}
+
+/*
+ * Tarjan's algorithm, without recursion: a group nested thousands deep
+ * must not overflow the stack.
+ */
+static int
+find_components(struct group_graph *gg)
+{
+	uint32_t *index, *low, *stack, *cs_node, *cs_edge;
+	uint32_t v, w, next;
+	size_t n, root, sp, csp;
+	unsigned char *on_stack;
+	int error;
+
+	n = gg->t.n;
+	index = malloc((n + 1) * sizeof(uint32_t));
+	low = malloc((n + 1) * sizeof(uint32_t));
+	stack = malloc((n + 1) * sizeof(uint32_t));
+	cs_node = malloc((n + 1) * sizeof(uint32_t));
+	cs_edge = malloc((n + 1) * sizeof(uint32_t));
+	on_stack = calloc(n + 1, 1);
+	error = -1;
+	if (index == NULL || low == NULL || stack == NULL ||
+	    cs_node == NULL || cs_edge == NULL || on_stack == NULL)
+		goto out;
+
+	for (root = 0; root < n; root++)
+		index[root] = UNVISITED;
+	next = 0;
+	sp = 0;
+	gg->nscc = 0;
+	for (root = 0; root < n; root++) {
+		if (index[root] != UNVISITED)
+			continue;
+		index[root] = low[root] = next++;
+		stack[sp++] = root;
+		on_stack[root] = 1;
+		cs_node[0] = root;
+		cs_edge[0] = 0;
+		csp = 1;
+		while (csp > 0) {
+			v = cs_node[csp - 1];
+			if (cs_edge[csp - 1] < gg->g[v].nsub) {
+				w = gg->edges[gg->g[v].sub +
+				    cs_edge[csp - 1]++];
+				if (index[w] == UNVISITED) {
+					index[w] = low[w] = next++;
+					stack[sp++] = w;
+					on_stack[w] = 1;
+					cs_node[csp] = w;
+					cs_edge[csp] = 0;
+					csp++;
+				} else if (on_stack[w] && index[w] < low[v])
+					low[v] = index[w];
+				continue;
+			}
+			csp--;
+			if (csp > 0 && low[v] < low[cs_node[csp - 1]])
+				low[cs_node[csp - 1]] = low[v];
+			if (low[v] != index[v])
+				continue;
+			do {
+				w = stack[--sp];
+				on_stack[w] = 0;
+				gg->g[w].scc = gg->nscc;
+			} while (w != v);
+			gg->nscc++;
+		}
+	}
+	error = 0;
+
+out:
+	free(index);
+	free(low);
+	free(stack);
+	free(cs_node);
+	free(cs_edge);
+	free(on_stack);
+	return (error);
+}
+
+static int
+union_into(struct member_set *dst, const struct member_set *src)
+{
+	struct member_set tmp;
+
+	if (src->nc == 0)
+		return (0);
+	if (ms_union(&tmp, dst, src) != 0)
+		return (-1);
+	ms_clear(dst);
+	*dst = tmp;
+	return (0);
+}
+
+static uint64_t
+add_sat(uint64_t a, uint64_t b)
+{
+	return (a > GG_UNBOUNDED - b ? GG_UNBOUNDED : a + b);
+}
+
+/*
+ * Fill in the per-group figures (see group_graph.h) from the fetched
+ * members.
+ */
+int
+gg_analyze(struct group_graph *gg)
+{
+	struct member_set *users, *groups, direct;
+	struct gg_node *node, *sub;
+	uint32_t *start, *nodes, *refs, c, d, v, w;
+	size_t n, i, e;
+	uint32_t depth;
+	int cyclic, unbounded, error;
+
+	if (find_components(gg) != 0)
+		return (-1);
+	ms_init(&direct);
+	n = gg->t.n;
+	start = calloc(gg->nscc + 2, sizeof(uint32_t));
+	nodes = malloc((n + 1) * sizeof(uint32_t));
+	refs = calloc(gg->nscc + 1, sizeof(uint32_t));
+	users = calloc(gg->nscc + 1, sizeof(struct member_set));
+	groups = calloc(gg->nscc + 1, sizeof(struct member_set));
+	error = -1;
+	if (start == NULL || nodes == NULL || refs == NULL ||
+	    users == NULL || groups == NULL)
+		goto out;
+
+	/* The groups in each component, and how many edges lead in. */
+	for (v = 0; v < n; v++) {
+		start[gg->g[v].scc + 2]++;
+		for (e = 0; e < gg->g[v].nsub; e++) {
+			w = gg->edges[gg->g[v].sub + e];
+			if (gg->g[w].scc != gg->g[v].scc)
+				refs[gg->g[w].scc]++;
+		}
+	}
+	for (c = 0; c < gg->nscc; c++)
+		start[c + 2] += start[c + 1];
+	for (v = 0; v < n; v++)
+		nodes[start[gg->g[v].scc + 1]++] = v;
+
+	for (c = 0; c < gg->nscc; c++) {
+		ms_init(&users[c]);
+		ms_init(&groups[c]);
+		cyclic = start[c + 1] - start[c] > 1;
+		depth = 0;
+		for (i = start[c]; i < start[c + 1]; i++) {
+			node = &gg->g[nodes[i]];
+			if (ms_build(&direct, gg->user_ids + node->users,
+			    node->nusers) != 0 ||
+			    union_into(&users[c], &direct) != 0)
+				goto out;
+			for (e = 0; e < node->nsub; e++) {
+				w = gg->edges[node->sub + e];
+				d = gg->g[w].scc;
+				if (ms_add(&groups[c], gg->t.e[w].id) != 0)
+					goto out;
+				if (d == c) {
+					cyclic = 1;
+					continue;
+				}
+				if (gg->g[w].depth + 1 > depth)
+					depth = gg->g[w].depth + 1;
+				if (union_into(&users[c], &users[d]) != 0 ||
+				    union_into(&groups[c], &groups[d]) != 0)
+					goto out;
+				if (--refs[d] == 0) {
+					ms_clear(&users[d]);
+					ms_clear(&groups[d]);
+				}
+			}
+		}
+
+		for (i = start[c]; i < start[c + 1]; i++) {
+			node = &gg->g[nodes[i]];
+			node->depth = depth;
+			node->cyclic = cyclic;
+			node->tusers = ms_cardinality(&users[c]);
+			node->tgroups = ms_cardinality(&groups[c]);
+			node->calls = 1;
+			node->expanded = node->nusers;
+			unbounded = cyclic;
+			for (e = 0; e < node->nsub && !unbounded; e++) {
+				sub = &gg->g[gg->edges[node->sub + e]];
+				unbounded = sub->calls == GG_UNBOUNDED;
+				node->calls = add_sat(node->calls, sub->calls);
+				node->expanded = add_sat(node->expanded,
+				    sub->expanded);
+			}
+			if (unbounded)
+				node->calls = node->expanded = GG_UNBOUNDED;
+		}
+		if (refs[c] == 0) {
+			ms_clear(&users[c]);
+			ms_clear(&groups[c]);
+		}
+	}
+	error = 0;
+
+out:
+	ms_clear(&direct);
+	if (users != NULL && groups != NULL)
+		for (c = 0; c < gg->nscc; c++) {
+			ms_clear(&users[c]);
+			ms_clear(&groups[c]);
+		}
+	free(start);
+	free(nodes);
+	free(refs);
+	free(users);
+	free(groups);
+	return (error);
+}
+
+/*
+ * Local variables:
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -0,0 +1,70 @@
+/*
+ * group_graph.h: the supergroup graph of the protection database
+ *
+ * A group graph has a node for every group and an edge from each group
+ * to each group among its members.  Once the members are fetched, the
+ * graph is analyzed: its strongly connected components are found
+ * (every group in a cycle of nested groups shares a component with the
+ * others in it), and for every group we work out
+ *
+ *	depth		the longest chain of nested groups below it, counting
+ *			each cycle as a single step
+ *	transitive	the distinct users and groups it reaches
+ *	calls		how many groups a naive recursive expansion (such as
+ *			Group#members_recursive) lists the members of
+ *	expanded	how many members that expansion yields, duplicates
+ *			and all
+ *
+ * The last two are GG_UNBOUNDED for a group that reaches a cycle, since
+ * a naive expansion of it never finishes.  Comparing "expanded" with
+ * "transitive" shows how much of an expansion is repeated work.
+ *
+ * Nothing in here knows about Ruby.  The members are fetched with
+ * pr_call_run() directly, on this thread and the worker pool, not
+ * through the installed executor.  Functions returning int return 0 on
+ * success and -1 if memory could not be allocated.
+ */
+
+#ifndef GROUP_GRAPH_H
+#define GROUP_GRAPH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "entry_table.h"
+
+#define	GG_UNBOUNDED	UINT64_MAX
+
+struct gg_node {
+	uint32_t sub;		/* offset of the subgroups in edges */
+	uint32_t nsub;
+	uint32_t users;		/* offset of the user members in user_ids */
+	uint32_t nusers;
+	afs_int32 error;	/* from fetching the members, or 0 */
+	uint32_t scc;		/* component, numbered children first */
+	uint32_t depth;
+	int cyclic;		/* in a component with a cycle */
+	uint64_t tusers;	/* distinct users reached */
+	uint64_t tgroups;	/* distinct groups reached */
+	uint64_t calls;
+	uint64_t expanded;
+};
+
+struct group_graph {
+	struct entry_table t;	/* the groups; node i is t.e[i] */
+	struct gg_node *g;
+	uint32_t *edges;	/* node indices */
+	int32_t *user_ids;
+	size_t nedges;
+	size_t nuser_ids;
+	uint32_t nscc;
+	volatile int cancel;	/* set to make gg_fetch() give up */
+};
+
+void	gg_init(struct group_graph *gg);
+void	gg_free(struct group_graph *gg);
+int	gg_fetch(struct group_graph *gg, int jobs);
+int	gg_analyze(struct group_graph *gg);
+size_t	gg_memsize(const struct group_graph *gg);
+
+#endif /* GROUP_GRAPH_H */
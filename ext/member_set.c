@@ -0,0 +1,723 @@
+/*
+ * member_set.c: compressed sets of protection database ids
+ *
+ * See member_set.h for a description of the representation.  Ids are
+ * stored biased by 2^31 so that the unsigned container order matches the
+ * signed ptsid order (groups, being negative, sort first).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "member_set.h"
+
+#define	MS_BIAS		0x80000000U
+
+enum ms_op { MS_OR, MS_AND, MS_ANDNOT };
+
+static uint32_t
+ms_bias(int32_t id)
+{
+	return ((uint32_t)id ^ MS_BIAS);
+}
+
+static int32_t
+ms_unbias(uint32_t u)
+{
+	return ((int32_t)(u ^ MS_BIAS));
+}
+
+static int
+popcount64(uint64_t w)
+{
+	return (__builtin_popcountll(w));
+}
+
+static void
+c_free(struct ms_container *c)
+{
+	if (c->is_bitmap)
+		free(c->u.bits);
+	else
+		free(c->u.array);
+	c->u.array = NULL;
+	c->card = c->cap = 0;
+}
+
+static int
+c_contains(const struct ms_container *c, uint16_t low)
+{
+	size_t lo, hi, mid;
+
+	if (c->is_bitmap)
+		return ((c->u.bits[low >> 6] >> (low & 63)) & 1);
+	lo = 0;
+	hi = c->card;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (c->u.array[mid] < low)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo < c->card && c->u.array[lo] == low);
+}
+
+/* The "card" values set in the word bitmap "w", as a new array. */
+static uint16_t *
+words_to_array(const uint64_t *w, uint32_t card)
+{
+	uint16_t *a;
+	uint32_t n;
+	size_t i;
+	uint64_t word;
+
+	a = malloc((card > 0 ? card : 1) * sizeof(uint16_t));
+	if (a == NULL)
+		return (NULL);
+	n = 0;
+	for (i = 0; i < MS_BITMAP_WORDS; i++) {
+		word = w[i];
+		while (word != 0) {
+			a[n++] = (uint16_t)(i * 64 + __builtin_ctzll(word));
+			word &= word - 1;
+		}
+	}
+	return (a);
+}
+
+/*
+ * Turn a word bitmap into a container, choosing the array form if it is
+ * sparse enough.  Takes ownership of "w", even on failure, when "out" is
+ * left alone.  Leaves out->card == 0 (and frees "w") if the bitmap is
+ * empty.
+ */
+static int
+c_from_words(struct ms_container *out, uint16_t key, uint64_t *w)
+{
+	uint32_t card;
+	uint16_t *a;
+	size_t i;
+
+	card = 0;
+	for (i = 0; i < MS_BITMAP_WORDS; i++)
+		card += popcount64(w[i]);
+	if (card > MS_ARRAY_MAX) {
+		out->is_bitmap = 1;
+		out->u.bits = w;
+		out->cap = 0;
+	} else {
+		a = NULL;
+		if (card > 0 && (a = words_to_array(w, card)) == NULL) {
+			free(w);
+			return (-1);
+		}
+		free(w);
+		out->is_bitmap = 0;
+		out->u.array = a;
+		out->cap = card;
+	}
+	out->key = key;
+	out->card = card;
+	return (0);
+}
+
+/* OR the contents of "c" into the word bitmap "w". */
+static void
+c_or_into(const struct ms_container *c, uint64_t *w)
+{
+	uint32_t i;
+
+	if (c->is_bitmap) {
+		for (i = 0; i < MS_BITMAP_WORDS; i++)
+			w[i] |= c->u.bits[i];
+	} else {
+		for (i = 0; i < c->card; i++)
+			w[c->u.array[i] >> 6] |= 1ULL << (c->u.array[i] & 63);
+	}
+}
+
+static int
+c_array_to_bitmap(struct ms_container *c)
+{
+	uint64_t *w;
+
+	w = calloc(MS_BITMAP_WORDS, sizeof(uint64_t));
+	if (w == NULL)
+		return (-1);
+	c_or_into(c, w);
+	free(c->u.array);
+	c->u.bits = w;
+	c->is_bitmap = 1;
+	c->cap = 0;
+	return (0);
+}
+
+/* Leaves "c" as it was if the array cannot be had. */
+static int
+c_bitmap_to_array(struct ms_container *c)
+{
+	uint16_t *a;
+
+	if ((a = words_to_array(c->u.bits, c->card)) == NULL)
+		return (-1);
+	free(c->u.bits);
+	c->u.array = a;
+	c->is_bitmap = 0;
+	c->cap = c->card;
+	return (0);
+}
+
+static int
+c_copy(struct ms_container *dst, const struct ms_container *src)
+{
+	size_t len;
+
+	*dst = *src;
+	if (src->is_bitmap)
+		len = MS_BITMAP_WORDS * sizeof(uint64_t);
+	else
+		len = src->card * sizeof(uint16_t);
+	dst->u.array = malloc(len > 0 ? len : 1);
+	if (dst->u.array == NULL)
+		return (-1);
+	memcpy(dst->u.array, src->u.array, len);
+	dst->cap = src->is_bitmap ? 0 : src->card;
+	return (0);
+}
+
+/* Combine two array containers with the same key without a bitmap. */
+static int
+c_op_arrays(enum ms_op op, const struct ms_container *x,
+    const struct ms_container *y, struct ms_container *out)
+{
+	uint32_t i, j, n, max;
+	uint16_t *r;
+
+	max = (op == MS_OR) ? x->card + y->card : x->card;
+	r = malloc((max > 0 ? max : 1) * sizeof(uint16_t));
+	if (r == NULL)
+		return (-1);
+	i = j = n = 0;
+	while (i < x->card && j < y->card) {
+		if (x->u.array[i] < y->u.array[j]) {
+			if (op != MS_AND)
+				r[n++] = x->u.array[i];
+			i++;
+		} else if (x->u.array[i] > y->u.array[j]) {
+			if (op == MS_OR)
+				r[n++] = y->u.array[j];
+			j++;
+		} else {
+			if (op != MS_ANDNOT)
+				r[n++] = x->u.array[i];
+			i++;
+			j++;
+		}
+	}
+	if (op != MS_AND)
+		while (i < x->card)
+			r[n++] = x->u.array[i++];
+	if (op == MS_OR)
+		while (j < y->card)
+			r[n++] = y->u.array[j++];
+
+	out->key = x->key;
+	out->is_bitmap = 0;
+	out->card = n;
+	out->cap = max;
+	out->u.array = r;
+	if (n > MS_ARRAY_MAX && c_array_to_bitmap(out) != 0) {
+		free(r);
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+c_op(enum ms_op op, const struct ms_container *x,
+    const struct ms_container *y, struct ms_container *out)
+{
+	uint64_t *w, *v;
+	size_t i;
+
+	if (!x->is_bitmap && !y->is_bitmap)
+		return (c_op_arrays(op, x, y, out));
+
+	w = calloc(MS_BITMAP_WORDS, sizeof(uint64_t));
+	if (w == NULL)
+		return (-1);
+	c_or_into(x, w);
+	if (op == MS_OR) {
+		c_or_into(y, w);
+	} else if (y->is_bitmap) {
+		v = y->u.bits;
+		for (i = 0; i < MS_BITMAP_WORDS; i++)
+			w[i] = (op == MS_AND) ? (w[i] & v[i]) : (w[i] & ~v[i]);
+	} else {
+		v = calloc(MS_BITMAP_WORDS, sizeof(uint64_t));
+		if (v == NULL) {
+			free(w);
+			return (-1);
+		}
+		c_or_into(y, v);
+		for (i = 0; i < MS_BITMAP_WORDS; i++)
+			w[i] = (op == MS_AND) ? (w[i] & v[i]) : (w[i] & ~v[i]);
+		free(v);
+	}
+	return (c_from_words(out, x->key, w));
+}
+
+/*
+ * Find the container for "key".  Returns its index, or -1 with the
+ * insertion point stored in *pos.
+ */
+static long
+ms_find(const struct member_set *ms, uint16_t key, size_t *pos)
+{
+	size_t lo, hi, mid;
+
+	lo = 0;
+	hi = ms->nc;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (ms->c[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (pos != NULL)
+		*pos = lo;
+	if (lo < ms->nc && ms->c[lo].key == key)
+		return ((long)lo);
+	return (-1);
+}
+
+static int
+ms_reserve(struct member_set *ms, size_t n)
+{
+	struct ms_container *c;
+	size_t cap;
+
+	if (n <= ms->cap)
+		return (0);
+	cap = ms->cap ? ms->cap : 4;
+	while (cap < n)
+		cap *= 2;
+	c = realloc(ms->c, cap * sizeof(*c));
+	if (c == NULL)
+		return (-1);
+	ms->c = c;
+	ms->cap = cap;
+	return (0);
+}
+
+/* Append a container, dropping it if empty. */
+static int
+ms_append(struct member_set *ms, struct ms_container *c)
+{
+	if (c->card == 0) {
+		c_free(c);
+		return (0);
+	}
+	if (ms_reserve(ms, ms->nc + 1) != 0) {
+		c_free(c);
+		return (-1);
+	}
+	ms->c[ms->nc++] = *c;
+	return (0);
+}
+
+void
+ms_init(struct member_set *ms)
+{
+	ms->c = NULL;
+	ms->nc = ms->cap = 0;
+}
+
+void
+ms_clear(struct member_set *ms)
+{
+	size_t i;
+
+	for (i = 0; i < ms->nc; i++)
+		c_free(&ms->c[i]);
+	free(ms->c);
+	ms_init(ms);
+}
+
+static int
+cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * Replace the contents of "ms" with the ids in "ids", which need not be
+ * sorted or unique.  This is much faster than repeated ms_add() calls
+ * since every container is built in one pass.
+ */
+int
+ms_build(struct member_set *ms, const int32_t *ids, size_t n)
+{
+	uint32_t *u;
+	size_t i, j, k, m;
+	struct ms_container c;
+
+	ms_clear(ms);
+	if (n == 0)
+		return (0);
+	u = malloc(n * sizeof(uint32_t));
+	if (u == NULL)
+		return (-1);
+	for (i = 0; i < n; i++)
+		u[i] = ms_bias(ids[i]);
+	qsort(u, n, sizeof(uint32_t), cmp_u32);
+	for (i = j = 1; i < n; i++)
+		if (u[i] != u[j - 1])
+			u[j++] = u[i];
+	n = j;
+
+	for (i = 0; i < n; i = j) {
+		for (j = i; j < n && (u[j] >> 16) == (u[i] >> 16); j++)
+			continue;
+		m = j - i;
+		c.key = (uint16_t)(u[i] >> 16);
+		c.is_bitmap = 0;
+		c.card = (uint32_t)m;
+		c.cap = (uint32_t)m;
+		c.u.array = malloc(m * sizeof(uint16_t));
+		if (c.u.array == NULL)
+			goto fail;
+		for (k = 0; k < m; k++)
+			c.u.array[k] = (uint16_t)u[i + k];
+		if (m > MS_ARRAY_MAX && c_array_to_bitmap(&c) != 0) {
+			c_free(&c);
+			goto fail;
+		}
+		if (ms_append(ms, &c) != 0)
+			goto fail;
+	}
+	free(u);
+	return (0);
+
+fail:
+	free(u);
+	ms_clear(ms);
+	return (-1);
+}
+
+/*
+ * ms_add() and ms_remove() return -1, having changed nothing, if memory
+ * runs out.
+ */
+int
+ms_add(struct member_set *ms, int32_t id)
+{
+	uint32_t u, i;
+	uint16_t low, *a;
+	size_t pos;
+	long idx;
+	struct ms_container *c;
+
+	u = ms_bias(id);
+	low = (uint16_t)u;
+	idx = ms_find(ms, (uint16_t)(u >> 16), &pos);
+	if (idx < 0) {
+		if (ms_reserve(ms, ms->nc + 1) != 0)
+			return (-1);
+		memmove(&ms->c[pos + 1], &ms->c[pos],
+		    (ms->nc - pos) * sizeof(ms->c[0]));
+		ms->nc++;
+		c = &ms->c[pos];
+		c->key = (uint16_t)(u >> 16);
+		c->is_bitmap = 0;
+		c->card = 0;
+		c->cap = 0;
+		c->u.array = NULL;
+	} else
+		c = &ms->c[idx];
+
+	/* A full array becomes a bitmap before the id goes in. */
+	if (!c->is_bitmap && c->card == MS_ARRAY_MAX && !c_contains(c, low) &&
+	    c_array_to_bitmap(c) != 0)
+		return (-1);
+	if (c->is_bitmap) {
+		if (!c_contains(c, low)) {
+			c->u.bits[low >> 6] |= 1ULL << (low & 63);
+			c->card++;
+		}
+		return (0);
+	}
+	for (i = 0; i < c->card && c->u.array[i] < low; i++)
+		continue;
+	if (i < c->card && c->u.array[i] == low)
+		return (0);
+	if (c->card == c->cap) {
+		a = realloc(c->u.array,
+		    (c->cap ? c->cap * 2 : 4) * sizeof(uint16_t));
+		if (a == NULL) {
+			if (idx < 0) {
+				memmove(&ms->c[pos], &ms->c[pos + 1],
+				    (ms->nc - pos - 1) * sizeof(ms->c[0]));
+				ms->nc--;
+			}
+			return (-1);
+		}
+		c->u.array = a;
+		c->cap = c->cap ? c->cap * 2 : 4;
+	}
+	memmove(&c->u.array[i + 1], &c->u.array[i],
+	    (c->card - i) * sizeof(uint16_t));
+	c->u.array[i] = low;
+	c->card++;
+	return (0);
+}
+
+int
+ms_remove(struct member_set *ms, int32_t id)
+{
+	uint32_t u, i;
+	uint16_t low;
+	long idx;
+	struct ms_container *c;
+
+	u = ms_bias(id);
+	low = (uint16_t)u;
+	idx = ms_find(ms, (uint16_t)(u >> 16), NULL);
+	if (idx < 0)
+		return (0);
+	c = &ms->c[idx];
+	if (!c_contains(c, low))
+		return (0);
+	if (c->is_bitmap) {
+		c->u.bits[low >> 6] &= ~(1ULL << (low & 63));
+		c->card--;
+		if (c->card <= MS_ARRAY_MAX && c_bitmap_to_array(c) != 0) {
+			c->u.bits[low >> 6] |= 1ULL << (low & 63);
+			c->card++;
+			return (-1);
+		}
+	} else {
+		for (i = 0; c->u.array[i] != low; i++)
+			continue;
+		memmove(&c->u.array[i], &c->u.array[i + 1],
+		    (c->card - i - 1) * sizeof(uint16_t));
+		c->card--;
+	}
+	if (c->card == 0) {
+		c_free(c);
+		memmove(&ms->c[idx], &ms->c[idx + 1],
+		    (ms->nc - idx - 1) * sizeof(ms->c[0]));
+		ms->nc--;
+	}
+	return (0);
+}
+
+int
+ms_contains(const struct member_set *ms, int32_t id)
+{
+	uint32_t u;
+	long idx;
+
+	u = ms_bias(id);
+	idx = ms_find(ms, (uint16_t)(u >> 16), NULL);
+	return (idx >= 0 && c_contains(&ms->c[idx], (uint16_t)u));
+}
+
+size_t
+ms_cardinality(const struct member_set *ms)
+{
+	size_t i, n;
+
+	for (i = n = 0; i < ms->nc; i++)
+		n += ms->c[i].card;
+	return (n);
+}
+
+size_t
+ms_memsize(const struct member_set *ms)
+{
+	size_t i, n;
+
+	n = ms->cap * sizeof(ms->c[0]);
+	for (i = 0; i < ms->nc; i++) {
+		if (ms->c[i].is_bitmap)
+			n += MS_BITMAP_WORDS * sizeof(uint64_t);
+		else
+			n += ms->c[i].cap * sizeof(uint16_t);
+	}
+	return (n);
+}
+
+/*
+ * Containers are always kept in canonical form (arrays exactly when the
+ * cardinality is at most MS_ARRAY_MAX), so a memberwise comparison is
+ * enough.
+ */
+int
+ms_equal(const struct member_set *a, const struct member_set *b)
+{
+	size_t i, len;
+	const struct ms_container *x, *y;
+
+	if (a->nc != b->nc)
+		return (0);
+	for (i = 0; i < a->nc; i++) {
+		x = &a->c[i];
+		y = &b->c[i];
+		if (x->key != y->key || x->card != y->card ||
+		    x->is_bitmap != y->is_bitmap)
+			return (0);
+		len = x->is_bitmap ? MS_BITMAP_WORDS * sizeof(uint64_t) :
+		    x->card * sizeof(uint16_t);
+		if (memcmp(x->u.array, y->u.array, len) != 0)
+			return (0);
+	}
+	return (1);
+}
+
+int
+ms_copy(struct member_set *dst, const struct member_set *src)
+{
+	size_t i;
+	struct ms_container c;
+
+	ms_init(dst);
+	if (ms_reserve(dst, src->nc) != 0)
+		return (-1);
+	for (i = 0; i < src->nc; i++) {
+		if (c_copy(&c, &src->c[i]) != 0 || ms_append(dst, &c) != 0) {
+			ms_clear(dst);
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Merge the container lists of "a" and "b" into "dst", which must be
+ * freshly initialized and distinct from both.
+ */
+static int
+ms_op(enum ms_op op, struct member_set *dst, const struct member_set *a,
+    const struct member_set *b)
+{
+	size_t i, j;
+	struct ms_container c;
+	int error;
+
+	ms_init(dst);
+	i = j = 0;
+	error = 0;
+	while (error == 0 && (i < a->nc || j < b->nc)) {
+		if (j >= b->nc || (i < a->nc && a->c[i].key < b->c[j].key)) {
+			if (op != MS_AND)
+				error = c_copy(&c, &a->c[i]) ||
+				    ms_append(dst, &c);
+			i++;
+		} else if (i >= a->nc || a->c[i].key > b->c[j].key) {
+			if (op == MS_OR)
+				error = c_copy(&c, &b->c[j]) ||
+				    ms_append(dst, &c);
+			j++;
+		} else {
+			error = c_op(op, &a->c[i], &b->c[j], &c) ||
+			    ms_append(dst, &c);
+			i++;
+			j++;
+		}
+	}
+	if (error) {
+		ms_clear(dst);
+		return (-1);
+	}
+	return (0);
+}
+
+int
+ms_union(struct member_set *dst, const struct member_set *a,
+    const struct member_set *b)
+{
+	return (ms_op(MS_OR, dst, a, b));
+}
+
+int
+ms_intersection(struct member_set *dst, const struct member_set *a,
+    const struct member_set *b)
+{
+	return (ms_op(MS_AND, dst, a, b));
+}
+
+int
+ms_difference(struct member_set *dst, const struct member_set *a,
+    const struct member_set *b)
+{
+	return (ms_op(MS_ANDNOT, dst, a, b));
+}
+
+/*
+ * Call "fn" for each id in ascending order.  Stops early and returns the
+ * callback's value if it is nonzero.
+ */
+int
+ms_each(const struct member_set *ms, ms_iter_fn fn, void *arg)
+{
+	size_t i, k;
+	uint32_t j, base;
+	uint64_t word;
+	const struct ms_container *c;
+	int rv;
+
+	for (i = 0; i < ms->nc; i++) {
+		c = &ms->c[i];
+		base = (uint32_t)c->key << 16;
+		if (!c->is_bitmap) {
+			for (j = 0; j < c->card; j++)
+				if ((rv = fn(ms_unbias(base | c->u.array[j]),
+				    arg)) != 0)
+					return (rv);
+			continue;
+		}
+		for (k = 0; k < MS_BITMAP_WORDS; k++) {
+			word = c->u.bits[k];
+			while (word != 0) {
+				j = (uint32_t)(k * 64 + __builtin_ctzll(word));
+				if ((rv = fn(ms_unbias(base | j), arg)) != 0)
+					return (rv);
+				word &= word - 1;
+			}
+		}
+	}
+	return (0);
+}
+
+static int
+to_array_cb(int32_t id, void *arg)
+{
+	int32_t **p = arg;
+
+	*(*p)++ = id;
+	return (0);
+}
+
+/*
+ * Store the ids in ascending order into "out", which must have room for
+ * ms_cardinality() entries.  Returns the number stored.
+ */
+size_t
+ms_to_array(const struct member_set *ms, int32_t *out)
+{
+	int32_t *p = out;
+
+	ms_each(ms, to_array_cb, &p);
+	return ((size_t)(p - out));
+}
+
+/*
+ * Local variables:
+ *  c-basic-offset: 8
+ * End:
+ */
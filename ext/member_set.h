@@ -0,0 +1,64 @@
+/*
+ * member_set.h: compressed sets of protection database ids
+ *
+ * A member set stores ptsids in the manner of a Roaring bitmap: the id
+ * space is cut into 65536-id chunks keyed on the high 16 bits, and each
+ * non-empty chunk is kept either as a sorted array of 16-bit offsets
+ * (when sparse) or as a 65536-bit bitmap (when dense).  A group of a
+ * hundred thousand users with mostly consecutive ids thus costs a few
+ * hundred kilobytes instead of one Ruby object per member.
+ *
+ * Nothing in here knows about Ruby, so it can be shared with other
+ * consumers of the protection database.  Functions returning int return
+ * 0 on success and -1 if memory could not be allocated.
+ */
+
+#ifndef MEMBER_SET_H
+#define MEMBER_SET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A container holding more than this many ids is stored as a bitmap. */
+#define	MS_ARRAY_MAX	4096
+#define	MS_BITMAP_WORDS	(65536 / 64)
+
+struct ms_container {
+	uint16_t key;		/* high 16 bits of the biased id */
+	uint16_t is_bitmap;
+	uint32_t card;		/* number of ids in this container */
+	uint32_t cap;		/* allocated array slots (arrays only) */
+	union {
+		uint16_t *array;
+		uint64_t *bits;
+	} u;
+};
+
+struct member_set {
+	struct ms_container *c;	/* sorted by key */
+	size_t nc;
+	size_t cap;
+};
+
+typedef int (*ms_iter_fn)(int32_t id, void *arg);
+
+void	ms_init(struct member_set *ms);
+void	ms_clear(struct member_set *ms);
+int	ms_build(struct member_set *ms, const int32_t *ids, size_t n);
+int	ms_add(struct member_set *ms, int32_t id);
+int	ms_remove(struct member_set *ms, int32_t id);
+int	ms_contains(const struct member_set *ms, int32_t id);
+size_t	ms_cardinality(const struct member_set *ms);
+size_t	ms_memsize(const struct member_set *ms);
+int	ms_equal(const struct member_set *a, const struct member_set *b);
+int	ms_copy(struct member_set *dst, const struct member_set *src);
+int	ms_union(struct member_set *dst, const struct member_set *a,
+	    const struct member_set *b);
+int	ms_intersection(struct member_set *dst, const struct member_set *a,
+	    const struct member_set *b);
+int	ms_difference(struct member_set *dst, const struct member_set *a,
+	    const struct member_set *b);
+int	ms_each(const struct member_set *ms, ms_iter_fn fn, void *arg);
+size_t	ms_to_array(const struct member_set *ms, int32_t *out);
+
+#endif /* MEMBER_SET_H */
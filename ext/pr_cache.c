@@ -0,0 +1,789 @@
+/*
+ * pr_cache.c: a persistent cache of protection database lookups
+ *
+ * See pr_cache.h.  Each cached id has a node, which is found through
+ * two hash tables, by id and by name, and holds the time the mapping
+ * was last seen and, if it has been fetched, the entry and the time it
+ * was.  A node whose mapping stops being true is marked dead rather
+ * than unlinked (there is at most one live node per id and per name),
+ * and the dead are swept out whenever the tables are rebuilt.
+ *
+ * A cache file starts with the eight bytes "AFSPRC01", and each node
+ * follows as
+ *
+ *	id (4), mapping time (8), entry time (8, or 0 if none),
+ *	name (a length byte and the name),
+ *	flags, owner, creator, ngroups, nusers, count (4 each; only if
+ *	there is an entry)
+ *
+ * with integers big-endian and times in seconds since the epoch.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pr_cache.h"
+
+#define	CACHE_MAGIC	"AFSPRC01"
+#define	CACHE_MAGIC_LEN	8
+#define	CACHE_REC_MAX	(4 + 8 + 8 + 1 + PR_MAXNAMELEN + 6 * 4)
+
+struct node {
+	afs_int32 id;
+	char name[PR_MAXNAMELEN];	/* lower-cased */
+	time_t named;		/* when the mapping was seen; 0 if dead */
+	time_t listed;		/* when e was fetched, or 0 */
+	struct prcheckentry e;
+	struct node *id_chain;
+	struct node *name_chain;
+	struct node *next;	/* every node, dead or alive */
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int cache_on;
+static long max_age = PR_CACHE_MAX_AGE;
+static struct pr_cache_stats cache_stats;
+static struct node *nodes;
+static size_t nnodes;
+static struct node **id_buckets;
+static struct node **name_buckets;
+static size_t nbuckets;
+
+static size_t
+hash_id(afs_int32 id)
+{
+	return ((uint32_t)id * 2654435761U);
+}
+
+static size_t
+hash_name(const char *name)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	while (*name != '\0')
+		h = (h ^ (unsigned char)*name++) * 1099511628211ULL;
+	return ((size_t)h);
+}
+
+/* As the library does before looking a name up. */
+static void
+lower(const char *in, char *out)
+{
+	size_t i;
+
+	for (i = 0; i < PR_MAXNAMELEN - 1 && in[i] != '\0'; i++)
+		out[i] = (in[i] >= 'A' && in[i] <= 'Z') ?
+		    in[i] - 'A' + 'a' : in[i];
+	out[i] = '\0';
+}
+
+/*
+ * Whether something fetched at "t" may still be used; nothing may if
+ * the maximum age is 0.  "stale" is set if it could have been, but for
+ * its age.
+ */
+static int
+fresh(time_t t, time_t now, int *stale)
+{
+	if (t == 0)
+		return (0);
+	if (max_age > 0 && t <= now && now - t <= max_age)
+		return (1);
+	if (stale != NULL)
+		*stale = 1;
+	return (0);
+}
+
+static struct node *
+find_id(afs_int32 id)
+{
+	struct node *n;
+
+	if (nbuckets == 0)
+		return (NULL);
+	for (n = id_buckets[hash_id(id) & (nbuckets - 1)]; n != NULL;
+	    n = n->id_chain)
+		if (n->named != 0 && n->id == id)
+			return (n);
+	return (NULL);
+}
+
+static struct node *
+find_name(const char *name)
+{
+	struct node *n;
+
+	if (nbuckets == 0)
+		return (NULL);
+	for (n = name_buckets[hash_name(name) & (nbuckets - 1)]; n != NULL;
+	    n = n->name_chain)
+		if (n->named != 0 && strcmp(n->name, name) == 0)
+			return (n);
+	return (NULL);
+}
+
+static void
+kill_node(struct node *n)
+{
+	if (n != NULL)
+		n->named = n->listed = 0;
+}
+
+static void
+link_node(struct node *n)
+{
+	size_t i;
+
+	i = hash_id(n->id) & (nbuckets - 1);
+	n->id_chain = id_buckets[i];
+	id_buckets[i] = n;
+	i = hash_name(n->name) & (nbuckets - 1);
+	n->name_chain = name_buckets[i];
+	name_buckets[i] = n;
+}
+
+/*
+ * Make room for another node, rebuilding the tables (without the dead)
+ * once they average two nodes a bucket.  If memory is short the chains
+ * just get longer.
+ */
+static void
+grow(void)
+{
+	struct node **ib, **nb, **np, *n;
+	size_t live, size;
+
+	if (nbuckets != 0 && nnodes < 2 * nbuckets)
+		return;
+	live = 0;
+	for (n = nodes; n != NULL; n = n->next)
+		if (n->named != 0)
+			live++;
+	for (size = 64; size < live; size *= 2)
+		continue;
+	ib = calloc(size, sizeof(*ib));
+	nb = calloc(size, sizeof(*nb));
+	if (ib == NULL || nb == NULL) {
+		free(ib);
+		free(nb);
+		return;
+	}
+	free(id_buckets);
+	free(name_buckets);
+	id_buckets = ib;
+	name_buckets = nb;
+	nbuckets = size;
+	for (np = &nodes; (n = *np) != NULL; ) {
+		if (n->named == 0) {
+			*np = n->next;
+			free(n);
+			nnodes--;
+			continue;
+		}
+		link_node(n);
+		np = &n->next;
+	}
+}
+
+/*
+ * Record that "name" (already lower-cased) is "id" as of "t", killing
+ * anything that says otherwise.  Returns the node, or NULL if memory
+ * is short.
+ */
+static struct node *
+bind_name(afs_int32 id, const char *name, time_t t)
+{
+	struct node *n;
+
+	n = find_id(id);
+	if (n != NULL && strcmp(n->name, name) == 0) {
+		if (t > n->named)
+			n->named = t;
+		return (n);
+	}
+	kill_node(n);
+	kill_node(find_name(name));
+	grow();
+	if (nbuckets == 0 || (n = calloc(1, sizeof(*n))) == NULL)
+		return (NULL);
+	n->id = id;
+	strcpy(n->name, name);
+	n->named = t;
+	link_node(n);
+	n->next = nodes;
+	nodes = n;
+	nnodes++;
+	return (n);
+}
+
+/*
+ * The library answers names that do not exist with ANONYMOUSID, and
+ * ids that do not exist with their own decimal form; neither is kept.
+ */
+static void
+note_name(afs_int32 id, const char *name, time_t t)
+{
+	char lname[PR_MAXNAMELEN], num[16];
+
+	lower(name, lname);
+	if (id == ANONYMOUSID && strcmp(lname, "anonymous") != 0)
+		return;
+	snprintf(num, sizeof(num), "%ld", (long)id);
+	if (strcmp(lname, num) == 0)
+		return;
+	bind_name(id, lname, t);
+}
+
+static void
+note_entry(const struct prcheckentry *e, time_t t)
+{
+	char lname[PR_MAXNAMELEN];
+	struct node *n;
+
+	lower(e->name, lname);
+	if ((n = bind_name(e->id, lname, t)) == NULL)
+		return;
+	n->e = *e;
+	n->listed = t;
+}
+
+static void
+note_listentry(const struct prlistentries *le, time_t t)
+{
+	struct prcheckentry e;
+
+	memset(&e, 0, sizeof(e));
+	e.flags = le->flags;
+	e.id = le->id;
+	e.owner = le->owner;
+	e.creator = le->creator;
+	e.ngroups = le->ngroups;
+	e.nusers = le->nusers;
+	e.count = le->count;
+	memcpy(e.name, le->name, sizeof(e.name));
+	e.name[sizeof(e.name) - 1] = '\0';
+	note_entry(&e, t);
+}
+
+static void
+forget_name(const char *name)
+{
+	char lname[PR_MAXNAMELEN];
+	struct node *n;
+
+	lower(name, lname);
+	if ((n = find_name(lname)) != NULL)
+		n->listed = 0;
+}
+
+/*
+ * A write was made; forget whatever it may have changed.  Membership
+ * changes alter the counts of both entries involved, and setting
+ * fields or a new owner alters just the entry.  Creating a group uses
+ * up some of the quota of its creator, whoever that is, and deleting
+ * an entry alters the counts of everything it was a member of or had
+ * as members, so those forget every entry.  Renaming a user renames
+ * the groups it owns, so renames forget everything.  A creation tells
+ * us a new mapping.
+ */
+static void
+invalidate(const struct pr_call *c, time_t t)
+{
+	char lname[PR_MAXNAMELEN];
+	struct node *n;
+	int entries, names;
+
+	entries = names = 0;
+	switch (c->op) {
+	case PR_OP_CREATEUSER:
+	case PR_OP_CREATEGROUP:
+	case PR_OP_DELETE:
+		lower(c->name, lname);
+		kill_node(find_name(lname));
+		if (c->op != PR_OP_DELETE && c->error == 0)
+			note_name(*c->idp, c->name, t);
+		entries = c->op != PR_OP_CREATEUSER;
+		break;
+	case PR_OP_DELETEBYID:
+		kill_node(find_id(c->id));
+		entries = 1;
+		break;
+	case PR_OP_ADDTOGROUP:
+	case PR_OP_REMOVEUSERFROMGROUP:
+		forget_name(c->name);
+		forget_name(c->name2);
+		break;
+	case PR_OP_CHANGEENTRY:
+		if (c->name2[0] != '\0' || c->has_newid)
+			entries = names = 1;
+		else
+			forget_name(c->name);
+		break;
+	case PR_OP_SETFIELDSENTRY:
+		if ((n = find_id(c->id)) != NULL)
+			n->listed = 0;
+		break;
+	default:
+		return;
+	}
+	cache_stats.invalidations++;
+	if (entries)
+		for (n = nodes; n != NULL; n = n->next) {
+			n->listed = 0;
+			if (names)
+				n->named = 0;
+		}
+}
+
+void
+pr_cache_start(void)
+{
+	cache_on = 1;
+}
+
+/*
+ * Answer "c" from the cache if possible, returning nonzero if so.
+ */
+int
+pr_cache_serve(struct pr_call *c)
+{
+	char lname[PR_MAXNAMELEN];
+	struct node *n;
+	afs_int32 *ids;
+	prname *names;
+	u_int i, len;
+	time_t now;
+	int served, stale;
+
+	if (!cache_on)
+		return (0);
+	switch (c->op) {
+	case PR_OP_SNAMETOID:
+	case PR_OP_SIDTONAME:
+	case PR_OP_NAMETOID:
+	case PR_OP_IDTONAME:
+	case PR_OP_LISTENTRY:
+		break;
+	default:
+		return (0);
+	}
+	now = time(NULL);
+	served = stale = 0;
+	pthread_mutex_lock(&cache_lock);
+	switch (c->op) {
+	case PR_OP_SNAMETOID:
+		lower(c->name, lname);
+		n = find_name(lname);
+		if (n != NULL && fresh(n->named, now, &stale)) {
+			*c->idp = n->id;
+			served = 1;
+		}
+		break;
+	case PR_OP_SIDTONAME:
+		n = find_id(c->id);
+		if (n != NULL && fresh(n->named, now, &stale)) {
+			strcpy(c->namep, n->name);
+			served = 1;
+		}
+		break;
+	case PR_OP_NAMETOID:
+		len = c->names->namelist_len;
+		if (len == 0 || (ids = malloc(len * sizeof(*ids))) == NULL)
+			break;
+		for (i = 0; i < len; i++) {
+			lower(c->names->namelist_val[i], lname);
+			n = find_name(lname);
+			if (n == NULL || !fresh(n->named, now, &stale))
+				break;
+			ids[i] = n->id;
+		}
+		if (i < len) {
+			free(ids);
+			break;
+		}
+		c->ids->idlist_len = len;
+		c->ids->idlist_val = ids;
+		served = 1;
+		break;
+	case PR_OP_IDTONAME:
+		len = c->ids->idlist_len;
+		if (len == 0 ||
+		    (names = malloc(len * sizeof(*names))) == NULL)
+			break;
+		for (i = 0; i < len; i++) {
+			n = find_id(c->ids->idlist_val[i]);
+			if (n == NULL || !fresh(n->named, now, &stale))
+				break;
+			strcpy(names[i], n->name);
+		}
+		if (i < len) {
+			free(names);
+			break;
+		}
+		c->names->namelist_len = len;
+		c->names->namelist_val = names;
+		served = 1;
+		break;
+	case PR_OP_LISTENTRY:
+		n = find_id(c->id);
+		if (n != NULL && fresh(n->listed, now, &stale)) {
+			*c->entry = n->e;
+			served = 1;
+		}
+		break;
+	default:
+		break;
+	}
+	if (served) {
+		c->error = 0;
+		cache_stats.hits++;
+	} else {
+		cache_stats.misses++;
+		if (stale)
+			cache_stats.expired++;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return (served);
+}
+
+/*
+ * Learn from a call that was made.
+ */
+void
+pr_cache_note(const struct pr_call *c)
+{
+	time_t now;
+	u_int i, len;
+	afs_int32 k;
+
+	if (!cache_on || (c->error != 0 && !PR_OP_IS_WRITE(c->op)))
+		return;
+	now = time(NULL);
+	pthread_mutex_lock(&cache_lock);
+	switch (c->op) {
+	case PR_OP_SNAMETOID:
+		note_name(*c->idp, c->name, now);
+		break;
+	case PR_OP_SIDTONAME:
+		note_name(c->id, c->namep, now);
+		break;
+	case PR_OP_NAMETOID:
+	case PR_OP_IDTONAME:
+		len = c->names->namelist_len;
+		if (c->ids->idlist_len < len)
+			len = c->ids->idlist_len;
+		for (i = 0; i < len; i++)
+			note_name(c->ids->idlist_val[i],
+			    c->names->namelist_val[i], now);
+		break;
+	case PR_OP_LISTENTRY:
+		note_entry(c->entry, now);
+		break;
+	case PR_OP_LISTENTRIES:
+		if (*c->entries == NULL)
+			break;
+		for (k = 0; k < *c->idp; k++)
+			note_listentry(&(*c->entries)[k], now);
+		break;
+	default:
+		if (PR_OP_IS_WRITE(c->op))
+			invalidate(c, now);
+		break;
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/* Forget the entry for "id", so that the next pr_ListEntry fetches it. */
+void
+pr_cache_forget(afs_int32 id)
+{
+	struct node *n;
+
+	pthread_mutex_lock(&cache_lock);
+	if ((n = find_id(id)) != NULL)
+		n->listed = 0;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+static void
+clear_locked(void)
+{
+	struct node *n;
+
+	while ((n = nodes) != NULL) {
+		nodes = n->next;
+		free(n);
+	}
+	nnodes = 0;
+	free(id_buckets);
+	free(name_buckets);
+	id_buckets = name_buckets = NULL;
+	nbuckets = 0;
+}
+
+void
+pr_cache_clear(void)
+{
+	pthread_mutex_lock(&cache_lock);
+	clear_locked();
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void
+pr_cache_set_max_age(long seconds)
+{
+	pthread_mutex_lock(&cache_lock);
+	max_age = seconds;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+long
+pr_cache_max_age(void)
+{
+	long rv;
+
+	pthread_mutex_lock(&cache_lock);
+	rv = max_age;
+	pthread_mutex_unlock(&cache_lock);
+	return (rv);
+}
+
+void
+pr_cache_get_stats(struct pr_cache_stats *stats)
+{
+	struct node *n;
+
+	pthread_mutex_lock(&cache_lock);
+	*stats = cache_stats;
+	stats->names = stats->entries = 0;
+	for (n = nodes; n != NULL; n = n->next) {
+		if (n->named != 0)
+			stats->names++;
+		if (n->listed != 0)
+			stats->entries++;
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+static unsigned char *
+put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+	return (p + 4);
+}
+
+static unsigned char *
+put64(unsigned char *p, uint64_t v)
+{
+	return (put32(put32(p, v >> 32), (uint32_t)v));
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | p[3]);
+}
+
+static uint64_t
+get64(const unsigned char *p)
+{
+	return ((uint64_t)get32(p) << 32 | get32(p + 4));
+}
+
+/*
+ * Write what is still fresh to a temporary file next to "path", then
+ * rename it into place, so that a reader never sees half a cache.
+ */
+int
+pr_cache_save(const char *path)
+{
+	unsigned char rec[CACHE_REC_MAX], *p;
+	struct node *n;
+	size_t len;
+	time_t now;
+	char *tmp;
+	FILE *f;
+	int fd, error;
+
+	len = strlen(path) + sizeof(".XXXXXX");
+	if ((tmp = malloc(len)) == NULL)
+		return (ENOMEM);
+	snprintf(tmp, len, "%s.XXXXXX", path);
+	if ((fd = mkstemp(tmp)) < 0 || (f = fdopen(fd, "wb")) == NULL) {
+		error = errno;
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp);
+		}
+		free(tmp);
+		return (error);
+	}
+	fwrite(CACHE_MAGIC, 1, CACHE_MAGIC_LEN, f);
+	pthread_mutex_lock(&cache_lock);
+	now = time(NULL);
+	for (n = nodes; n != NULL; n = n->next) {
+		if (!fresh(n->named, now, NULL))
+			continue;
+		p = put32(rec, n->id);
+		p = put64(p, n->named);
+		if (fresh(n->listed, now, NULL)) {
+			p = put64(p, n->listed);
+		} else
+			p = put64(p, 0);
+		len = strlen(n->name);
+		*p++ = len;
+		memcpy(p, n->name, len);
+		p += len;
+		if (fresh(n->listed, now, NULL)) {
+			p = put32(p, n->e.flags);
+			p = put32(p, n->e.owner);
+			p = put32(p, n->e.creator);
+			p = put32(p, n->e.ngroups);
+			p = put32(p, n->e.nusers);
+			p = put32(p, n->e.count);
+		}
+		fwrite(rec, 1, p - rec, f);
+	}
+	pthread_mutex_unlock(&cache_lock);
+	error = 0;
+	if (ferror(f))
+		error = errno ? errno : EIO;
+	if (fclose(f) != 0 && error == 0)
+		error = errno;
+	if (error == 0 && rename(tmp, path) != 0)
+		error = errno;
+	if (error != 0)
+		unlink(tmp);
+	free(tmp);
+	return (error);
+}
+
+/*
+ * Check the records from "p" up to "end", or if "apply" add the fresh
+ * ones to the cache.  Returns 0, or -1 if they are malformed.
+ */
+static int
+load_records(const unsigned char *p, const unsigned char *end, int apply)
+{
+	struct prcheckentry e;
+	struct node *n;
+	time_t named, listed, now;
+	size_t len, need;
+	afs_int32 id;
+	char name[PR_MAXNAMELEN];
+
+	now = time(NULL);
+	while (p < end) {
+		if (end - p < 21)
+			return (-1);
+		id = (afs_int32)get32(p);
+		named = (time_t)get64(p + 4);
+		listed = (time_t)get64(p + 12);
+		len = p[20];
+		need = 21 + len + (listed != 0 ? 6 * 4 : 0);
+		if (len == 0 || len >= PR_MAXNAMELEN ||
+		    (size_t)(end - p) < need)
+			return (-1);
+		memcpy(name, p + 21, len);
+		name[len] = '\0';
+		if (memchr(name, '\0', len) != NULL)
+			return (-1);
+		if (apply && fresh(named, now, NULL) &&
+		    (n = bind_name(id, name, named)) != NULL &&
+		    fresh(listed, now, NULL)) {
+			memset(&e, 0, sizeof(e));
+			e.id = id;
+			memcpy(e.name, name, len + 1);
+			e.flags = (afs_int32)get32(p + 21 + len);
+			e.owner = (afs_int32)get32(p + 25 + len);
+			e.creator = (afs_int32)get32(p + 29 + len);
+			e.ngroups = (afs_int32)get32(p + 33 + len);
+			e.nusers = (afs_int32)get32(p + 37 + len);
+			e.count = (afs_int32)get32(p + 41 + len);
+			n->e = e;
+			n->listed = listed;
+		}
+		p += need;
+	}
+	return (0);
+}
+
+/*
+ * Add what a cache file holds to the cache.  A malformed file adds
+ * nothing.
+ */
+int
+pr_cache_load(const char *path)
+{
+	unsigned char *data;
+	FILE *f;
+	long size;
+	int error;
+
+	if ((f = fopen(path, "rb")) == NULL)
+		return (errno);
+	data = NULL;
+	error = -1;
+	if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET) != 0) {
+		error = errno;
+		goto done;
+	}
+	if ((data = malloc(size ? size : 1)) == NULL) {
+		error = ENOMEM;
+		goto done;
+	}
+	if (fread(data, 1, size, f) != (size_t)size) {
+		error = ferror(f) ? errno : -1;
+		goto done;
+	}
+	if (size < CACHE_MAGIC_LEN ||
+	    memcmp(data, CACHE_MAGIC, CACHE_MAGIC_LEN) != 0 ||
+	    load_records(data + CACHE_MAGIC_LEN, data + size, 0) != 0)
+		goto done;
+	pthread_mutex_lock(&cache_lock);
+	load_records(data + CACHE_MAGIC_LEN, data + size, 1);
+	pthread_mutex_unlock(&cache_lock);
+	error = 0;
+
+done:
+	free(data);
+	fclose(f);
+	return (error);
+}
+
+void
+pr_cache_atfork_prepare(void)
+{
+	pthread_mutex_lock(&cache_lock);
+}
+
+void
+pr_cache_atfork_parent(void)
+{
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void
+pr_cache_atfork_child(void)
+{
+	pthread_mutex_init(&cache_lock, NULL);
+}
+
+/*
+ * Local variables:
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -0,0 +1,64 @@
+/*
+ * pr_cache.h: a persistent cache of protection database lookups
+ *
+ * Once started, the cache learns name/id mappings from every
+ * pr_SNameToId, pr_SIdToName, pr_NameToId and pr_IdToName call that
+ * succeeds, and entries from every pr_ListEntry and pr_ListEntries
+ * call, each stamped with the time it was fetched.  Later calls of the
+ * first five kinds are answered from it without going to the ptserver,
+ * so long as everything they ask about was fetched no more than the
+ * maximum age ago; older answers are fetched afresh.  (pr_NameToId and
+ * pr_IdToName calls are only answered if every name or id in them is
+ * known.)  Names that do not exist are never cached.
+ *
+ * A write made through pr_call_run() forgets the cached entries it may
+ * have changed, which for deletions and group creations (which change
+ * the counts and quotas of entries they do not name) means all of
+ * them; deletions and renames forget the mappings they affect as well.
+ * Writes made by other clients are only noticed once the answers they
+ * affect grow too old.  A maximum age of 0 means nothing is answered
+ * from the cache at all.
+ *
+ * The cache can be saved to a file and loaded again by a later process,
+ * which is the point: a short-lived job starts with what the last one
+ * learned.  Timestamps are wall-clock times so that they survive the
+ * trip, and answers already too old are not saved.
+ *
+ * Nothing in here knows about Ruby.  Functions returning int return 0
+ * on success, an errno value if the file could not be opened, read or
+ * written, or -1 if it is not a cache file.
+ */
+
+#ifndef PR_CACHE_H
+#define PR_CACHE_H
+
+#include "pr_call.h"
+
+#define	PR_CACHE_MAX_AGE	600	/* default, in seconds */
+
+struct pr_cache_stats {
+	unsigned long hits;		/* calls answered from the cache */
+	unsigned long misses;		/* calls that had to be made */
+	unsigned long expired;		/* of those, because of age alone */
+	unsigned long invalidations;	/* writes that forgot anything */
+	unsigned long names;		/* mappings held */
+	unsigned long entries;		/* entries held */
+};
+
+void	pr_cache_start(void);
+int	pr_cache_load(const char *path);
+int	pr_cache_save(const char *path);
+void	pr_cache_clear(void);
+void	pr_cache_forget(afs_int32 id);
+void	pr_cache_set_max_age(long seconds);
+long	pr_cache_max_age(void);
+void	pr_cache_get_stats(struct pr_cache_stats *stats);
+
+/* For pr_call_run(). */
+int	pr_cache_serve(struct pr_call *c);
+void	pr_cache_note(const struct pr_call *c);
+void	pr_cache_atfork_prepare(void);
+void	pr_cache_atfork_parent(void);
+void	pr_cache_atfork_child(void);
+
+#endif /* PR_CACHE_H */
@@ -0,0 +1,1010 @@
+/*
+ * pr_call.c: protection database calls as data
+ *
+ * See pr_call.h.  The worker pool is a fixed-size (but adjustable) set
+ * of detached threads taking calls from a FIFO queue; a caller learns
+ * that its call has completed either by waiting on the pool's condition
+ * variable or, if it supplied one, by the wakeup descriptor becoming
+ * readable.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pr_cache.h"
+#include "pr_call.h"
+#include "pr_trace.h"
+
+const char *pr_op_names[PR_NOPS] = {
+	"pr_SNameToId",
+	"pr_SIdToName",
+	"pr_NameToId",
+	"pr_IdToName",
+	"pr_ListEntry",
+	"pr_ListEntries",
+	"pr_ListMaxUserId",
+	"pr_ListMaxGroupId",
+	"pr_IDListMembers",
+	"pr_GetCPS",
+	"pr_IsAMemberOf",
+	"pr_ListOwned",
+	"ubik_PR_ListElements",
+	"pr_CreateUser",
+	"pr_CreateGroup",
+	"pr_Delete",
+	"pr_DeleteByID",
+	"pr_SetMaxUserId",
+	"pr_SetMaxGroupId",
+	"pr_AddToGroup",
+	"pr_RemoveUserFromGroup",
+	"pr_ChangeEntry",
+	"pr_SetFieldsEntry",
+};
+
+static afs_int32 dispatch(struct pr_call *c);
+
+static pr_call_executor_fn executor = pr_call_run;
+static pr_call_connect_fn connector;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static struct pr_call *queue_head, *queue_tail;
+static int pool_max = 8;
+static int pool_threads;
+static int pool_idle;
+
+/*
+ * Admission control.  Reads and writes each have a budget: a limit on
+ * the number of calls in flight, and optionally a token bucket limiting
+ * the rate at which they start.  The concurrency limit is adjusted in
+ * the AIMD fashion: it grows by one for every "limit" calls that finish
+ * promptly, and is cut by a quarter (at most once a round) when a call
+ * fails at the RX level or latency passes the target.  Latency is
+ * tracked separately for each kind of call, since a pr_ListEntries page
+ * or a big pr_GetCPS takes far longer than a pr_SNameToId, and each
+ * call is judged by the moving average for its own kind.  Unless one is
+ * configured, the target is twice the best latency seen lately for that
+ * kind, but not less than LATENCY_FLOOR.
+ */
+#define	LATENCY_FLOOR	0.010
+#define	LATENCY_ALPHA	0.125
+#define	LATENCY_EPOCH	1000	/* calls between resets of the best */
+#define	DECREASE	0.75
+
+struct latency {
+	double average;		/* moving average */
+	double best;
+	unsigned long samples;
+};
+
+struct limiter {
+	pthread_mutex_t lock;
+	pthread_cond_t slot;
+	struct pr_limit_config cfg;
+	double limit;
+	int inflight;
+	double tokens;
+	double refilled;	/* when tokens was last topped up */
+	struct latency all;	/* for the statistics */
+	struct latency op[PR_NOPS];
+	unsigned long round;	/* calls since the last decrease */
+	struct pr_limit_stats stats;
+};
+
+#define	LIMITER_INITIALIZER(max) {					\
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,		\
+	{ (max), 1, 0.0, 0.0, 0.0 }, (max),				\
+}
+
+static struct limiter limiters[2] = {
+	LIMITER_INITIALIZER(32),	/* reads */
+	LIMITER_INITIALIZER(8),		/* writes */
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Wait until the budget allows another call, then count it in flight.
+ * Returns the time the call was admitted, or a negative number if "c"
+ * was cancelled while waiting.  The wait for tokens is made on the
+ * condition variable too, so that pr_call_cancel() can cut it short.
+ */
+static double
+admit(struct limiter *l, struct pr_call *c)
+{
+	struct timespec ts;
+	double start, t, burst, delay;
+	int waited;
+
+	start = now();
+	waited = 0;
+	pthread_mutex_lock(&l->lock);
+	for (;;) {
+		if (c->cancelled) {
+			pthread_mutex_unlock(&l->lock);
+			return (-1);
+		}
+		if (l->cfg.max_concurrency > 0 &&
+		    l->inflight >= (int)l->limit) {
+			waited = 1;
+			pthread_cond_wait(&l->slot, &l->lock);
+			continue;
+		}
+		if (l->cfg.rate <= 0)
+			break;
+		burst = l->cfg.burst > 0 ? l->cfg.burst : l->cfg.rate;
+		if (burst < 1)
+			burst = 1;
+		t = now();
+		if (l->refilled == 0)
+			l->tokens = burst;
+		else
+			l->tokens += (t - l->refilled) * l->cfg.rate;
+		if (l->tokens > burst)
+			l->tokens = burst;
+		l->refilled = t;
+		if (l->tokens >= 1) {
+			l->tokens -= 1;
+			break;
+		}
+		delay = (1 - l->tokens) / l->cfg.rate;
+		waited = 1;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		delay += ts.tv_nsec / 1e9;
+		ts.tv_sec += (time_t)delay;
+		ts.tv_nsec = (long)((delay - (time_t)delay) * 1e9);
+		pthread_cond_timedwait(&l->slot, &l->lock, &ts);
+	}
+	l->inflight++;
+	t = now();
+	if (waited) {
+		l->stats.waits++;
+		l->stats.wait_time += t - start;
+	}
+	pthread_mutex_unlock(&l->lock);
+	return (t);
+}
+
+/*
+ * Make "c" give up if it is still waiting to be admitted, or as soon as
+ * it starts to; pr_call_run() then returns EINTR without making it.  A
+ * call already under way is not affected.  This may be called from any
+ * thread, at any time before the call is reused.
+ */
+void
+pr_call_cancel(struct pr_call *c)
+{
+	int i;
+
+	c->cancelled = 1;
+	for (i = 0; i < 2; i++) {
+		pthread_mutex_lock(&limiters[i].lock);
+		pthread_cond_broadcast(&limiters[i].slot);
+		pthread_mutex_unlock(&limiters[i].lock);
+	}
+}
+
+static void
+sample(struct latency *t, double elapsed)
+{
+	if (t->samples++ % LATENCY_EPOCH == 0 || elapsed < t->best)
+		t->best = elapsed;
+	if (t->average == 0)
+		t->average = elapsed;
+	else
+		t->average += LATENCY_ALPHA * (elapsed - t->average);
+}
+
+/*
+ * Account for a finished call of kind "op", and adjust the limit
+ * accordingly.  Negative errors come from RX (timeouts, dead calls, busy
+ * servers) and are taken as signs of overload; the ptserver's own errors
+ * are not.
+ */
+static void
+release(struct limiter *l, enum pr_op op, double elapsed, afs_int32 error)
+{
+	struct latency *t = &l->op[op];
+	double target;
+	int congested;
+
+	pthread_mutex_lock(&l->lock);
+	l->inflight--;
+	l->stats.calls++;
+	if (error != 0)
+		l->stats.errors++;
+	congested = error < 0;
+	if (!congested) {
+		sample(&l->all, elapsed);
+		sample(t, elapsed);
+		target = l->cfg.latency_target;
+		if (target <= 0) {
+			target = 2 * t->best;
+			if (target < LATENCY_FLOOR)
+				target = LATENCY_FLOOR;
+		}
+		congested = t->average > target;
+	}
+	l->round++;
+	if (congested) {
+		l->stats.congested++;
+		if (l->round >= l->limit) {
+			l->limit *= DECREASE;
+			if (l->limit < l->cfg.min_concurrency)
+				l->limit = l->cfg.min_concurrency;
+			l->round = 0;
+			l->stats.decreases++;
+		}
+	} else if (l->cfg.max_concurrency > 0) {
+		l->limit += 1 / l->limit;
+		if (l->limit > l->cfg.max_concurrency)
+			l->limit = l->cfg.max_concurrency;
+	}
+	pthread_cond_broadcast(&l->slot);
+	pthread_mutex_unlock(&l->lock);
+}
+
+/*
+ * Set the budget for reads (writes == 0) or writes.  A max_concurrency
+ * of zero means no concurrency limit, and a rate of zero no rate limit.
+ */
+int
+pr_call_set_limits(int writes, const struct pr_limit_config *cfg)
+{
+	struct limiter *l = &limiters[writes != 0];
+
+	if (cfg->max_concurrency < 0 || cfg->min_concurrency < 1 ||
+	    (cfg->max_concurrency > 0 &&
+		cfg->min_concurrency > cfg->max_concurrency) ||
+	    cfg->rate < 0 || cfg->burst < 0 || cfg->latency_target < 0)
+		return (-1);
+	pthread_mutex_lock(&l->lock);
+	if (l->cfg.max_concurrency == 0 || l->limit > cfg->max_concurrency)
+		l->limit = cfg->max_concurrency;
+	if (l->limit < cfg->min_concurrency)
+		l->limit = cfg->min_concurrency;
+	if (cfg->rate != l->cfg.rate || cfg->burst != l->cfg.burst)
+		l->refilled = 0;
+	l->cfg = *cfg;
+	pthread_cond_broadcast(&l->slot);
+	pthread_mutex_unlock(&l->lock);
+	return (0);
+}
+
+void
+pr_call_get_limits(int writes, struct pr_limit_config *cfg)
+{
+	struct limiter *l = &limiters[writes != 0];
+
+	pthread_mutex_lock(&l->lock);
+	*cfg = l->cfg;
+	pthread_mutex_unlock(&l->lock);
+}
+
+void
+pr_call_limit_stats(int writes, struct pr_limit_stats *stats)
+{
+	struct limiter *l = &limiters[writes != 0];
+
+	pthread_mutex_lock(&l->lock);
+	*stats = l->stats;
+	stats->limit = l->cfg.max_concurrency > 0 ? l->limit : 0;
+	stats->inflight = l->inflight;
+	stats->latency = l->all.average;
+	stats->best_latency = l->all.best;
+	pthread_mutex_unlock(&l->lock);
+}
+
+/*
+ * Actually make the call described by "c", in the calling thread, once
+ * admission control lets it through; or answer it from the cache (see
+ * pr_cache.h) or, if a trace is being replayed, from that instead (see
+ * pr_trace.h).  Only a call that is really made needs the connection,
+ * so the connect function is run just before admission.
+ */
+afs_int32
+pr_call_run(struct pr_call *c)
+{
+	struct limiter *l = &limiters[PR_OP_IS_WRITE(c->op) != 0];
+	double start, elapsed;
+	afs_int32 idp_in;
+
+	if (pr_cache_serve(c))
+		return (c->error);
+	if (pr_trace_serve(c)) {
+		pr_cache_note(c);
+		return (c->error);
+	}
+	if (connector != NULL && (c->error = (*connector)()) != 0)
+		return (c->error);
+	idp_in = c->idp != NULL ? *c->idp : 0;
+	start = admit(l, c);
+	if (start < 0)
+		return (c->error = EINTR);
+	dispatch(c);
+	elapsed = now() - start;
+	release(l, c->op, elapsed, c->error);
+	pr_trace_note(c, idp_in, elapsed);
+	pr_cache_note(c);
+	return (c->error);
+}
+
+static afs_int32
+dispatch(struct pr_call *c)
+{
+	switch (c->op) {
+	case PR_OP_SNAMETOID:
+		c->error = pr_SNameToId(c->name, c->idp);
+		break;
+	case PR_OP_SIDTONAME:
+		c->error = pr_SIdToName(c->id, c->namep);
+		break;
+	case PR_OP_NAMETOID:
+		c->error = pr_NameToId(c->names, c->ids);
+		break;
+	case PR_OP_IDTONAME:
+		c->error = pr_IdToName(c->ids, c->names);
+		break;
+	case PR_OP_LISTENTRY:
+		c->error = pr_ListEntry(c->id, c->entry);
+		break;
+	case PR_OP_LISTENTRIES:
+		c->error = pr_ListEntries(c->arg[0], c->arg[1], c->idp,
+		    c->entries, c->idp2);
+		break;
+	case PR_OP_LISTMAXUSERID:
+		c->error = pr_ListMaxUserId(c->idp);
+		break;
+	case PR_OP_LISTMAXGROUPID:
+		c->error = pr_ListMaxGroupId(c->idp);
+		break;
+	case PR_OP_IDLISTMEMBERS:
+		c->error = pr_IDListMembers(c->id, c->names);
+		break;
+	case PR_OP_GETCPS:
+		c->error = pr_GetCPS(c->id, c->list);
+		break;
+	case PR_OP_ISAMEMBEROF:
+		c->error = pr_IsAMemberOf(c->name, c->name2, c->idp);
+		break;
+	case PR_OP_LISTOWNED:
+		c->error = pr_ListOwned(c->id, c->names, c->idp);
+		break;
+	case PR_OP_LISTELEMENTS:
+#ifdef HAVE_UBIK_PR_LISTELEMENTS
+		c->error = ubik_PR_ListElements(pruclient, 0, c->id, c->list,
+		    c->idp);
+#else
+		c->error = ENOSYS;
+#endif
+		break;
+	case PR_OP_CREATEUSER:
+		c->error = pr_CreateUser(c->name, c->idp);
+		break;
+	case PR_OP_CREATEGROUP:
+		c->error = pr_CreateGroup(c->name,
+		    c->has_name3 ? c->name3 : NULL, c->idp);
+		break;
+	case PR_OP_DELETE:
+		c->error = pr_Delete(c->name);
+		break;
+	case PR_OP_DELETEBYID:
+		c->error = pr_DeleteByID(c->id);
+		break;
+	case PR_OP_SETMAXUSERID:
+		c->error = pr_SetMaxUserId(c->id);
+		break;
+	case PR_OP_SETMAXGROUPID:
+		c->error = pr_SetMaxGroupId(c->id);
+		break;
+	case PR_OP_ADDTOGROUP:
+		c->error = pr_AddToGroup(c->name, c->name2);
+		break;
+	case PR_OP_REMOVEUSERFROMGROUP:
+		c->error = pr_RemoveUserFromGroup(c->name, c->name2);
+		break;
+	case PR_OP_CHANGEENTRY:
+		c->error = pr_ChangeEntry(c->name, c->name2,
+		    c->has_newid ? &c->arg[0] : NULL,
+		    c->has_name3 ? c->name3 : NULL);
+		break;
+	case PR_OP_SETFIELDSENTRY:
+		c->error = pr_SetFieldsEntry(c->id, c->arg[0], c->arg[1],
+		    c->arg[2], c->arg[3]);
+		break;
+	default:
+		c->error = EINVAL;
+		break;
+	}
+	return (c->error);
+}
+
+/*
+ * Make the call using whatever executor has been installed.
+ */
+afs_int32
+pr_call_execute(struct pr_call *c)
+{
+	return ((*executor)(c));
+}
+
+void
+pr_call_set_executor(pr_call_executor_fn fn)
+{
+	executor = (fn != NULL) ? fn : pr_call_run;
+}
+
+void
+pr_call_set_connect(pr_call_connect_fn fn)
+{
+	connector = fn;
+}
+
+static void *
+pool_worker(void *arg)
+{
+	struct pr_call *c;
+	char wakeup = 0;
+
+	pthread_mutex_lock(&pool_lock);
+	for (;;) {
+		while (queue_head == NULL && pool_threads <= pool_max) {
+			pool_idle++;
+			pthread_cond_wait(&pool_work, &pool_lock);
+			pool_idle--;
+		}
+		if (pool_threads > pool_max)
+			break;
+		c = queue_head;
+		queue_head = c->next;
+		if (queue_head == NULL)
+			queue_tail = NULL;
+		pthread_mutex_unlock(&pool_lock);
+
+		pr_call_run(c);
+
+		/*
+		 * The wakeup is written with the lock held, so that whoever
+		 * reads it and then looks at "done" finds it set, and so
+		 * that the descriptor is still open: once the lock is
+		 * released, the caller is free to close it.  A full pipe
+		 * is readable already, so EAGAIN loses nothing.
+		 */
+		pthread_mutex_lock(&pool_lock);
+		c->done = 1;
+		if (c->wakeup_fd >= 0)
+			while (write(c->wakeup_fd, &wakeup, 1) < 0 &&
+			    errno == EINTR)
+				continue;
+		pthread_cond_broadcast(&pool_done);
+	}
+	pool_threads--;
+	pthread_mutex_unlock(&pool_lock);
+	return (NULL);
+}
+
+/*
+ * Set the maximum number of worker threads.  Surplus threads exit once
+ * they finish their current call.
+ */
+int
+pr_call_set_workers(int n)
+{
+	if (n < 1)
+		return (-1);
+	pthread_mutex_lock(&pool_lock);
+	pool_max = n;
+	pthread_cond_broadcast(&pool_work);
+	pthread_mutex_unlock(&pool_lock);
+	return (0);
+}
+
+int
+pr_call_workers(void)
+{
+	return (pool_max);
+}
+
+/*
+ * Queue "c" to be run by a worker thread, starting one if none is idle.
+ * Returns -1 if there are no workers and none could be started, in which
+ * case the caller should just run the call itself.
+ */
+int
+pr_call_submit(struct pr_call *c)
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+
+	c->done = 0;
+	c->next = NULL;
+	pthread_mutex_lock(&pool_lock);
+	if (pool_idle == 0 && pool_threads < pool_max) {
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&thread, &attr, pool_worker, NULL) == 0)
+			pool_threads++;
+		pthread_attr_destroy(&attr);
+	}
+	if (pool_threads == 0) {
+		pthread_mutex_unlock(&pool_lock);
+		return (-1);
+	}
+	if (queue_tail != NULL)
+		queue_tail->next = c;
+	else
+		queue_head = c;
+	queue_tail = c;
+	pthread_cond_signal(&pool_work);
+	pthread_mutex_unlock(&pool_lock);
+	return (0);
+}
+
+/*
+ * Block until a submitted call has completed.
+ */
+void
+pr_call_wait(struct pr_call *c)
+{
+	pthread_mutex_lock(&pool_lock);
+	while (!c->done)
+		pthread_cond_wait(&pool_done, &pool_lock);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+int
+pr_call_done(struct pr_call *c)
+{
+	int done;
+
+	pthread_mutex_lock(&pool_lock);
+	done = c->done;
+	pthread_mutex_unlock(&pool_lock);
+	return (done);
+}
+
+/*
+ * Fork handlers, for whoever calls pthread_atfork().  The pool lock is
+ * held across fork() so that the child does not inherit it locked by a
+ * thread that no longer exists, and so are the admission control locks.
+ * None of the workers survive into the child either, so it starts with
+ * an empty pool and nothing in flight; any calls still queued belonged
+ * to threads of the parent and are dropped.
+ */
+void
+pr_call_atfork_prepare(void)
+{
+	pthread_mutex_lock(&pool_lock);
+	pthread_mutex_lock(&limiters[0].lock);
+	pthread_mutex_lock(&limiters[1].lock);
+	pr_trace_atfork_prepare();
+	pr_cache_atfork_prepare();
+}
+
+void
+pr_call_atfork_parent(void)
+{
+	pr_cache_atfork_parent();
+	pr_trace_atfork_parent();
+	pthread_mutex_unlock(&limiters[1].lock);
+	pthread_mutex_unlock(&limiters[0].lock);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void
+pr_call_atfork_child(void)
+{
+	int i;
+
+	pr_cache_atfork_child();
+	pr_trace_atfork_child();
+	for (i = 0; i < 2; i++) {
+		pthread_mutex_init(&limiters[i].lock, NULL);
+		pthread_cond_init(&limiters[i].slot, NULL);
+		limiters[i].inflight = 0;
+	}
+	pthread_mutex_init(&pool_lock, NULL);
+	pthread_cond_init(&pool_work, NULL);
+	pthread_cond_init(&pool_done, NULL);
+	queue_head = queue_tail = NULL;
+	pool_threads = 0;
+	pool_idle = 0;
+}
+
+/*
+ * Set up "c" to make an "op" call; the caller fills in the arguments
+ * and result pointers.  The wrappers below all start here.
+ */
+void
+pr_call_init(struct pr_call *c, enum pr_op op)
+{
+	memset(c, 0, sizeof(*c));
+	c->op = op;
+	c->wakeup_fd = -1;
+}
+
+/*
+ * The wrappers.
+ */
+
+static void
+copy_name(char *dst, const char *src)
+{
+	strncpy(dst, src, PR_MAXNAMELEN - 1);
+	dst[PR_MAXNAMELEN - 1] = '\0';
+}
+
+afs_int32
+rpc_SNameToId(char *name, afs_int32 *id)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_SNAMETOID);
+	copy_name(c.name, name);
+	c.idp = id;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_SIdToName(afs_int32 id, char *name)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_SIDTONAME);
+	c.id = id;
+	c.namep = name;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_NameToId(namelist *names, idlist *ids)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_NAMETOID);
+	c.names = names;
+	c.ids = ids;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_IdToName(idlist *ids, namelist *names)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_IDTONAME);
+	c.ids = ids;
+	c.names = names;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_ListEntry(afs_int32 id, struct prcheckentry *entry)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_LISTENTRY);
+	c.id = id;
+	c.entry = entry;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_ListEntries(int flags, afs_int32 index, afs_int32 *nentries,
+    struct prlistentries **entries, afs_int32 *nextindex)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_LISTENTRIES);
+	c.arg[0] = flags;
+	c.arg[1] = index;
+	c.idp = nentries;
+	c.entries = entries;
+	c.idp2 = nextindex;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_ListMaxUserId(afs_int32 *id)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_LISTMAXUSERID);
+	c.idp = id;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_ListMaxGroupId(afs_int32 *id)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_LISTMAXGROUPID);
+	c.idp = id;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_IDListMembers(afs_int32 id, namelist *names)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_IDLISTMEMBERS);
+	c.id = id;
+	c.names = names;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_GetCPS(afs_int32 id, prlist *cps)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_GETCPS);
+	c.id = id;
+	c.list = cps;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_IsAMemberOf(char *user, char *group, afs_int32 *flag)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_ISAMEMBEROF);
+	copy_name(c.name, user);
+	copy_name(c.name2, group);
+	c.idp = flag;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_ListOwned(afs_int32 id, namelist *names, afs_int32 *more)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_LISTOWNED);
+	c.id = id;
+	c.names = names;
+	c.idp = more;
+	return (pr_call_execute(&c));
+}
+
+/*
+ * The RPC underneath pr_IDListMembers(): the member ids, without the
+ * IdToName call the library makes to turn them into names.  "over" is
+ * set if the list was cut short.
+ */
+afs_int32
+rpc_ListElements(afs_int32 id, prlist *elist, afs_int32 *over)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_LISTELEMENTS);
+	c.id = id;
+	c.list = elist;
+	c.idp = over;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_CreateUser(char *name, afs_int32 *id)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_CREATEUSER);
+	copy_name(c.name, name);
+	c.idp = id;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_CreateGroup(char *name, char *owner, afs_int32 *id)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_CREATEGROUP);
+	copy_name(c.name, name);
+	if (owner != NULL) {
+		copy_name(c.name3, owner);
+		c.has_name3 = 1;
+	}
+	c.idp = id;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_Delete(char *name)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_DELETE);
+	copy_name(c.name, name);
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_DeleteByID(afs_int32 id)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_DELETEBYID);
+	c.id = id;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_SetMaxUserId(afs_int32 id)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_SETMAXUSERID);
+	c.id = id;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_SetMaxGroupId(afs_int32 id)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_SETMAXGROUPID);
+	c.id = id;
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_AddToGroup(char *user, char *group)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_ADDTOGROUP);
+	copy_name(c.name, user);
+	copy_name(c.name2, group);
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_RemoveUserFromGroup(char *user, char *group)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_REMOVEUSERFROMGROUP);
+	copy_name(c.name, user);
+	copy_name(c.name2, group);
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_ChangeEntry(char *name, char *newname, afs_int32 *newid, char *newowner)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_CHANGEENTRY);
+	copy_name(c.name, name);
+	copy_name(c.name2, newname);
+	if (newid != NULL) {
+		c.arg[0] = *newid;
+		c.has_newid = 1;
+	}
+	if (newowner != NULL) {
+		copy_name(c.name3, newowner);
+		c.has_name3 = 1;
+	}
+	return (pr_call_execute(&c));
+}
+
+afs_int32
+rpc_SetFieldsEntry(afs_int32 id, afs_int32 mask, afs_int32 flags,
+    afs_int32 ngroups, afs_int32 nusers)
+{
+	struct pr_call c;
+
+	pr_call_init(&c, PR_OP_SETFIELDSENTRY);
+	c.id = id;
+	c.arg[0] = mask;
+	c.arg[1] = flags;
+	c.arg[2] = ngroups;
+	c.arg[3] = nusers;
+	return (pr_call_execute(&c));
+}
+
+/*
+ * The ids of the members of group "id" (or of the groups that user "id"
+ * belongs to).  Where the library lets us make the ListElements RPC
+ * ourselves that is all it takes; otherwise pr_IDListMembers only
+ * returns names, so they are turned back into ids with pr_NameToId,
+ * PR_MAXLIST at a time.  If a call fails, *failed is set to the one
+ * that did and ids is left empty.  A list the ptserver cut short is a
+ * failure too, PRTOOMANY, rather than passed off as the whole of it.
+ */
+afs_int32
+pr_call_member_ids(afs_int32 id, idlist *ids, enum pr_op *failed)
+{
+#ifdef HAVE_UBIK_PR_LISTELEMENTS
+	prlist elist;
+	afs_int32 error, over;
+
+	elist.prlist_len = 0;
+	elist.prlist_val = NULL;
+	over = 0;
+	error = rpc_ListElements(id, &elist, &over);
+	if (error == 0 && over != 0)
+		error = PRTOOMANY;
+	if (error != 0) {
+		*failed = PR_OP_LISTELEMENTS;
+		free(elist.prlist_val);
+		elist.prlist_len = 0;
+		elist.prlist_val = NULL;
+	}
+	ids->idlist_len = elist.prlist_len;
+	ids->idlist_val = elist.prlist_val;
+	return (error);
+#else
+	namelist members, chunk;
+	idlist out;
+	afs_int32 error;
+	u_int i, n;
+
+	members.namelist_len = 0;
+	members.namelist_val = NULL;
+	ids->idlist_len = 0;
+	ids->idlist_val = NULL;
+
+	error = rpc_IDListMembers(id, &members);
+	if (error != 0) {
+		*failed = PR_OP_IDLISTMEMBERS;
+		return (error);
+	}
+	if (members.namelist_len > 0) {
+		ids->idlist_val = malloc(members.namelist_len *
+		    sizeof(afs_int32));
+		if (ids->idlist_val == NULL)
+			error = ENOMEM;
+	}
+	for (i = 0; i < members.namelist_len && error == 0; i += n) {
+		n = members.namelist_len - i;
+		if (n > PR_MAXLIST)
+			n = PR_MAXLIST;
+		chunk.namelist_len = n;
+		chunk.namelist_val = members.namelist_val + i;
+		out.idlist_len = 0;
+		out.idlist_val = NULL;
+		error = rpc_NameToId(&chunk, &out);
+		if (error == 0 && out.idlist_len != n)
+			error = EIO;
+		if (error == 0)
+			memcpy(ids->idlist_val + i, out.idlist_val,
+			    n * sizeof(afs_int32));
+		free(out.idlist_val);
+	}
+	if (error == 0)
+		ids->idlist_len = members.namelist_len;
+	else {
+		*failed = PR_OP_NAMETOID;
+		free(ids->idlist_val);
+		ids->idlist_val = NULL;
+	}
+	free(members.namelist_val);
+	return (error);
+#endif
+}
+
+
+/*
+ * Local variables:
+ *  c-basic-offset: 8
+ * End:
+ */
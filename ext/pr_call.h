@@ -0,0 +1,177 @@
+/*
+ * pr_call.h: protection database calls as data
+ *
+ * Every protection database RPC made by the extension is described by a
+ * struct pr_call and performed by pr_call_run().  Having a single choke
+ * point lets the call be made from whatever thread is convenient: the
+ * Ruby extension runs it without the interpreter lock, or hands it to a
+ * worker thread when a Fiber scheduler is active, and plain C programs
+ * can queue many calls at once on the worker pool.  It is also where
+ * admission control keeps the number and rate of calls to what the
+ * ptserver can stand.
+ *
+ * The rpc_*() wrappers take the same arguments as the corresponding
+ * pr_*() library functions, fill in a struct pr_call, and pass it to
+ * the current executor (pr_call_run() unless someone has installed
+ * another with pr_call_set_executor()).  A function installed with
+ * pr_call_set_connect() is run before any call that cannot be answered
+ * from the cache or a trace, so that the connection to the ptserver can
+ * be made only once one is needed.  Nothing here knows about Ruby.
+ */
+
+#ifndef PR_CALL_H
+#define PR_CALL_H
+
+#include <afs/ptclient.h>
+#include <afs/ptuser.h>
+
+enum pr_op {
+	PR_OP_SNAMETOID,
+	PR_OP_SIDTONAME,
+	PR_OP_NAMETOID,
+	PR_OP_IDTONAME,
+	PR_OP_LISTENTRY,
+	PR_OP_LISTENTRIES,
+	PR_OP_LISTMAXUSERID,
+	PR_OP_LISTMAXGROUPID,
+	PR_OP_IDLISTMEMBERS,
+	PR_OP_GETCPS,
+	PR_OP_ISAMEMBEROF,
+	PR_OP_LISTOWNED,
+	PR_OP_LISTELEMENTS,	/* only if HAVE_UBIK_PR_LISTELEMENTS */
+	/* everything from here on modifies the database */
+	PR_OP_CREATEUSER,
+	PR_OP_CREATEGROUP,
+	PR_OP_DELETE,
+	PR_OP_DELETEBYID,
+	PR_OP_SETMAXUSERID,
+	PR_OP_SETMAXGROUPID,
+	PR_OP_ADDTOGROUP,
+	PR_OP_REMOVEUSERFROMGROUP,
+	PR_OP_CHANGEENTRY,
+	PR_OP_SETFIELDSENTRY,
+	PR_NOPS
+};
+
+#define	PR_OP_IS_WRITE(op)	((op) >= PR_OP_CREATEUSER)
+
+#ifndef PR_MAXLIST
+#define	PR_MAXLIST	5000	/* most names one NameToId call will take */
+#endif
+
+struct pr_call {
+	enum pr_op op;
+	afs_int32 error;
+
+	/*
+	 * Arguments.  Names are copied into the call so that the caller's
+	 * strings need not stay put while the call runs elsewhere.
+	 */
+	afs_int32 id;
+	afs_int32 arg[4];
+	prname name;
+	prname name2;
+	prname name3;
+	int has_name3;		/* name3 is meaningful (else NULL) */
+	int has_newid;		/* arg[0] is a new id (else NULL) */
+
+	/* Results, stored through the caller's pointers. */
+	afs_int32 *idp;
+	afs_int32 *idp2;
+	char *namep;
+	struct prcheckentry *entry;
+	struct prlistentries **entries;
+	namelist *names;
+	idlist *ids;
+	prlist *list;
+
+	/* Set by pr_call_cancel(). */
+	volatile int cancelled;
+
+	/* Worker pool bookkeeping. */
+	int wakeup_fd;		/* non-blocking, written to once done, or -1 */
+	int done;
+	struct pr_call *next;
+};
+
+typedef afs_int32 (*pr_call_executor_fn)(struct pr_call *);
+typedef afs_int32 (*pr_call_connect_fn)(void);
+
+/*
+ * Admission control budgets, one for reads and one for writes; see
+ * pr_call.c.  Times are in seconds.
+ */
+struct pr_limit_config {
+	int max_concurrency;	/* 0 for no limit */
+	int min_concurrency;
+	double rate;		/* calls started per second, 0 for no limit */
+	double burst;		/* bucket size, 0 for one second's worth */
+	double latency_target;	/* 0 to derive from the best latencies */
+};
+
+struct pr_limit_stats {
+	unsigned long calls;
+	unsigned long errors;
+	unsigned long congested;	/* calls that signalled overload */
+	unsigned long decreases;	/* times the limit was cut */
+	unsigned long waits;		/* calls that had to wait */
+	double wait_time;
+	double latency;			/* over all kinds of call */
+	double best_latency;
+	double limit;			/* current concurrency limit */
+	int inflight;
+};
+
+extern const char *pr_op_names[PR_NOPS];
+
+void		pr_call_init(struct pr_call *c, enum pr_op op);
+afs_int32	pr_call_run(struct pr_call *c);
+afs_int32	pr_call_execute(struct pr_call *c);
+void		pr_call_cancel(struct pr_call *c);
+void		pr_call_set_executor(pr_call_executor_fn fn);
+void		pr_call_set_connect(pr_call_connect_fn fn);
+
+int		pr_call_set_workers(int n);
+int		pr_call_workers(void);
+int		pr_call_submit(struct pr_call *c);
+void		pr_call_wait(struct pr_call *c);
+int		pr_call_done(struct pr_call *c);
+int		pr_call_set_limits(int writes,
+		    const struct pr_limit_config *cfg);
+void		pr_call_get_limits(int writes, struct pr_limit_config *cfg);
+void		pr_call_limit_stats(int writes, struct pr_limit_stats *stats);
+void		pr_call_atfork_prepare(void);
+void		pr_call_atfork_parent(void);
+void		pr_call_atfork_child(void);
+
+afs_int32	pr_call_member_ids(afs_int32 id, idlist *ids,
+		    enum pr_op *failed);
+
+afs_int32	rpc_SNameToId(char *name, afs_int32 *id);
+afs_int32	rpc_SIdToName(afs_int32 id, char *name);
+afs_int32	rpc_NameToId(namelist *names, idlist *ids);
+afs_int32	rpc_IdToName(idlist *ids, namelist *names);
+afs_int32	rpc_ListEntry(afs_int32 id, struct prcheckentry *entry);
+afs_int32	rpc_ListEntries(int flags, afs_int32 index, afs_int32 *nentries,
+		    struct prlistentries **entries, afs_int32 *nextindex);
+afs_int32	rpc_ListMaxUserId(afs_int32 *id);
+afs_int32	rpc_ListMaxGroupId(afs_int32 *id);
+afs_int32	rpc_IDListMembers(afs_int32 id, namelist *names);
+afs_int32	rpc_GetCPS(afs_int32 id, prlist *cps);
+afs_int32	rpc_IsAMemberOf(char *user, char *group, afs_int32 *flag);
+afs_int32	rpc_ListOwned(afs_int32 id, namelist *names, afs_int32 *more);
+afs_int32	rpc_ListElements(afs_int32 id, prlist *elist, afs_int32 *over);
+afs_int32	rpc_CreateUser(char *name, afs_int32 *id);
+afs_int32	rpc_CreateGroup(char *name, char *owner, afs_int32 *id);
+afs_int32	rpc_Delete(char *name);
+afs_int32	rpc_DeleteByID(afs_int32 id);
+afs_int32	rpc_SetMaxUserId(afs_int32 id);
+afs_int32	rpc_SetMaxGroupId(afs_int32 id);
+afs_int32	rpc_AddToGroup(char *user, char *group);
+afs_int32	rpc_RemoveUserFromGroup(char *user, char *group);
+afs_int32	rpc_ChangeEntry(char *name, char *newname, afs_int32 *newid,
+		    char *newowner);
+afs_int32	rpc_SetFieldsEntry(afs_int32 id, afs_int32 mask,
+		    afs_int32 flags, afs_int32 ngroups, afs_int32 nusers);
+
+#endif /* PR_CALL_H */
@@ -0,0 +1,888 @@
+/*
+ * pr_trace.c: recording and replaying protection database calls
+ *
+ * See pr_trace.h.  A trace file starts with the eight bytes "AFSRPCT1",
+ * and each call follows as
+ *
+ *	op (1 byte), length of the arguments (4), the arguments,
+ *	error (4), latency in microseconds (4), length of the results (4),
+ *	the results
+ *
+ * with integers big-endian and each string preceded by a length byte.
+ * Which arguments and results are present depends on the op (see
+ * op_fields[]); results are only recorded for calls that succeeded.
+ * The op and arguments together are the key a replayed call is looked
+ * up by.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <hcrypto/evp.h>
+#include <hcrypto/hmac.h>
+
+#include "pr_trace.h"
+
+#define	TRACE_MAGIC	"AFSRPCT1"
+#define	TRACE_MAGIC_LEN	8
+
+#define	HMAC_BLOCK	64	/* SHA-256's */
+#define	HASH_BITS	64	/* of it kept in a hashed name */
+
+/* Arguments */
+#define	IN_ID		0x0001
+#define	IN_ARG2		0x0002	/* arg[0] and arg[1] */
+#define	IN_ARG4		0x0004	/* arg[0] through arg[3] */
+#define	IN_NAME		0x0008
+#define	IN_NAME2	0x0010
+#define	IN_NAME3	0x0020	/* if has_name3 */
+#define	IN_NEWID	0x0040	/* arg[0], if has_newid */
+#define	IN_IDP		0x0080	/* *idp on entry */
+#define	IN_NAMES	0x0100
+#define	IN_IDS		0x0200
+
+/* Results */
+#define	OUT_IDP		0x0001
+#define	OUT_IDP2	0x0002
+#define	OUT_NAMEP	0x0004
+#define	OUT_ENTRY	0x0008
+#define	OUT_ENTRIES	0x0010	/* *idp of them */
+#define	OUT_NAMES	0x0020
+#define	OUT_IDS		0x0040
+#define	OUT_LIST	0x0080
+
+static const struct {
+	unsigned short in;
+	unsigned short out;
+} op_fields[PR_NOPS] = {
+	[PR_OP_SNAMETOID] =	{ IN_NAME, OUT_IDP },
+	[PR_OP_SIDTONAME] =	{ IN_ID, OUT_NAMEP },
+	[PR_OP_NAMETOID] =	{ IN_NAMES, OUT_IDS },
+	[PR_OP_IDTONAME] =	{ IN_IDS, OUT_NAMES },
+	[PR_OP_LISTENTRY] =	{ IN_ID, OUT_ENTRY },
+	[PR_OP_LISTENTRIES] =	{ IN_ARG2,
+				  OUT_IDP | OUT_ENTRIES | OUT_IDP2 },
+	[PR_OP_LISTMAXUSERID] =	{ 0, OUT_IDP },
+	[PR_OP_LISTMAXGROUPID] = { 0, OUT_IDP },
+	[PR_OP_IDLISTMEMBERS] =	{ IN_ID, OUT_NAMES },
+	[PR_OP_GETCPS] =	{ IN_ID, OUT_LIST },
+	[PR_OP_ISAMEMBEROF] =	{ IN_NAME | IN_NAME2, OUT_IDP },
+	[PR_OP_LISTOWNED] =	{ IN_ID | IN_IDP, OUT_NAMES | OUT_IDP },
+	[PR_OP_LISTELEMENTS] =	{ IN_ID, OUT_LIST | OUT_IDP },
+	[PR_OP_CREATEUSER] =	{ IN_NAME | IN_IDP, OUT_IDP },
+	[PR_OP_CREATEGROUP] =	{ IN_NAME | IN_NAME3 | IN_IDP, OUT_IDP },
+	[PR_OP_DELETE] =	{ IN_NAME, 0 },
+	[PR_OP_DELETEBYID] =	{ IN_ID, 0 },
+	[PR_OP_SETMAXUSERID] =	{ IN_ID, 0 },
+	[PR_OP_SETMAXGROUPID] =	{ IN_ID, 0 },
+	[PR_OP_ADDTOGROUP] =	{ IN_NAME | IN_NAME2, 0 },
+	[PR_OP_REMOVEUSERFROMGROUP] = { IN_NAME | IN_NAME2, 0 },
+	[PR_OP_CHANGEENTRY] =	{ IN_NAME | IN_NAME2 | IN_NAME3 | IN_NEWID,
+				  0 },
+	[PR_OP_SETFIELDSENTRY] = { IN_ID | IN_ARG4, 0 },
+};
+
+enum trace_mode { TRACE_OFF, TRACE_RECORDING, TRACE_REPLAYING };
+
+struct trace_rec {
+	const unsigned char *key;	/* op and arguments */
+	size_t keylen;
+	afs_int32 error;
+	uint32_t latency;
+	const unsigned char *out;
+	size_t outlen;
+	struct trace_rec *next;		/* the next call with the same key */
+};
+
+struct trace_key {
+	uint64_t hash;
+	struct trace_rec *head;		/* the next to replay */
+	struct trace_rec *tail;
+	struct trace_key *chain;
+};
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int trace_mode = TRACE_OFF;
+static struct pr_trace_stats trace_stats;
+
+/* Recording */
+static FILE *trace_file;
+
+/*
+ * Recording, or replaying an anonymized trace.  The key is kept as HMAC
+ * would use it, hashed first if it is longer than a block, so that it
+ * fits here and never has to be freed under a call encoding a name.
+ */
+static int anonymize;
+static unsigned char hmac_key[HMAC_BLOCK];
+static unsigned int hmac_keylen;
+
+/* Replaying */
+static unsigned char *trace_data;
+static struct trace_rec *recs;
+static struct trace_key *keys;
+static struct trace_key **buckets;
+static size_t nbuckets;
+static double scale;
+
+struct buf {
+	unsigned char *p;
+	size_t len;
+	size_t cap;
+	int failed;
+};
+
+struct reader {
+	const unsigned char *p;
+	const unsigned char *end;
+	int failed;
+};
+
+static uint64_t
+fnv1a(uint64_t h, const void *data, size_t n)
+{
+	const unsigned char *p = data;
+
+	if (h == 0)
+		h = 0xcbf29ce484222325ULL;
+	while (n-- > 0) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	return (h);
+}
+
+static void
+put(struct buf *b, const void *data, size_t n)
+{
+	size_t ncap;
+	void *np;
+
+	if (b->failed)
+		return;
+	if (b->len + n > b->cap) {
+		ncap = b->cap ? b->cap : 256;
+		while (ncap < b->len + n)
+			ncap *= 2;
+		if ((np = realloc(b->p, ncap)) == NULL) {
+			b->failed = 1;
+			return;
+		}
+		b->p = np;
+		b->cap = ncap;
+	}
+	memcpy(b->p + b->len, data, n);
+	b->len += n;
+}
+
+static void
+put8(struct buf *b, unsigned v)
+{
+	unsigned char c = v;
+
+	put(b, &c, 1);
+}
+
+static void
+put32(struct buf *b, afs_int32 v)
+{
+	uint32_t u = (uint32_t)v;
+	unsigned char c[4];
+
+	c[0] = u >> 24;
+	c[1] = u >> 16;
+	c[2] = u >> 8;
+	c[3] = u;
+	put(b, c, 4);
+}
+
+/*
+ * Whether a part of a name is already a hash, as written below: "X" and
+ * HASH_BITS / 4 hex digits, all in upper case.  The ptserver keeps names
+ * in lower case, so no real name looks like this.
+ */
+static int
+hashed(const char *p, size_t len)
+{
+	size_t i;
+
+	if (len != 1 + HASH_BITS / 4 || p[0] != 'X')
+		return (0);
+	for (i = 1; i < len; i++)
+		if ((p[i] < '0' || p[i] > '9') && (p[i] < 'A' || p[i] > 'F'))
+			return (0);
+	return (1);
+}
+
+/*
+ * HMAC-SHA256 of "p", lower-cased as the library would before sending
+ * it, under the trace's key, cut to HASH_BITS.
+ */
+static uint64_t
+keyed_hash(const char *p, size_t len)
+{
+	unsigned char part[PR_MAXNAMELEN], md[EVP_MAX_MD_SIZE];
+	unsigned int mdlen;
+	uint64_t h;
+	size_t i;
+
+	for (i = 0; i < len && i < sizeof(part); i++)
+		part[i] = (p[i] >= 'A' && p[i] <= 'Z') ? p[i] - 'A' + 'a' :
+		    p[i];
+	HMAC(EVP_sha256(), hmac_key, hmac_keylen, part, i, md, &mdlen);
+	h = 0;
+	for (i = 0; i < HASH_BITS / 8; i++)
+		h = h << 8 | md[i];
+	return (h);
+}
+
+/*
+ * Replace each colon-separated part of "name" with a keyed hash of it.
+ * Well-known names, and the numbers pr_IdToName returns for ids that
+ * don't exist, are left alone.  When replaying, so are parts that are
+ * hashes already: a program replaying a trace may pass back names it
+ * got from it.  (When recording, every name comes from the cell.)
+ */
+static void
+anonymize_name(const char *name, char *out)
+{
+	const char *p, *colon;
+	size_t o, len;
+	int n;
+
+	if (strncmp(name, "system:", 7) == 0 ||
+	    strcmp(name, "anonymous") == 0 ||
+	    name[strspn(name, "-0123456789")] == '\0') {
+		strncpy(out, name, PR_MAXNAMELEN - 1);
+		out[PR_MAXNAMELEN - 1] = '\0';
+		return;
+	}
+	o = 0;
+	out[0] = '\0';
+	for (p = name; ; p = colon + 1) {
+		colon = strchr(p, ':');
+		len = colon ? (size_t)(colon - p) : strlen(p);
+		if (trace_mode == TRACE_REPLAYING && hashed(p, len)) {
+			n = snprintf(out + o, PR_MAXNAMELEN - o, "%s%.*s",
+			    o ? ":" : "", (int)len, p);
+		} else {
+			n = snprintf(out + o, PR_MAXNAMELEN - o, "%sX%016llX",
+			    o ? ":" : "",
+			    (unsigned long long)keyed_hash(p, len));
+		}
+		if (n < 0 || o + n >= PR_MAXNAMELEN - 1)
+			break;
+		o += n;
+		if (colon == NULL)
+			break;
+	}
+}
+
+static void
+putname(struct buf *b, const char *name, int anon)
+{
+	char tmp[PR_MAXNAMELEN];
+	size_t len;
+
+	if (anon) {
+		anonymize_name(name, tmp);
+		name = tmp;
+	}
+	len = strnlen(name, PR_MAXNAMELEN - 1);
+	put8(b, len);
+	put(b, name, len);
+}
+
+static void
+encode_args(struct buf *b, const struct pr_call *c, afs_int32 idp_in,
+    int anon)
+{
+	unsigned in = op_fields[c->op].in;
+	u_int i;
+
+	put8(b, c->op);
+	put32(b, 0);		/* length, filled in below */
+	if (in & IN_ID)
+		put32(b, c->id);
+	if (in & IN_ARG2) {
+		put32(b, c->arg[0]);
+		put32(b, c->arg[1]);
+	}
+	if (in & IN_ARG4)
+		for (i = 0; i < 4; i++)
+			put32(b, c->arg[i]);
+	if (in & IN_NAME)
+		putname(b, c->name, anon);
+	if (in & IN_NAME2)
+		putname(b, c->name2, anon);
+	if (in & IN_NAME3) {
+		put8(b, c->has_name3);
+		if (c->has_name3)
+			putname(b, c->name3, anon);
+	}
+	if (in & IN_NEWID) {
+		put8(b, c->has_newid);
+		if (c->has_newid)
+			put32(b, c->arg[0]);
+	}
+	if (in & IN_IDP)
+		put32(b, idp_in);
+	if (in & IN_NAMES) {
+		put32(b, c->names->namelist_len);
+		for (i = 0; i < c->names->namelist_len; i++)
+			putname(b, c->names->namelist_val[i], anon);
+	}
+	if (in & IN_IDS) {
+		put32(b, c->ids->idlist_len);
+		for (i = 0; i < c->ids->idlist_len; i++)
+			put32(b, c->ids->idlist_val[i]);
+	}
+	if (!b->failed) {
+		b->p[1] = (b->len - 5) >> 24;
+		b->p[2] = (b->len - 5) >> 16;
+		b->p[3] = (b->len - 5) >> 8;
+		b->p[4] = (b->len - 5);
+	}
+}
+
+static void
+encode_results(struct buf *b, const struct pr_call *c, int anon)
+{
+	unsigned out = op_fields[c->op].out;
+	const struct prlistentries *e;
+	afs_int32 i;
+
+	if (out & OUT_IDP)
+		put32(b, *c->idp);
+	if (out & OUT_IDP2)
+		put32(b, *c->idp2);
+	if (out & OUT_NAMEP)
+		putname(b, c->namep, anon);
+	if (out & OUT_ENTRY) {
+		put32(b, c->entry->flags);
+		put32(b, c->entry->id);
+		put32(b, c->entry->owner);
+		put32(b, c->entry->creator);
+		put32(b, c->entry->ngroups);
+		put32(b, c->entry->nusers);
+		put32(b, c->entry->count);
+		putname(b, c->entry->name, anon);
+	}
+	if (out & OUT_ENTRIES) {
+		for (i = 0; i < *c->idp; i++) {
+			e = &(*c->entries)[i];
+			put32(b, e->flags);
+			put32(b, e->id);
+			put32(b, e->owner);
+			put32(b, e->creator);
+			put32(b, e->ngroups);
+			put32(b, e->nusers);
+			put32(b, e->count);
+			putname(b, e->name, anon);
+		}
+	}
+	if (out & OUT_NAMES) {
+		put32(b, c->names->namelist_len);
+		for (i = 0; i < (afs_int32)c->names->namelist_len; i++)
+			putname(b, c->names->namelist_val[i], anon);
+	}
+	if (out & OUT_IDS) {
+		put32(b, c->ids->idlist_len);
+		for (i = 0; i < (afs_int32)c->ids->idlist_len; i++)
+			put32(b, c->ids->idlist_val[i]);
+	}
+	if (out & OUT_LIST) {
+		put32(b, c->list->prlist_len);
+		for (i = 0; i < (afs_int32)c->list->prlist_len; i++)
+			put32(b, c->list->prlist_val[i]);
+	}
+}
+
+static uint32_t
+get32(struct reader *r)
+{
+	uint32_t u;
+
+	if (r->end - r->p < 4) {
+		r->failed = 1;
+		return (0);
+	}
+	u = (uint32_t)r->p[0] << 24 | (uint32_t)r->p[1] << 16 |
+	    (uint32_t)r->p[2] << 8 | r->p[3];
+	r->p += 4;
+	return (u);
+}
+
+static void
+getname(struct reader *r, char *name)
+{
+	size_t len;
+
+	if (r->p >= r->end || (len = *r->p) >= PR_MAXNAMELEN ||
+	    (size_t)(r->end - r->p) < 1 + len) {
+		r->failed = 1;
+		name[0] = '\0';
+		return;
+	}
+	memcpy(name, r->p + 1, len);
+	name[len] = '\0';
+	r->p += 1 + len;
+}
+
+/*
+ * Get a count of "size"-byte things and allocate room for them.
+ */
+static void *
+getarray(struct reader *r, u_int *n, size_t size)
+{
+	void *p;
+
+	*n = get32(r);
+	if (r->failed || *n > (size_t)(r->end - r->p))
+		goto bad;
+	if ((p = calloc(*n ? *n : 1, size)) == NULL)
+		goto bad;
+	return (p);
+bad:
+	r->failed = 1;
+	*n = 0;
+	return (NULL);
+}
+
+static void
+decode_results(struct reader *r, struct pr_call *c)
+{
+	unsigned out = op_fields[c->op].out;
+	struct prlistentries *e;
+	afs_int32 i;
+	u_int n;
+
+	if (out & OUT_IDP)
+		*c->idp = get32(r);
+	if (out & OUT_IDP2)
+		*c->idp2 = get32(r);
+	if (out & OUT_NAMEP)
+		getname(r, c->namep);
+	if (out & OUT_ENTRY) {
+		memset(c->entry, 0, sizeof(*c->entry));
+		c->entry->flags = get32(r);
+		c->entry->id = get32(r);
+		c->entry->owner = get32(r);
+		c->entry->creator = get32(r);
+		c->entry->ngroups = get32(r);
+		c->entry->nusers = get32(r);
+		c->entry->count = get32(r);
+		getname(r, c->entry->name);
+	}
+	if (out & OUT_ENTRIES) {
+		if (*c->idp < 0 || *c->idp > r->end - r->p) {
+			r->failed = 1;
+			return;
+		}
+		e = calloc(*c->idp ? *c->idp : 1, sizeof(*e));
+		*c->entries = e;
+		if (e == NULL) {
+			r->failed = 1;
+			return;
+		}
+		for (i = 0; i < *c->idp; i++) {
+			e[i].flags = get32(r);
+			e[i].id = get32(r);
+			e[i].owner = get32(r);
+			e[i].creator = get32(r);
+			e[i].ngroups = get32(r);
+			e[i].nusers = get32(r);
+			e[i].count = get32(r);
+			getname(r, e[i].name);
+		}
+	}
+	if (out & OUT_NAMES) {
+		c->names->namelist_val = getarray(r, &n, sizeof(prname));
+		c->names->namelist_len = n;
+		for (i = 0; i < (afs_int32)n; i++)
+			getname(r, c->names->namelist_val[i]);
+	}
+	if (out & OUT_IDS) {
+		c->ids->idlist_val = getarray(r, &n, sizeof(afs_int32));
+		c->ids->idlist_len = n;
+		for (i = 0; i < (afs_int32)n; i++)
+			c->ids->idlist_val[i] = get32(r);
+	}
+	if (out & OUT_LIST) {
+		c->list->prlist_val = getarray(r, &n, sizeof(afs_int32));
+		c->list->prlist_len = n;
+		for (i = 0; i < (afs_int32)n; i++)
+			c->list->prlist_val[i] = get32(r);
+	}
+}
+
+/*
+ * Called with trace_lock held.
+ */
+static void
+stop_locked(void)
+{
+	if (trace_file != NULL)
+		fclose(trace_file);
+	trace_file = NULL;
+	free(trace_data);
+	free(recs);
+	free(keys);
+	free(buckets);
+	trace_data = NULL;
+	recs = NULL;
+	keys = NULL;
+	buckets = NULL;
+	nbuckets = 0;
+	trace_mode = TRACE_OFF;
+}
+
+void
+pr_trace_stop(void)
+{
+	pthread_mutex_lock(&trace_lock);
+	stop_locked();
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/*
+ * Keep "key" as HMAC would use it: as it is, or if it is longer than a
+ * block, its SHA-256.
+ */
+static void
+set_key(const char *key)
+{
+	size_t len = strlen(key);
+
+	if (len > HMAC_BLOCK) {
+		EVP_Digest(key, len, hmac_key, &hmac_keylen, EVP_sha256(),
+		    NULL);
+		return;
+	}
+	memcpy(hmac_key, key, len);
+	hmac_keylen = len;
+}
+
+int
+pr_trace_record(const char *path, int anon, const char *key)
+{
+	FILE *f;
+
+	if (anon && (key == NULL || *key == '\0'))
+		return (EINVAL);
+	if ((f = fopen(path, "wb")) == NULL)
+		return (errno);
+	if (fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LEN, f) != TRACE_MAGIC_LEN) {
+		fclose(f);
+		return (errno ? errno : EIO);
+	}
+	pthread_mutex_lock(&trace_lock);
+	stop_locked();
+	memset(&trace_stats, 0, sizeof(trace_stats));
+	trace_file = f;
+	anonymize = anon;
+	if (anon)
+		set_key(key);
+	trace_mode = TRACE_RECORDING;
+	pthread_mutex_unlock(&trace_lock);
+	return (0);
+}
+
+static struct trace_key *
+find_key(const unsigned char *key, size_t keylen, uint64_t hash)
+{
+	struct trace_key *k;
+
+	for (k = buckets[hash & (nbuckets - 1)]; k != NULL; k = k->chain)
+		if (k->hash == hash && k->head->keylen == keylen &&
+		    memcmp(k->head->key, key, keylen) == 0)
+			return (k);
+	return (NULL);
+}
+
+/*
+ * Read the whole trace, and index its calls by key.
+ */
+int
+pr_trace_replay(const char *path, double s, const char *key)
+{
+	unsigned char *data, *p, *end;
+	struct trace_rec *r, *nr;
+	struct trace_key *k, *nk;
+	size_t n, cap, nk_used, i, len;
+	uint64_t h;
+	FILE *f;
+	long size;
+	int error;
+
+	if ((f = fopen(path, "rb")) == NULL)
+		return (errno);
+	data = NULL;
+	r = NULL;
+	k = NULL;
+	error = -1;
+	if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET) != 0) {
+		error = errno;
+		goto fail;
+	}
+	if ((data = malloc(size ? size : 1)) == NULL) {
+		error = ENOMEM;
+		goto fail;
+	}
+	if (fread(data, 1, size, f) != (size_t)size) {
+		error = ferror(f) ? errno : -1;
+		goto fail;
+	}
+	if (size < TRACE_MAGIC_LEN ||
+	    memcmp(data, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0)
+		goto fail;
+
+	n = cap = 0;
+	end = data + size;
+	for (p = data + TRACE_MAGIC_LEN; p < end; ) {
+		if (end - p < 5 || p[0] >= PR_NOPS)
+			goto fail;
+		len = (uint32_t)p[1] << 24 | (uint32_t)p[2] << 16 |
+		    (uint32_t)p[3] << 8 | p[4];
+		if ((size_t)(end - p) - 5 < len + 12)
+			goto fail;
+		len += 5;
+		if (n == cap) {
+			cap = cap ? 2 * cap : 1024;
+			if ((nr = realloc(r, cap * sizeof(*r))) == NULL) {
+				error = ENOMEM;
+				goto fail;
+			}
+			r = nr;
+		}
+		r[n].key = p;
+		r[n].keylen = len;
+		p += len;
+		r[n].error = (afs_int32)((uint32_t)p[0] << 24 |
+		    (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]);
+		r[n].latency = (uint32_t)p[4] << 24 | (uint32_t)p[5] << 16 |
+		    (uint32_t)p[6] << 8 | p[7];
+		len = (uint32_t)p[8] << 24 | (uint32_t)p[9] << 16 |
+		    (uint32_t)p[10] << 8 | p[11];
+		p += 12;
+		if ((size_t)(end - p) < len)
+			goto fail;
+		r[n].out = p;
+		r[n].outlen = len;
+		r[n].next = NULL;
+		p += len;
+		n++;
+	}
+
+	pthread_mutex_lock(&trace_lock);
+	stop_locked();
+	for (nbuckets = 16; nbuckets < 2 * n; nbuckets *= 2)
+		continue;
+	buckets = calloc(nbuckets, sizeof(*buckets));
+	keys = k = calloc(n ? n : 1, sizeof(*k));
+	if (buckets == NULL || keys == NULL) {
+		stop_locked();
+		pthread_mutex_unlock(&trace_lock);
+		free(r);
+		free(data);
+		fclose(f);
+		return (ENOMEM);
+	}
+	for (i = nk_used = 0; i < n; i++) {
+		h = fnv1a(0, r[i].key, r[i].keylen);
+		if ((nk = find_key(r[i].key, r[i].keylen, h)) != NULL) {
+			nk->tail->next = &r[i];
+			nk->tail = &r[i];
+			continue;
+		}
+		nk = &k[nk_used++];
+		nk->hash = h;
+		nk->head = nk->tail = &r[i];
+		nk->chain = buckets[h & (nbuckets - 1)];
+		buckets[h & (nbuckets - 1)] = nk;
+	}
+	recs = r;
+	trace_data = data;
+	scale = s;
+	anonymize = key != NULL;
+	if (key != NULL)
+		set_key(key);
+	memset(&trace_stats, 0, sizeof(trace_stats));
+	trace_mode = TRACE_REPLAYING;
+	pthread_mutex_unlock(&trace_lock);
+	fclose(f);
+	return (0);
+
+fail:
+	free(r);
+	free(data);
+	fclose(f);
+	return (error);
+}
+
+int
+pr_trace_replaying(void)
+{
+	return (trace_mode == TRACE_REPLAYING);
+}
+
+void
+pr_trace_get_stats(struct pr_trace_stats *stats)
+{
+	pthread_mutex_lock(&trace_lock);
+	*stats = trace_stats;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/*
+ * If replaying, answer "c" from the trace and return 1; otherwise
+ * return 0 and let the call be made for real.
+ */
+int
+pr_trace_serve(struct pr_call *c)
+{
+	struct trace_key *k;
+	struct trace_rec *rec;
+	struct reader rd;
+	struct timespec ts;
+	struct buf key;
+	double delay;
+
+	if (trace_mode != TRACE_REPLAYING)
+		return (0);
+	memset(&key, 0, sizeof(key));
+	encode_args(&key, c, c->idp != NULL ? *c->idp : 0, anonymize);
+
+	pthread_mutex_lock(&trace_lock);
+	if (trace_mode != TRACE_REPLAYING) {
+		pthread_mutex_unlock(&trace_lock);
+		free(key.p);
+		return (0);
+	}
+	k = key.failed ? NULL :
+	    find_key(key.p, key.len, fnv1a(0, key.p, key.len));
+	free(key.p);
+	if (k == NULL) {
+		trace_stats.missing++;
+		pthread_mutex_unlock(&trace_lock);
+		c->error = ENOENT;
+		return (1);
+	}
+	rec = k->head;
+	if (rec->next != NULL)
+		k->head = rec->next;
+	c->error = rec->error;
+	if (c->error == 0) {
+		rd.p = rec->out;
+		rd.end = rec->out + rec->outlen;
+		rd.failed = 0;
+		decode_results(&rd, c);
+		if (rd.failed)
+			c->error = EIO;
+	}
+	delay = rec->latency / 1e6 * scale;
+	trace_stats.calls[c->op]++;
+	trace_stats.latency += delay;
+	pthread_mutex_unlock(&trace_lock);
+
+	if (delay > 0) {
+		ts.tv_sec = (time_t)delay;
+		ts.tv_nsec = (long)((delay - ts.tv_sec) * 1e9);
+		nanosleep(&ts, NULL);
+	}
+	return (1);
+}
+
+/*
+ * If recording, append the call just made to the trace.  "idp_in" is
+ * what *c->idp was before the call.
+ */
+void
+pr_trace_note(const struct pr_call *c, afs_int32 idp_in, double elapsed)
+{
+	struct buf args, results;
+	unsigned char hdr[12];
+	uint32_t latency;
+	int anon;
+
+	if (trace_mode != TRACE_RECORDING)
+		return;
+	anon = anonymize;
+	memset(&args, 0, sizeof(args));
+	memset(&results, 0, sizeof(results));
+	encode_args(&args, c, idp_in, anon);
+	if (c->error == 0)
+		encode_results(&results, c, anon);
+
+	latency = elapsed * 1e6;
+	hdr[0] = c->error >> 24;
+	hdr[1] = c->error >> 16;
+	hdr[2] = c->error >> 8;
+	hdr[3] = c->error;
+	hdr[4] = latency >> 24;
+	hdr[5] = latency >> 16;
+	hdr[6] = latency >> 8;
+	hdr[7] = latency;
+	hdr[8] = results.len >> 24;
+	hdr[9] = results.len >> 16;
+	hdr[10] = results.len >> 8;
+	hdr[11] = results.len;
+
+	pthread_mutex_lock(&trace_lock);
+	if (trace_mode == TRACE_RECORDING && !args.failed &&
+	    !results.failed) {
+		fwrite(args.p, 1, args.len, trace_file);
+		fwrite(hdr, 1, sizeof(hdr), trace_file);
+		if (results.len > 0)
+			fwrite(results.p, 1, results.len, trace_file);
+		trace_stats.calls[c->op]++;
+		trace_stats.latency += elapsed;
+	}
+	pthread_mutex_unlock(&trace_lock);
+	free(args.p);
+	free(results.p);
+}
+
+/*
+ * Called from pr_call's fork handlers.  The trace file is flushed before
+ * the fork, so the child can close its copy without writing anything;
+ * only the parent goes on recording.  A replay carries on in both.
+ */
+void
+pr_trace_atfork_prepare(void)
+{
+	pthread_mutex_lock(&trace_lock);
+	if (trace_file != NULL)
+		fflush(trace_file);
+}
+
+void
+pr_trace_atfork_parent(void)
+{
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void
+pr_trace_atfork_child(void)
+{
+	pthread_mutex_init(&trace_lock, NULL);
+	if (trace_mode == TRACE_RECORDING) {
+		fclose(trace_file);
+		trace_file = NULL;
+		trace_mode = TRACE_OFF;
+	}
+}
+
+/*
+ * Local variables:
+ *  c-basic-offset: 8
+ * End:
+ */
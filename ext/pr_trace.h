@@ -0,0 +1,52 @@
+/*
+ * pr_trace.h: recording and replaying protection database calls
+ *
+ * While recording, every call made through pr_call_run() is appended to
+ * a trace file along with its results and how long it took.  While
+ * replaying, calls are not sent to the ptserver at all: each is answered
+ * from the trace, by finding a recorded call of the same kind with the
+ * same arguments, after sleeping for the recorded latency times a
+ * scale factor.  Calls repeated more often than they were recorded get
+ * the last recorded answer again; calls that were never recorded fail
+ * with ENOENT.  A trace recorded with anonymization has every name
+ * outside system: replaced by a keyed hash of it (HMAC-SHA256, cut to
+ * 64 bits), one colon-separated part at a time, so that "owner:group"
+ * names keep their shape.
+ *
+ * Anonymizing takes a key, which is not kept in the trace.  To replay
+ * calls that take names, give pr_trace_replay() the key the trace was
+ * recorded with, so that it can hash their names the same way; without
+ * it, only calls by id can be replayed.
+ *
+ * Nothing in here knows about Ruby.  Functions returning int return 0
+ * on success, an errno value if the file could not be opened or read
+ * (or EINVAL if pr_trace_record() is asked to anonymize without a key),
+ * or -1 if it is not a trace.
+ */
+
+#ifndef PR_TRACE_H
+#define PR_TRACE_H
+
+#include "pr_call.h"
+
+struct pr_trace_stats {
+	unsigned long calls[PR_NOPS];	/* recorded or replayed, by op */
+	unsigned long missing;		/* replayed calls not in the trace */
+	double latency;			/* total recorded or replayed */
+};
+
+int	pr_trace_record(const char *path, int anonymize, const char *key);
+int	pr_trace_replay(const char *path, double scale, const char *key);
+void	pr_trace_stop(void);
+int	pr_trace_replaying(void);
+void	pr_trace_get_stats(struct pr_trace_stats *stats);
+
+/* For pr_call_run(). */
+int	pr_trace_serve(struct pr_call *c);
+void	pr_trace_note(const struct pr_call *c, afs_int32 idp_in,
+	    double elapsed);
+void	pr_trace_atfork_prepare(void);
+void	pr_trace_atfork_parent(void);
+void	pr_trace_atfork_child(void);
+
+#endif /* PR_TRACE_H */
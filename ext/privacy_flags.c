@@ -0,0 +1,125 @@
+/*
+ * privacy_flags.c: protection database privacy flags
+ *
+ * See privacy_flags.h.  Each character of the string form depends on
+ * at most two adjacent flag bits, so pf_to_s() looks each one up by
+ * those bits; pf_from_s() looks up the bit for each character.
+ */
+
+#include <string.h>
+
+#include "privacy_flags.h"
+
+const char *pf_rule_names[PF_NRULES] = {
+	"require",
+	"forbid",
+	"min_ngroups",
+	"max_ngroups",
+	"min_nusers",
+	"max_nusers",
+	"min_count",
+	"max_count",
+};
+
+/*
+ * For each position: the shift that brings its bits to the bottom, and
+ * the character for each value of the two bits there.  The "any" flag
+ * is the higher of each pair, and wins if both are set.
+ */
+static const struct {
+	int shift;
+	char c[4];
+} pf_chars[PF_STRLEN] = {
+	{ 6, { '-', 's', 'S', 'S' } },
+	{ 5, { '-', 'O', '-', 'O' } },
+	{ 3, { '-', 'm', 'M', 'M' } },
+	{ 1, { '-', 'a', 'A', 'A' } },
+	{ 0, { '-', 'r', '-', 'r' } },
+};
+
+/*
+ * The flag for each character, plus PF_VALID; zero for characters
+ * that are not flags.
+ */
+#define	PF_VALID	0x100
+
+static const short pf_bits[256] = {
+	['-'] = PF_VALID,
+	['S'] = PF_VALID | PF_STATUS_ANY,
+	['s'] = PF_VALID | PF_STATUS_MEM,
+	['O'] = PF_VALID | PF_OWNED_ANY,
+	['M'] = PF_VALID | PF_MEMBER_ANY,
+	['m'] = PF_VALID | PF_MEMBER_MEM,
+	['A'] = PF_VALID | PF_ADD_ANY,
+	['a'] = PF_VALID | PF_ADD_MEM,
+	['r'] = PF_VALID | PF_REMOVE_MEM,
+};
+
+/*
+ * Write the five-character form of "flags" to "s", which must have
+ * room for PF_STRLEN + 1 characters.
+ */
+void
+pf_to_s(afs_int32 flags, char *s)
+{
+	int i;
+
+	for (i = 0; i < PF_STRLEN; i++)
+		s[i] = pf_chars[i].c[(flags >> pf_chars[i].shift) & 3];
+	s[PF_STRLEN] = '\0';
+}
+
+/*
+ * Parse the flags in "s", which may list them in any order and need
+ * not be NUL-terminated.  Returns NULL, or a pointer to the first
+ * character that is not a flag.
+ */
+const char *
+pf_from_s(const char *s, size_t len, afs_int32 *flags)
+{
+	afs_int32 f;
+	short bit;
+	size_t i;
+
+	f = 0;
+	for (i = 0; i < len; i++) {
+		if ((bit = pf_bits[(unsigned char)s[i]]) == 0)
+			return (s + i);
+		f |= bit & ~PF_VALID;
+	}
+	*flags = f;
+	return (NULL);
+}
+
+/*
+ * Which of the policy's rules the entry breaks, as a bit (1 << rule)
+ * for each.
+ */
+unsigned
+pf_check(const struct pf_policy *p, const struct prlistentries *le)
+{
+	unsigned broken;
+
+	broken = 0;
+#define	BROKEN(rule, cond)						\
+	if ((p->rules & (1U << (rule))) && (cond))			\
+		broken |= 1U << (rule)
+	BROKEN(PF_RULE_REQUIRE, (le->flags & p->require) != p->require);
+	BROKEN(PF_RULE_FORBID, (le->flags & p->forbid) != 0);
+	BROKEN(PF_RULE_MIN_NGROUPS,
+	    le->ngroups < p->limit[PF_RULE_MIN_NGROUPS]);
+	BROKEN(PF_RULE_MAX_NGROUPS,
+	    le->ngroups > p->limit[PF_RULE_MAX_NGROUPS]);
+	BROKEN(PF_RULE_MIN_NUSERS, le->nusers < p->limit[PF_RULE_MIN_NUSERS]);
+	BROKEN(PF_RULE_MAX_NUSERS, le->nusers > p->limit[PF_RULE_MAX_NUSERS]);
+	BROKEN(PF_RULE_MIN_COUNT, le->count < p->limit[PF_RULE_MIN_COUNT]);
+	BROKEN(PF_RULE_MAX_COUNT, le->count > p->limit[PF_RULE_MAX_COUNT]);
+#undef BROKEN
+	return (broken);
+}
+
+/*
+ * Local variables:
+ *  c-basic-offset: 8
+ * End:
+ */
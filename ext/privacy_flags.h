@@ -0,0 +1,65 @@
+/*
+ * privacy_flags.h: protection database privacy flags
+ *
+ * An entry's privacy flags are shown, as by "pts examine", as five
+ * characters, one per kind of access: who may see the entry's status
+ * (S anyone, s members), who may list what it owns (O anyone), who may
+ * list its members (M anyone, m members), who may add members (A
+ * anyone, a members) and who may remove them (r members), with '-'
+ * meaning the owner and administrators only.  pf_to_s() and pf_from_s()
+ * convert between that and the flag bits with table lookups.
+ *
+ * A privacy policy lists what the flags, group and user quotas, and
+ * membership counts of entries must look like; pf_check() says which
+ * parts of it an entry breaks.
+ *
+ * Nothing in here knows about Ruby.
+ */
+
+#ifndef PRIVACY_FLAGS_H
+#define PRIVACY_FLAGS_H
+
+#include <stddef.h>
+
+#include <afs/ptclient.h>
+#include <afs/ptuser.h>
+
+#define	PF_STATUS_ANY	0x80
+#define	PF_STATUS_MEM	0x40
+#define	PF_OWNED_ANY	0x20
+#define	PF_MEMBER_ANY	0x10
+#define	PF_MEMBER_MEM	0x08
+#define	PF_ADD_ANY	0x04
+#define	PF_ADD_MEM	0x02
+#define	PF_REMOVE_MEM	0x01
+
+#define	PF_STRLEN	5
+
+/* Rules in a policy, and the bits pf_check() returns for them. */
+enum pf_rule {
+	PF_RULE_REQUIRE,	/* these flags must be set */
+	PF_RULE_FORBID,		/* these flags must not be */
+	PF_RULE_MIN_NGROUPS,
+	PF_RULE_MAX_NGROUPS,
+	PF_RULE_MIN_NUSERS,
+	PF_RULE_MAX_NUSERS,
+	PF_RULE_MIN_COUNT,
+	PF_RULE_MAX_COUNT,
+	PF_NRULES
+};
+
+struct pf_policy {
+	unsigned rules;		/* bit (1 << rule) for each rule in force */
+	afs_int32 require;
+	afs_int32 forbid;
+	afs_int32 limit[PF_NRULES];	/* for the MIN_ and MAX_ rules */
+};
+
+extern const char *pf_rule_names[PF_NRULES];
+
+void	pf_to_s(afs_int32 flags, char *s);
+const char *pf_from_s(const char *s, size_t len, afs_int32 *flags);
+unsigned pf_check(const struct pf_policy *p,
+	    const struct prlistentries *le);
+
+#endif /* PRIVACY_FLAGS_H */
@@ -0,0 +1,416 @@
+/*
+ * afs-ptdump: dump the protection database without Ruby
+ *
+ * usage: afs-ptdump [-gnu] [-f json|csv|snapshot] [-j jobs] [-c cell]
+ *		     [-d confdir] [-s seclevel] [-o file]
+ *
+ * Entries are written as they are read, one pr_ListEntries page at a
+ * time, and the members of each page's groups are fetched by up to
+ * "jobs" threads at once, so memory use does not grow with the size of
+ * the cell.  -u and -g restrict the dump to users or to groups, and -n
+ * leaves out group members.  Every id is a ptsid; members are written
+ * for groups only.
+ *
+ * A group whose members cannot be listed (say, for want of permission)
+ * is written with the error instead, and the dump goes on; each such
+ * group is reported on the standard error, and the exit status is 1.
+ *
+ * Output formats:
+ *
+ *  json	One object per line, with keys id, name, owner, creator,
+ *		flags, ngroups, nusers, count and (for groups) members,
+ *		or error in place of members if they could not be listed.
+ *
+ *  csv		A header line, then one line per entry in the same order,
+ *		members separated by spaces, and the error if any.
+ *
+ *  snapshot	The bytes "AFSPTDMP" and a format version (2), then for
+ *		each entry: id, owner, creator, flags, ngroups, nusers,
+ *		count and the number of members (-1 if not fetched, -2 if
+ *		they could not be listed), a byte giving the length of
+ *		the name, the name, and the members, or for -2 the error
+ *		code.  All integers are 32-bit big-endian.  Version 1 was
+ *		the same without -2.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef HAVE_AFS_ERROR_MESSAGE
+#define afs_error_message error_message
+#endif
+
+#include <afs/dirpath.h>
+#include <afs/ptclient.h>
+#include <afs/ptuser.h>
+#include <afs/com_err.h>
+
+#include "entry_table.h"
+#include "pr_call.h"
+
+struct dump_entry {
+	const struct prlistentries *le;
+	idlist members;
+	int fetched;
+	afs_int32 error;
+	enum pr_op failed;
+};
+
+struct page_work {
+	struct dump_entry *d;
+	int n;
+	int next;
+	pthread_mutex_t lock;
+};
+
+typedef void (*write_fn)(FILE *, const struct dump_entry *);
+
+struct dump_state {
+	FILE *out;
+	write_fn write;
+	int members;
+	int jobs;
+	long failed;		/* groups whose members could not be listed */
+};
+
+static const char *progname = "afs-ptdump";
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-gnu] [-f json|csv|snapshot] "
+	    "[-j jobs] [-c cell]\n\t\t  [-d confdir] [-s seclevel] "
+	    "[-o file]\n", progname);
+	exit(2);
+}
+
+static void
+put32(FILE *out, afs_int32 v)
+{
+	unsigned char b[4];
+	uint32_t u = (uint32_t)v;
+
+	b[0] = u >> 24;
+	b[1] = u >> 16;
+	b[2] = u >> 8;
+	b[3] = u;
+	fwrite(b, 1, 4, out);
+}
+
+static void
+write_json_string(FILE *out, const char *s)
+{
+	putc('"', out);
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(out, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(out, "\\u%04x", (unsigned char)*s);
+		else
+			putc(*s, out);
+	}
+	putc('"', out);
+}
+
+/*
+ * Why a group's members could not be listed, as "pr_X: message".
+ */
+static const char *
+error_text(const struct dump_entry *d)
+{
+	static char buf[256];
+
+	snprintf(buf, sizeof(buf), "%s: %s",
+	    d->failed == PR_OP_NAMETOID ? "pr_NameToId" : "pr_ListMembers",
+	    afs_error_message(d->error));
+	return (buf);
+}
+
+static void
+write_json(FILE *out, const struct dump_entry *d)
+{
+	const struct prlistentries *le = d->le;
+	u_int i;
+
+	fprintf(out, "{\"id\":%ld,\"name\":", (long)le->id);
+	write_json_string(out, le->name);
+	fprintf(out, ",\"owner\":%ld,\"creator\":%ld,\"flags\":%ld,"
+	    "\"ngroups\":%ld,\"nusers\":%ld,\"count\":%ld",
+	    (long)le->owner, (long)le->creator, (long)le->flags,
+	    (long)le->ngroups, (long)le->nusers, (long)le->count);
+	if (d->fetched && d->error != 0) {
+		fputs(",\"error\":", out);
+		write_json_string(out, error_text(d));
+	} else if (d->fetched) {
+		fputs(",\"members\":[", out);
+		for (i = 0; i < d->members.idlist_len; i++)
+			fprintf(out, i ? ",%ld" : "%ld",
+			    (long)d->members.idlist_val[i]);
+		putc(']', out);
+	}
+	fputs("}\n", out);
+}
+
+static void
+write_csv_string(FILE *out, const char *s)
+{
+	if (strpbrk(s, ",\"\r\n") == NULL) {
+		fputs(s, out);
+		return;
+	}
+	putc('"', out);
+	for (; *s != '\0'; s++) {
+		if (*s == '"')
+			putc('"', out);
+		putc(*s, out);
+	}
+	putc('"', out);
+}
+
+static void
+write_csv(FILE *out, const struct dump_entry *d)
+{
+	const struct prlistentries *le = d->le;
+	u_int i;
+
+	fprintf(out, "%ld,", (long)le->id);
+	write_csv_string(out, le->name);
+	fprintf(out, ",%ld,%ld,%ld,%ld,%ld,%ld,",
+	    (long)le->owner, (long)le->creator, (long)le->flags,
+	    (long)le->ngroups, (long)le->nusers, (long)le->count);
+	if (d->fetched && d->error == 0)
+		for (i = 0; i < d->members.idlist_len; i++)
+			fprintf(out, i ? " %ld" : "%ld",
+			    (long)d->members.idlist_val[i]);
+	putc(',', out);
+	if (d->fetched && d->error != 0)
+		write_csv_string(out, error_text(d));
+	putc('\n', out);
+}
+
+static void
+write_snapshot(FILE *out, const struct dump_entry *d)
+{
+	const struct prlistentries *le = d->le;
+	size_t len;
+	u_int i;
+
+	put32(out, le->id);
+	put32(out, le->owner);
+	put32(out, le->creator);
+	put32(out, le->flags);
+	put32(out, le->ngroups);
+	put32(out, le->nusers);
+	put32(out, le->count);
+	if (!d->fetched)
+		put32(out, -1);
+	else if (d->error != 0)
+		put32(out, -2);
+	else
+		put32(out, (afs_int32)d->members.idlist_len);
+	len = strnlen(le->name, PR_MAXNAMELEN - 1);
+	putc((int)len, out);
+	fwrite(le->name, 1, len, out);
+	if (d->fetched && d->error != 0)
+		put32(out, d->error);
+	else if (d->fetched)
+		for (i = 0; i < d->members.idlist_len; i++)
+			put32(out, d->members.idlist_val[i]);
+}
+
+/*
+ * Worker: take the page's groups one at a time until none are left.
+ */
+static void *
+fetch_members(void *arg)
+{
+	struct page_work *w = arg;
+	struct dump_entry *d;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&w->lock);
+		i = w->next++;
+		pthread_mutex_unlock(&w->lock);
+		if (i >= w->n)
+			break;
+		d = &w->d[i];
+		if (!d->fetched)
+			continue;
+		d->error = pr_call_member_ids(d->le->id, &d->members,
+		    &d->failed);
+	}
+	return (NULL);
+}
+
+static afs_int32
+dump_page(const struct prlistentries *le, int n, void *arg)
+{
+	struct dump_state *ds = arg;
+	struct page_work w;
+	struct dump_entry *d;
+	pthread_t *threads;
+	int i, ngroups, nthreads;
+
+	if (n == 0)
+		return (0);
+	d = calloc(n, sizeof(*d));
+	threads = calloc(ds->jobs, sizeof(*threads));
+	if (d == NULL || threads == NULL) {
+		fprintf(stderr, "%s: %s\n", progname, strerror(ENOMEM));
+		exit(1);
+	}
+	ngroups = 0;
+	for (i = 0; i < n; i++) {
+		d[i].le = &le[i];
+		d[i].fetched = ds->members && le[i].id < 0;
+		ngroups += d[i].fetched;
+	}
+
+	/* This thread does its share of the fetching too. */
+	w.d = d;
+	w.n = n;
+	w.next = 0;
+	pthread_mutex_init(&w.lock, NULL);
+	nthreads = 0;
+	while (nthreads < ds->jobs - 1 && nthreads < ngroups - 1 &&
+	    pthread_create(&threads[nthreads], NULL, fetch_members, &w) == 0)
+		nthreads++;
+	fetch_members(&w);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&w.lock);
+
+	for (i = 0; i < n; i++) {
+		if (d[i].error != 0) {
+			ds->failed++;
+			fprintf(stderr, "%s: %s: %s\n", progname, le[i].name,
+			    error_text(&d[i]));
+		}
+		(*ds->write)(ds->out, &d[i]);
+		free(d[i].members.idlist_val);
+	}
+	free(threads);
+	free(d);
+	return (0);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct dump_state ds;
+	const char *format, *confdir, *outfile;
+	char *cell;
+	afs_int32 error;
+	int ch, flags, seclevel;
+
+	if (argv[0] != NULL && strrchr(argv[0], '/') != NULL)
+		progname = strrchr(argv[0], '/') + 1;
+	else if (argv[0] != NULL)
+		progname = argv[0];
+
+	format = "json";
+	confdir = AFSDIR_CLIENT_ETC_DIR;
+	outfile = NULL;
+	cell = NULL;
+	seclevel = 1;
+	flags = PRUSERS | PRGROUPS;
+	ds.members = 1;
+	ds.jobs = pr_call_workers();
+	while ((ch = getopt(argc, argv, "c:d:f:gj:no:s:u")) != -1) {
+		switch (ch) {
+		case 'c':
+			cell = optarg;
+			break;
+		case 'd':
+			confdir = optarg;
+			break;
+		case 'f':
+			format = optarg;
+			break;
+		case 'g':
+			flags = PRGROUPS;
+			break;
+		case 'j':
+			ds.jobs = atoi(optarg);
+			if (ds.jobs < 1)
+				usage();
+			break;
+		case 'n':
+			ds.members = 0;
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 's':
+			seclevel = atoi(optarg);
+			break;
+		case 'u':
+			flags = PRUSERS;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	if (strcmp(format, "json") == 0)
+		ds.write = write_json;
+	else if (strcmp(format, "csv") == 0)
+		ds.write = write_csv;
+	else if (strcmp(format, "snapshot") == 0)
+		ds.write = write_snapshot;
+	else
+		usage();
+
+	if (outfile == NULL)
+		ds.out = stdout;
+	else if ((ds.out = fopen(outfile, "w")) == NULL) {
+		fprintf(stderr, "%s: %s: %s\n", progname, outfile,
+		    strerror(errno));
+		return (1);
+	}
+
+	error = pr_Initialize(seclevel, confdir, cell);
+	if (error != 0) {
+		fprintf(stderr, "%s: pr_Initialize: %s\n", progname,
+		    afs_error_message(error));
+		return (1);
+	}
+
+	if (ds.write == write_csv)
+		fputs("id,name,owner,creator,flags,ngroups,nusers,count,"
+		    "members,error\n", ds.out);
+	else if (ds.write == write_snapshot) {
+		fputs(ET_SNAPSHOT_MAGIC, ds.out);
+		put32(ds.out, ET_SNAPSHOT_VERSION);
+	}
+
+	ds.failed = 0;
+	error = et_scan(flags, dump_page, &ds);
+	if (error != 0) {
+		fflush(ds.out);
+		fprintf(stderr, "%s: pr_ListEntries: %s\n", progname,
+		    afs_error_message(error));
+	}
+	pr_End();
+	if (fclose(ds.out) != 0 && error == 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname,
+		    outfile ? outfile : "stdout", strerror(errno));
+		error = 1;
+	}
+	return (error != 0 || ds.failed != 0);
+}
+
+/*
+ * Local variables:
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -1,8 +1,8 @@
 #
-# Ruby parts of AFS interface.
-# At the moment, this is primarily AFS::Group#members_recursive,
-# which provides support for supergroups.  (The C protection database
-# interfaces don't expand supergroups.)
+# Ruby parts of AFS interface: the bulk, batched and concurrent
+# operations built on the native protection database calls, and the
+# indexes, watchers and reports built from them.  Each file under afs/
+# describes its own part.
 #
 require 'AFS'
 
@@ -10,5 +10,13 @@ module AFS
   VERSION = 1.0
 end
 
+require "afs/concurrency"
+require "afs/batch"
+require "afs/protection_object"
 require "afs/group"
-require "afs/privacy_flags"
+require "afs/user"
+require "afs/name_index"
+require "afs/ownership_index"
+require "afs/watcher"
+require "afs/group_graph"
+require "afs/membership_matrix"
@@ -0,0 +1,260 @@
+#
+# AFS.batch records a series of changes to the protection database and
+# then applies them all at once:
+#
+#   report = AFS.batch do |b|
+#     b.create_group("alice:staff", nil, "alice")
+#     b.add_member("alice:staff", "bob")
+#     b.add_member("alice:staff", "carol")
+#     b.set_flags("alice:staff", 0x70)
+#   end
+#
+# Operations are ordered by the names they touch: anything that creates,
+# deletes or renames an entry runs after every earlier operation that
+# mentions the same name, and everything else runs after the operation
+# that last created or renamed the entries it refers to.  (So refer to
+# a renamed entry by its new name afterwards.)  Operations that don't
+# depend on one another run concurrently.  The changes are
+# made without reading each entry back; instead, every ProtectionObject
+# passed to the batch is refreshed once at the end.
+#
+# A Report with one Result per operation (in the order recorded) is
+# returned.  If anything failed, AFS::BatchError is raised after all the
+# independent operations have been attempted, and the report is
+# available from the exception.  Operations that depend on a failed one
+# are skipped.
+#
+module AFS
+  class BatchError < LibraryError
+    attr_reader :report
+
+    def initialize(report)
+      @report = report
+      failures = report.failures
+      super("#{failures.size} of #{report.results.size} batched " \
+	    "operations failed; first: #{failures.first.error.message}")
+    end
+  end
+
+  def self.batch(concurrency = DEFAULT_CONCURRENCY)
+    b = Batch.new
+    yield b
+    report = b.run(concurrency)
+    raise BatchError.new(report) unless report.ok?
+    return report
+  end
+
+  class Batch
+    # +status+ is one of :ok, :failed or :skipped.  +value+ is the ptsid
+    # for create operations, otherwise nil.
+    Result = Struct.new(:op, :args, :status, :value, :error) do
+      def ok?
+	return status == :ok
+      end
+    end
+
+    class Report
+      include Enumerable
+      attr_reader :results
+
+      def initialize(results)
+	@results = results
+      end
+
+      def ok?
+	return @results.all?(&:ok?)
+      end
+
+      def failures
+	return @results.reject(&:ok?)
+      end
+
+      def each(&block)
+	@results.each(&block)
+      end
+    end
+
+    Operation = Struct.new(:op, :args, :reads, :writes, :action, :deps)
+
+    def initialize
+      @ops = []
+      @objects = {}
+      @names_by_id = {}
+    end
+
+    def create_user(name, id = nil)
+      @names_by_id[id] = name if id
+      record(:create_user, [name, id], [], [entry(name)]) do
+	AFS::User.create_id(name, id)
+      end
+    end
+
+    def create_group(name, id = nil, owner = nil)
+      @names_by_id[id] = name if id
+      reads = owner ? [entry(owner)] : []
+      record(:create_group, [name, id, owner], reads, [entry(name)]) do
+	AFS::Group.create_id(name, id, owner)
+      end
+    end
+
+    def delete(po)
+      record(:delete, [po], [], [entry(po)]) do
+	if po.is_a?(AFS::ProtectionObject)
+	  po.delete
+	else
+	  AFS::ProtectionObject.delete(resolve(po))
+	end
+	nil
+      end
+    end
+
+    def rename(po, newname)
+      record(:rename, [po, newname], [], [entry(po), entry(newname)]) do
+	AFS::ProtectionObject.change_entry(resolve(po), newname)
+	nil
+      end
+    end
+
+    def add_member(group, member)
+      record(:add_member, [group, member], [entry(group), entry(member)],
+	     [[:member, key(group), key(member)]]) do
+	AFS::Group.add_member(resolve(group), resolve(member))
+      end
+    end
+
+    def remove_member(group, member)
+      record(:remove_member, [group, member],
+	     [entry(group), entry(member)],
+	     [[:member, key(group), key(member)]]) do
+	AFS::Group.remove_member(resolve(group), resolve(member))
+      end
+    end
+
+    def set_owner(group, owner)
+      record(:set_owner, [group, owner], [entry(group), entry(owner)],
+	     [[:owner, key(group)]]) do
+	AFS::ProtectionObject.change_entry(resolve(group), nil, nil,
+					   resolve(owner))
+      end
+    end
+
+    def set_flags(po, flags)
+      record(:set_flags, [po, flags], [entry(po)], [[:flags, key(po)]]) do
+	AFS::ProtectionObject.set_fields(po, flags)
+      end
+    end
+
+    def set_group_quota(user, ngroups)
+      record(:set_group_quota, [user, ngroups], [entry(user)],
+	     [[:quota, key(user)]]) do
+	AFS::ProtectionObject.set_fields(user, nil, ngroups, nil)
+      end
+    end
+
+    def set_user_quota(group, nusers)
+      record(:set_user_quota, [group, nusers], [entry(group)],
+	     [[:quota, key(group)]]) do
+	AFS::ProtectionObject.set_fields(group, nil, nil, nusers)
+      end
+    end
+
+    # Apply the recorded operations, one dependency level at a time.
+    def run(concurrency = DEFAULT_CONCURRENCY)
+      results = @ops.map { |o| Result.new(o.op, o.args, nil, nil, nil) }
+      levels(@ops).each do |level|
+	runnable = level.select do |i|
+	  failed = @ops[i].deps.find { |d| !results[d].ok? }
+	  next true unless failed
+	  results[i].status = :skipped
+	  results[i].error = AFS::LibraryError.new(
+	    "skipped because #{@ops[failed].op} failed")
+	  false
+	end
+	values = AFS.concurrently(runnable, concurrency) do |i|
+	  @ops[i].action.call
+	end
+	runnable.zip(values).each do |i, v|
+	  if v.is_a?(Exception)
+	    results[i].status = :failed
+	    results[i].error = v
+	  else
+	    results[i].status = :ok
+	    results[i].value = v
+	  end
+	end
+      end
+      refresh_objects
+      return Report.new(results)
+    end
+
+    private
+
+    # Entries are keyed by name wherever possible so that operations
+    # naming the same entry in different ways are still ordered.
+    def key(x)
+      case x
+      when AFS::ProtectionObject
+	@objects[x.object_id] = x
+	return x.name
+      when Integer
+	return @names_by_id.fetch(x, x)
+      else
+	return x.to_s
+      end
+    end
+
+    # The name-based calls need names; translate any ptsids.
+    def resolve(x)
+      return x unless x.is_a?(Integer)
+      return @names_by_id[x] || AFS::ProtectionObject.translate(x)
+    end
+
+    def entry(x)
+      return [:entry, key(x)]
+    end
+
+    def record(op, args, reads, writes, &action)
+      @ops.push(Operation.new(op, args, reads, writes, action, []))
+      return self
+    end
+
+    # Work out each operation's dependencies (reads wait for the last
+    # write of the same key; writes wait for the last write and every
+    # read since) and group the operations into levels that can run
+    # concurrently.
+    def levels(ops)
+      last_write = {}
+      reads_since = Hash.new { |h, k| h[k] = [] }
+      level = []
+      ops.each_with_index do |o, i|
+	deps = []
+	o.reads.each do |k|
+	  deps.push(last_write[k]) if last_write[k]
+	end
+	o.writes.each do |k|
+	  deps.push(last_write[k]) if last_write[k]
+	  deps.concat(reads_since[k])
+	end
+	o.deps = deps.uniq
+	level[i] = (o.deps.map { |d| level[d] }.max || -1) + 1
+	o.reads.each { |k| reads_since[k].push(i) }
+	o.writes.each do |k|
+	  last_write[k] = i
+	  reads_since[k] = []
+	end
+      end
+      return level.each_index.group_by { |i| level[i] }.sort.map(&:last)
+    end
+
+    def refresh_objects
+      @objects.each_value do |po|
+	next if po.deleted? || po.frozen?
+	begin
+	  po.refresh
+	rescue AFS::LibraryError
+	  # it may have been deleted by name
+	end
+      end
+    end
+  end
+end
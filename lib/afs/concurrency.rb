@@ -0,0 +1,35 @@
+#
+# A minimal thread pool.  The extension releases the interpreter lock
+# while it waits for the ptserver, so protection database calls made
+# from several Ruby threads really do overlap.
+#
+module AFS
+  DEFAULT_CONCURRENCY = 8
+
+  # Call the block for each of +items+ using up to +concurrency+
+  # threads, and return the results in the same order as the items.  An
+  # exception raised for an item is returned in place of its result
+  # rather than being propagated, so one failure doesn't abandon the
+  # rest of the work.
+  def self.concurrently(items, concurrency = DEFAULT_CONCURRENCY)
+    items = items.to_a
+    results = Array.new(items.size)
+    return results if items.empty?
+    queue = Queue.new
+    items.each_index { |i| queue.push(i) }
+    queue.close
+    workers = [concurrency, items.size].min.times.map do
+      Thread.new do
+	while (i = queue.pop)
+	  begin
+	    results[i] = yield(items[i])
+	  rescue StandardError => e
+	    results[i] = e
+	  end
+	end
+      end
+    end
+    workers.each(&:join)
+    return results
+  end
+end
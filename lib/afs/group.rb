@@ -1,11 +1,29 @@
 #
-# Ruby parts of AFS interface.
-# At the moment, this is primarily AFS::Group#members_recursive,
-# which provides support for supergroups.  (The C protection database
-# interfaces don't expand supergroups.)
+# Ruby parts of AFS::Group: bulk creation, batched membership tests
+# and members_recursive, which expands supergroups.  (The C protection
+# database interfaces don't.)
 #
 module AFS
   class Group
+    # Create many groups at once, like User.create_many.  +owner+, if
+    # given, owns all of them.
+    def self.create_many(names, owner = nil,
+			 concurrency = DEFAULT_CONCURRENCY)
+      names = names.to_a
+      ids = reserve_ids(names.size)
+      return create_with_ids(names.map { |n| [n, owner] }.zip(ids),
+			     concurrency)
+    end
+
+    # Whether each of +users+ (Users, ptsids or names) is a direct
+    # member of this group, as an Array of true and false: one member
+    # list fetch and at most one name translation, rather than a
+    # has_member? call per user.  Unlike has_member?, membership through
+    # a supergroup does not count; see AFS::MembershipMatrix.
+    def has_members?(users)
+      return member_set.include_many(ProtectionObject.ptsids(users))
+    end
+
     def members_recursive
       rv = []
       self.members do |member|
@@ -0,0 +1,40 @@
+#
+# Ruby parts of AFS::GroupGraph, which is otherwise native (see
+# ext/group_graph.h): ways of getting the report out for a dashboard.
+#
+#   graph = AFS::GroupGraph.new
+#   graph.worst(20).each { |r| puts "#{r[:name]} #{r[:expanded_members]}" }
+#   File.write("groups.csv", graph.to_csv)
+#
+module AFS
+  class GroupGraph
+    COLUMNS = [:id, :name, :depth, :cycle, :direct_users, :direct_groups,
+	       :transitive_users, :transitive_groups, :expansion_calls,
+	       :expanded_members, :error]
+
+    # The +n+ groups that cost the most to expand recursively: those in
+    # or above a cycle first, then by +key+.
+    def worst(n = 10, key = :expanded_members)
+      return max_by(n) { |r| [r[key].nil? ? 1 : 0, r[key] || 0] }
+    end
+
+    # The whole report as CSV, one line per group after a header line.
+    # Missing values (no cycle, an unbounded expansion, no error) are
+    # left empty.
+    def to_csv
+      out = COLUMNS.join(",") + "\n"
+      each do |r|
+	out << COLUMNS.map { |c| csv_field(r[c]) }.join(",") << "\n"
+      end
+      return out
+    end
+
+    private
+
+    def csv_field(v)
+      s = v.to_s
+      return s unless s =~ /[",\r\n]/
+      return '"' + s.gsub('"', '""') + '"'
+    end
+  end
+end
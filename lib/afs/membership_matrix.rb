@@ -0,0 +1,113 @@
+#
+# AFS::MembershipMatrix answers "which of these users are in which of
+# these groups" without a pr_IsAMemberOf call per pair.  Each group's
+# member list is fetched once, as a MemberSet, and every user is looked
+# up in it; asking about 500 users and 40 groups costs 40 member list
+# fetches (made concurrently) and one name translation rather than
+# 20,000 calls.
+#
+#   m = AFS::MembershipMatrix.new(30)
+#   rows = m.matrix(%w(alice bob carol), %w(staff admins))
+#   rows[1][0]		# is bob in staff?
+#
+# That counts direct members only.  With +transitive+, each user's
+# current protection set (CPS) is fetched instead, one call per user,
+# so that membership through supergroups counts too, as it does for
+# has_member? and is_member?.
+#
+# If +ttl+ is positive, the member sets are kept for that many seconds
+# and reused by later queries; changes made meanwhile, even through
+# this process, are not seen until they expire or are invalidated.
+#
+module AFS
+  class MembershipMatrix
+    attr_reader :ttl
+
+    def initialize(ttl = 0, transitive = false,
+		   concurrency = DEFAULT_CONCURRENCY)
+      @ttl = ttl
+      @transitive = transitive
+      @concurrency = concurrency
+      @cache = {}
+      @lock = Mutex.new
+    end
+
+    def transitive?
+      return @transitive
+    end
+
+    # An Array with a row for each of +users+, holding true or false
+    # for each of +groups+.  Both may be given as ProtectionObjects,
+    # ptsids or names.
+    def matrix(users, groups)
+      users = users.to_a
+      ids = ProtectionObject.ptsids(users + groups.to_a)
+      uids = ids[0, users.size]
+      gids = ids[users.size..-1]
+      if @transitive
+	sets = member_sets(uids)
+	return uids.map { |u| sets[u].include_many(gids) }
+      end
+      sets = member_sets(gids)
+      return uids.map { [] } if gids.empty?
+      return gids.map { |g| sets[g].include_many(uids) }.transpose
+    end
+
+    # The same as a Hash mapping each group to the Array of those of
+    # +users+ that are in it.
+    def members(users, groups)
+      users = users.to_a
+      groups = groups.to_a
+      rows = matrix(users, groups)
+      return groups.each_with_index.map do |g, j|
+	[g, users.select.with_index { |_, i| rows[i][j] }]
+      end.to_h
+    end
+
+    # Whether +user+ is in +group+.
+    def include?(user, group)
+      return matrix([user], [group])[0][0]
+    end
+
+    # Forget the cached member set of +id_or_name+ (a group, or a user
+    # if transitive), or all of them.
+    def invalidate(id_or_name = nil)
+      if id_or_name.nil?
+	@lock.synchronize { @cache.clear }
+      else
+	id = ProtectionObject.ptsids([id_or_name])[0]
+	@lock.synchronize { @cache.delete(id) }
+      end
+      return self
+    end
+
+    private
+
+    # MemberSets for +ids+, fetching those not cached.
+    def member_sets(ids)
+      now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      sets = {}
+      @lock.synchronize do
+	ids.each do |id|
+	  set, expires = @cache[id]
+	  sets[id] = set if set && expires > now
+	end
+      end
+      missing = ids.uniq - sets.keys
+      results = AFS.concurrently(missing, @concurrency) { |id| fetch(id) }
+      results.each { |r| raise r if r.is_a?(Exception) }
+      missing.zip(results) { |id, set| sets[id] = set }
+      if @ttl > 0
+	@lock.synchronize do
+	  missing.each { |id| @cache[id] = [sets[id], now + @ttl] }
+	end
+      end
+      return sets
+    end
+
+    def fetch(id)
+      return Group.member_set(id) unless @transitive
+      return MemberSet.new(User.memberships_transitive([id])[id])
+    end
+  end
+end
@@ -0,0 +1,142 @@
+#
+# AFS::NameIndex keeps protection database entries sorted by name, so
+# that prefix, glob and range queries ("every group under csail-", "all
+# of 6.*") take O(log n + k) rather than a find_all and a select over
+# the whole cell.  It is built from one pr_ListEntries scan and can then
+# be kept up to date a few entries at a time.
+#
+module AFS
+  class NameIndex
+    include Enumerable
+
+    # Build the index from +entries+ (any Enumerable of
+    # ProtectionObjects), or by scanning +klass+.find_all.
+    def initialize(entries = nil, klass = AFS::ProtectionObject)
+      @klass = klass
+      refresh(entries)
+    end
+
+    # Rebuild the index from scratch.
+    def refresh(entries = nil)
+      sorted = (entries || @klass.find_all).sort_by(&:name)
+      @names = sorted.map(&:name)
+      @entries = sorted
+      return self
+    end
+
+    def size
+      return @names.size
+    end
+
+    def each(&block)
+      @entries.each(&block)
+    end
+
+    # The entry called +name+, or nil.
+    def [](name)
+      i = lower_bound(name)
+      return @entries[i] if i < @names.size && @names[i] == name
+      return nil
+    end
+
+    # Add or replace an entry.
+    def add(po)
+      i = lower_bound(po.name)
+      if i < @names.size && @names[i] == po.name
+	@entries[i] = po
+      else
+	@names.insert(i, po.name)
+	@entries.insert(i, po)
+      end
+      return self
+    end
+    alias << add
+
+    # Add or replace several entries.
+    def merge(entries)
+      entries.each { |po| add(po) }
+      return self
+    end
+
+    # Remove an entry, given it or its name.
+    def delete(po_or_name)
+      name = po_or_name.is_a?(String) ? po_or_name : po_or_name.name
+      i = lower_bound(name)
+      return nil unless i < @names.size && @names[i] == name
+      @names.delete_at(i)
+      return @entries.delete_at(i)
+    end
+
+    # Note that +po+ used to be called +oldname+.
+    def rename(oldname, po)
+      delete(oldname)
+      return add(po)
+    end
+
+    # Entries whose names begin with +prefix+, in name order.
+    def find_by_prefix(prefix, &block)
+      return slice(*prefix_range(prefix), &block)
+    end
+
+    # Groups owned via the usual "owner:group" naming convention.
+    def find_by_owner(owner, &block)
+      return find_by_prefix("#{owner}:", &block)
+    end
+
+    # Entries with +from+ <= name < +to+ (or <= +to+ if +inclusive+);
+    # either bound may be nil for an open range.
+    def find_range(from, to, inclusive = false, &block)
+      lo = from ? lower_bound(from) : 0
+      if to.nil?
+	hi = @names.size
+      elsif inclusive
+	hi = (lo...@names.size).bsearch { |i| @names[i] > to } || @names.size
+      else
+	hi = (lo...@names.size).bsearch { |i| @names[i] >= to } ||
+	  @names.size
+      end
+      return slice(lo, hi, &block)
+    end
+
+    # Entries whose names match a shell-style +pattern+ (see
+    # File.fnmatch).  Only the names sharing the pattern's literal
+    # prefix are examined.
+    def glob(pattern, &block)
+      prefix = pattern[/\A[^*?\[{\\]*/]
+      lo, hi = prefix_range(prefix)
+      rv = []
+      (lo...hi).each do |i|
+	next unless File.fnmatch?(pattern, @names[i], File::FNM_EXTGLOB)
+	if block_given?
+	  yield @entries[i]
+	else
+	  rv.push(@entries[i])
+	end
+      end
+      return (block_given? ? nil : rv)
+    end
+
+    private
+
+    def lower_bound(name)
+      return (0...@names.size).bsearch { |i| @names[i] >= name } ||
+	@names.size
+    end
+
+    def prefix_range(prefix)
+      lo = lower_bound(prefix)
+      hi = (lo...@names.size).bsearch do |i|
+	!@names[i].start_with?(prefix)
+      end
+      return [lo, hi || @names.size]
+    end
+
+    def slice(lo, hi)
+      if block_given?
+	(lo...hi).each { |i| yield @entries[i] }
+	return nil
+      end
+      return @entries[lo...hi]
+    end
+  end
+end
@@ -0,0 +1,95 @@
+#
+# AFS::OwnershipIndex answers "what does this principal own (or
+# create)?" from memory.  ProtectionObject#ownerships makes a
+# pr_ListOwned call and then a lookup for every result, which adds up
+# quickly when asked about every user and group in the cell; the index
+# instead does a single pr_ListEntries scan (via find_all) and builds
+# owner and creator maps from the entries it returns.
+#
+module AFS
+  class OwnershipIndex
+    include Enumerable
+
+    # Build the index from +entries+ (any Enumerable of
+    # ProtectionObjects, such as the result of an earlier find_all), or
+    # by scanning the whole protection database if none are given.
+    def initialize(entries = nil)
+      refresh(entries)
+    end
+
+    # Rebuild the index, rescanning the database unless +entries+ is
+    # given.
+    def refresh(entries = nil)
+      @by_id = {}
+      @by_name = {}
+      @owned = Hash.new { |h, k| h[k] = [] }
+      @created = Hash.new { |h, k| h[k] = [] }
+      (entries || AFS::ProtectionObject.find_all).each do |po|
+	@by_id[po.ptsid] = po
+	@by_name[po.name] = po
+	@owned[po.owner_id].push(po)
+	@created[po.creator_id].push(po)
+      end
+      return self
+    end
+
+    # Look up an entry by ptsid or name.
+    def [](id_or_name)
+      return @by_id[ptsid_of(id_or_name)]
+    end
+
+    def each(&block)
+      @by_id.each_value(&block)
+    end
+
+    def size
+      return @by_id.size
+    end
+
+    # Entries owned by +who+ (a ProtectionObject, ptsid or name); like
+    # ProtectionObject#ownerships, but answered from the index.  Yields
+    # each entry if a block is given.
+    def ownerships(who, &block)
+      return lookup(@owned, who, &block)
+    end
+
+    # Entries created by +who+.
+    def created(who, &block)
+      return lookup(@created, who, &block)
+    end
+
+    # The owner of +po+, from the index (nil if it is not indexed).
+    def owner_of(po)
+      return @by_id[self[po].owner_id] if self[po]
+    end
+
+    # Entries whose owner is not itself in the index (e.g., deleted
+    # users), keyed by the stale owner id.
+    def orphans
+      return @owned.reject { |id, _| @by_id.has_key?(id) }
+    end
+
+    private
+
+    def ptsid_of(who)
+      case who
+      when AFS::ProtectionObject
+	return who.ptsid
+      when String
+	po = @by_name[who]
+	return po && po.ptsid
+      else
+	return who
+      end
+    end
+
+    def lookup(map, who)
+      rv = map.fetch(ptsid_of(who), [])
+      if block_given?
+	rv.each { |po| yield po }
+	return nil
+      end
+      return rv.dup
+    end
+  end
+end
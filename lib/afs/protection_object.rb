@@ -0,0 +1,53 @@
+#
+# Ruby parts of AFS::ProtectionObject: bulk creation support shared by
+# User.create_many and Group.create_many, and bulk name translation.
+#
+module AFS
+  class ProtectionObject
+    # Reserve +count+ consecutive ptsids by moving the server's id
+    # allocator past them with a single max_id= call.  Returns the ids,
+    # in allocation order.  (Users count up from max_id, groups count
+    # down.)  Nothing stops another client from using max_id= or
+    # creating entries with explicit ids in the meantime, but then the
+    # conflicting creations simply fail.
+    def self.reserve_ids(count)
+      return [] if count <= 0
+      start = max_id
+      step = (self <= AFS::Group) ? -1 : 1
+      self.max_id = start + step * count
+      return (1..count).map { |i| start + step * i }
+    end
+
+    # Create entries from +pairs+ of [args, id], calling create_id
+    # concurrently, and return a Hash mapping each name to its ptsid or
+    # to the exception that prevented its creation.
+    def self.create_with_ids(pairs, concurrency)
+      results = AFS.concurrently(pairs, concurrency) do |args, id|
+	create_id(args[0], id, *args[1..-1])
+      end
+      return pairs.map { |args, _| args[0] }.zip(results).to_h
+    end
+    private_class_method :create_with_ids
+
+    # The ptsids of +items+ (ProtectionObjects, ptsids or names), in
+    # order.  All the names are translated with one translate call;
+    # LibraryError is raised if any of them does not exist.
+    def self.ptsids(items)
+      items = items.to_a
+      names = items.grep(String)
+      ids = names.empty? ? [] : translate(names)
+      by_name = {}
+      names.zip(ids) do |name, id|
+	raise LibraryError, "no such entry `#{name}'" if id.nil?
+	by_name[name] = id
+      end
+      return items.map do |x|
+	case x
+	when ProtectionObject then x.ptsid
+	when String then by_name[x]
+	else Integer(x)
+	end
+      end
+    end
+  end
+end
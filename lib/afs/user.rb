@@ -0,0 +1,16 @@
+#
+# Ruby parts of AFS::User.
+#
+module AFS
+  class User
+    # Create many users at once: reserve a block of ptsids (see
+    # ProtectionObject.reserve_ids) and then create the users with
+    # explicit ids, several at a time.  Returns a Hash mapping each name
+    # to its new ptsid, or to the exception raised trying to create it.
+    def self.create_many(names, concurrency = DEFAULT_CONCURRENCY)
+      names = names.to_a
+      ids = reserve_ids(names.size)
+      return create_with_ids(names.map { |n| [n] }.zip(ids), concurrency)
+    end
+  end
+end
@@ -0,0 +1,130 @@
+#
+# AFS::Watcher notices new users and groups without scanning the whole
+# database.  The ptserver hands out ids in order, so everything created
+# since the last look lies between the old and the new User.max_id (or
+# Group.max_id), and one batched ProtectionObject.translate tells which
+# of those ids are now in use:
+#
+#   w = AFS::Watcher.new(60) { |po| provision(po) }
+#   w.start
+#   ...
+#   w.stop
+#
+# Each poll costs two max_id calls, plus a translate and a lookup per
+# new entry when there is anything to report.  The watermarks start at
+# the current maxima, so only entries created after the watcher is made
+# are reported, unless earlier marks (saved from a previous run, say)
+# are given.  Entries created with explicit ids past the maximum move
+# it, and are found the same way; explicit ids below it are not seen.
+#
+# An id below the new maximum may not be in use yet: create_many, for
+# one, moves max_id before it creates the entries.  So ids that do not
+# translate are kept and looked at again by each poll for +grace+
+# seconds, and reported if they turn up in that time.
+#
+# The marks only move once every new entry has been handed over, so if
+# the block raises, the same entries are offered again next time.
+#
+module AFS
+  class Watcher
+    DEFAULT_INTERVAL = 60
+    DEFAULT_GRACE = 300
+
+    attr_reader :interval, :user_mark, :group_mark, :last_error
+    attr_accessor :grace
+
+    def initialize(interval = DEFAULT_INTERVAL, user_mark = nil,
+		   group_mark = nil, &block)
+      @interval = interval
+      @user_mark = user_mark || User.max_id
+      @group_mark = group_mark || Group.max_id
+      @callback = block
+      @grace = DEFAULT_GRACE
+      @unresolved = {}		# id => when to give up on it
+      @lock = Mutex.new
+      @wakeup = ConditionVariable.new
+      @thread = nil
+      @stopping = false
+    end
+
+    # Look for new entries once, passing each to the block (or to the
+    # block given to new), and return them.
+    def poll(&block)
+      block ||= @callback
+      @lock.synchronize do
+	now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+	umax = User.max_id
+	gmax = Group.max_id
+	fresh = (@user_mark + 1).upto(umax).to_a +
+	  (@group_mark - 1).downto(gmax).to_a
+	@unresolved.delete_if { |_, expires| expires <= now }
+	found = probe(@unresolved.keys + fresh)
+	found.each { |po| block.call(po) } if block
+	@user_mark = umax if umax > @user_mark
+	@group_mark = gmax if gmax < @group_mark
+	fresh.each { |id| @unresolved[id] = now + @grace }
+	found.each { |po| @unresolved.delete(po.ptsid) }
+	return found
+      end
+    end
+
+    # Poll every +interval+ seconds on a background thread.  An exception
+    # raised by a poll is kept in last_error and the thread carries on.
+    def start
+      @lock.synchronize do
+	return self if @thread
+	@stopping = false
+	@thread = Thread.new { run }
+      end
+      return self
+    end
+
+    def stop
+      thread = nil
+      @lock.synchronize do
+	thread = @thread
+	@stopping = true
+	@wakeup.signal
+      end
+      thread.join if thread
+      @thread = nil
+      return self
+    end
+
+    def running?
+      return !@thread.nil?
+    end
+
+    private
+
+    def run
+      loop do
+	@lock.synchronize do
+	  @wakeup.wait(@lock, @interval) unless @stopping
+	  return if @stopping
+	end
+	begin
+	  poll
+	rescue StandardError => e
+	  @last_error = e
+	end
+      end
+    end
+
+    def probe(ids)
+      ids = ids.to_a
+      return [] if ids.empty?
+      names = ProtectionObject.translate(ids)
+      found = []
+      ids.zip(names).each do |id, name|
+	next if name.nil?
+	begin
+	  found.push(ProtectionObject.new(id))
+	rescue LibraryError
+	  # deleted again since it was translated
+	end
+      end
+      return found
+    end
+  end
+end
@@ -0,0 +1,41 @@
+/*
+ * check.h: the little there is to the C tests
+ *
+ * Each test is a program that runs its checks with CHECK(), which
+ * reports a failed condition and carries on, and exits nonzero if any
+ * failed.  "make check" in the extension's build directory builds and
+ * runs them all.  Tests that need a file make it with CHECK_SCRATCH(),
+ * from a template ending in XXXXXX, and remove it when they are done.
+ */
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static int check_failures;
+
+#define	CHECK(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: failed: %s\n", __FILE__,	\
+		    __LINE__, #cond);					\
+		check_failures++;					\
+	}								\
+} while (0)
+
+#define	CHECK_DONE(name) do {						\
+	printf("%s: %s\n", (name), check_failures ? "FAILED" : "ok");	\
+	return (check_failures != 0);					\
+} while (0)
+
+#define	CHECK_SCRATCH(tmpl) do {					\
+	int check_fd;							\
+									\
+	CHECK((check_fd = mkstemp(tmpl)) >= 0);				\
+	if (check_fd >= 0)						\
+		close(check_fd);					\
+} while (0)
+
+#endif /* CHECK_H */
@@ -0,0 +1,146 @@
+/*
+ * entry_table_test.c: entry tables loaded from afs-ptdump snapshots
+ *
+ * The snapshots are written here byte by byte, in the format described
+ * at the top of ptdump/ptdump.c, with members, without them, and with
+ * the error left by a group that could not be listed.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "entry_table.h"
+#include "check.h"
+
+static char path[] = "/tmp/entry_table_test.XXXXXX";
+
+static void
+put32(FILE *f, afs_int32 v)
+{
+	putc((v >> 24) & 0xff, f);
+	putc((v >> 16) & 0xff, f);
+	putc((v >> 8) & 0xff, f);
+	putc(v & 0xff, f);
+}
+
+/* An entry with "nmembers" members (or -1 or -2) numbered from 1. */
+static void
+put_entry(FILE *f, afs_int32 id, const char *name, afs_int32 owner,
+    afs_int32 nmembers)
+{
+	afs_int32 i;
+
+	put32(f, id);
+	put32(f, owner);
+	put32(f, 1);		/* creator */
+	put32(f, id < 0 ? 0x08 : 0);
+	put32(f, id < 0 ? 0 : 20);
+	put32(f, 0);
+	put32(f, nmembers > 0 ? nmembers : 0);
+	put32(f, nmembers);
+	putc((int)strlen(name), f);
+	fputs(name, f);
+	if (nmembers == -2)
+		put32(f, 267271);	/* PRPERM */
+	for (i = 0; i < nmembers; i++)
+		put32(f, i + 1);
+}
+
+static void
+write_snapshot(afs_int32 version)
+{
+	FILE *f;
+
+	CHECK((f = fopen(path, "wb")) != NULL);
+	if (f == NULL)
+		return;
+	fputs(ET_SNAPSHOT_MAGIC, f);
+	put32(f, version);
+	put_entry(f, 2, "bob", -204, -1);
+	put_entry(f, -300, "alice:staff", 1, 2);
+	put_entry(f, 1, "alice", -204, -1);
+	if (version >= 2)
+		put_entry(f, -301, "alice:secret", 1, -2);
+	put_entry(f, -204, "system:administrators", -204, 300);
+	fclose(f);
+}
+
+static void
+test_load(void)
+{
+	struct entry_table t;
+	const struct et_entry *e;
+
+	et_init(&t);
+	write_snapshot(ET_SNAPSHOT_VERSION);
+	CHECK(et_load_snapshot(&t, path, PRUSERS | PRGROUPS) == 0);
+	CHECK(t.n == 5);
+	/* Sorted by id, whatever the order in the file. */
+	CHECK(t.n == 5 && t.e[0].id == -301 && t.e[4].id == 2);
+
+	e = et_find_name(&t, "alice:staff");
+	CHECK(e != NULL && e->id == -300 && e->owner == 1);
+	CHECK(e != NULL && e->flags == 0x08 && e->count == 2);
+	e = et_find_id(&t, 1);
+	CHECK(e != NULL && strcmp(ET_NAME(&t, e), "alice") == 0);
+	CHECK(e != NULL && e->owner == -204 && e->ngroups == 20);
+	e = et_find_name(&t, "alice:secret");
+	CHECK(e != NULL && e->id == -301);
+	CHECK(et_find_name(&t, "carol") == NULL);
+	CHECK(et_find_id(&t, 3) == NULL);
+
+	CHECK(et_load_snapshot(&t, path, PRUSERS) == 0);
+	CHECK(t.n == 2 && et_find_name(&t, "alice:staff") == NULL);
+	CHECK(et_load_snapshot(&t, path, PRGROUPS) == 0);
+	CHECK(t.n == 3 && et_find_id(&t, 1) == NULL);
+
+	/* Version 1 has no unlistable groups, but is otherwise the same. */
+	write_snapshot(1);
+	CHECK(et_load_snapshot(&t, path, PRUSERS | PRGROUPS) == 0);
+	CHECK(t.n == 4);
+	et_free(&t);
+}
+
+static void
+test_bad_files(void)
+{
+	struct entry_table t;
+	FILE *f;
+
+	et_init(&t);
+	CHECK(et_load_snapshot(&t, "/nonexistent/snapshot", PRUSERS) ==
+	    ENOENT);
+	if ((f = fopen(path, "wb")) != NULL) {
+		fputs("AFSPRC01 not a snapshot", f);
+		fclose(f);
+	}
+	CHECK(et_load_snapshot(&t, path, PRUSERS) == -1);
+	write_snapshot(ET_SNAPSHOT_VERSION + 1);
+	CHECK(et_load_snapshot(&t, path, PRUSERS) == -1);
+
+	/* A file cut short in the last group's members is refused too. */
+	write_snapshot(ET_SNAPSHOT_VERSION);
+	CHECK(et_load_snapshot(&t, path, PRUSERS) == 0);
+	CHECK(truncate(path, 300) == 0);
+	CHECK(et_load_snapshot(&t, path, PRUSERS) == -1);
+	CHECK(t.n == 0);
+}
+
+int
+main(void)
+{
+	CHECK_SCRATCH(path);
+	test_load();
+	test_bad_files();
+	unlink(path);
+	CHECK_DONE("entry_table");
+}
+
+/*
+ * Local variables:
+ *  c-basic-offset: 8
+ * End:
+ */
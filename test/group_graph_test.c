@@ -0,0 +1,166 @@
+/*
+ * group_graph_test.c: components, depths and expansion figures
+ *
+ * The graphs are built by hand, as gg_fetch() would leave them, and
+ * handed to gg_analyze(); nothing here talks to a ptserver.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "group_graph.h"
+#include "check.h"
+
+#define	MAXSUB	3
+
+struct spec {
+	int nsub;
+	int sub[MAXSUB];	/* node indices */
+	int nusers;
+	int32_t users[MAXSUB];
+};
+
+/* Group i gets the ptsid -1000 + i, so that the table is sorted by id. */
+static void
+build(struct group_graph *gg, const struct spec *s, size_t n)
+{
+	size_t i, nedges, nusers;
+	int j;
+
+	gg_init(gg);
+	gg->t.e = calloc(n, sizeof(*gg->t.e));
+	gg->t.n = n;
+	gg->g = calloc(n, sizeof(*gg->g));
+	nedges = nusers = 0;
+	for (i = 0; i < n; i++) {
+		nedges += s[i].nsub;
+		nusers += s[i].nusers;
+	}
+	gg->edges = malloc((nedges + 1) * sizeof(*gg->edges));
+	gg->user_ids = malloc((nusers + 1) * sizeof(*gg->user_ids));
+	CHECK(gg->t.e != NULL && gg->g != NULL && gg->edges != NULL &&
+	    gg->user_ids != NULL);
+	for (i = 0; i < n; i++) {
+		gg->t.e[i].id = -1000 + (afs_int32)i;
+		gg->g[i].sub = gg->nedges;
+		gg->g[i].nsub = s[i].nsub;
+		for (j = 0; j < s[i].nsub; j++)
+			gg->edges[gg->nedges++] = s[i].sub[j];
+		gg->g[i].users = gg->nuser_ids;
+		gg->g[i].nusers = s[i].nusers;
+		for (j = 0; j < s[i].nusers; j++)
+			gg->user_ids[gg->nuser_ids++] = s[i].users[j];
+	}
+}
+
+static void
+check_node(const struct group_graph *gg, int v, uint32_t depth, int cyclic,
+    uint64_t tusers, uint64_t tgroups, uint64_t calls, uint64_t expanded)
+{
+	const struct gg_node *node = &gg->g[v];
+
+	CHECK(node->depth == depth);
+	CHECK(node->cyclic == cyclic);
+	CHECK(node->tusers == tusers);
+	CHECK(node->tgroups == tgroups);
+	CHECK(node->calls == calls);
+	CHECK(node->expanded == expanded);
+}
+
+enum { A, B, C, D, E, F, G, H, I, J, NNODES };
+
+static void
+test_small(void)
+{
+	/*
+	 * A diamond (A over B and C, both over D), a cycle (E and F) with
+	 * G below it and H above it, a group (I) containing itself, and a
+	 * group (J) with no members at all.  User 3 is reached from A
+	 * twice, and D's users through both B and C.
+	 */
+	static const struct spec s[NNODES] = {
+		[A] = { 2, { B, C }, 0, { 0 } },
+		[B] = { 1, { D }, 1, { 3 } },
+		[C] = { 1, { D }, 2, { 3, 4 } },
+		[D] = { 0, { 0 }, 2, { 1, 2 } },
+		[E] = { 1, { F }, 1, { 5 } },
+		[F] = { 2, { E, G }, 1, { 6 } },
+		[G] = { 0, { 0 }, 1, { 7 } },
+		[H] = { 1, { E }, 0, { 0 } },
+		[I] = { 1, { I }, 1, { 8 } },
+		[J] = { 0, { 0 }, 0, { 0 } },
+	};
+	struct group_graph gg;
+
+	build(&gg, s, NNODES);
+	CHECK(gg_analyze(&gg) == 0);
+
+	/* Components are numbered children first; E and F share one. */
+	CHECK(gg.nscc == NNODES - 1);
+	CHECK(gg.g[E].scc == gg.g[F].scc);
+	CHECK(gg.g[D].scc < gg.g[B].scc && gg.g[D].scc < gg.g[C].scc);
+	CHECK(gg.g[B].scc < gg.g[A].scc && gg.g[C].scc < gg.g[A].scc);
+	CHECK(gg.g[G].scc < gg.g[E].scc && gg.g[E].scc < gg.g[H].scc);
+
+	/* node, depth, cyclic, tusers, tgroups, calls, expanded */
+	check_node(&gg, D, 0, 0, 2, 0, 1, 2);
+	check_node(&gg, B, 1, 0, 3, 1, 2, 3);
+	check_node(&gg, C, 1, 0, 4, 1, 2, 4);
+	check_node(&gg, A, 2, 0, 4, 3, 5, 7);
+	check_node(&gg, G, 0, 0, 1, 0, 1, 1);
+	check_node(&gg, E, 1, 1, 3, 3, GG_UNBOUNDED, GG_UNBOUNDED);
+	check_node(&gg, F, 1, 1, 3, 3, GG_UNBOUNDED, GG_UNBOUNDED);
+	check_node(&gg, H, 2, 0, 3, 3, GG_UNBOUNDED, GG_UNBOUNDED);
+	check_node(&gg, I, 0, 1, 1, 1, GG_UNBOUNDED, GG_UNBOUNDED);
+	check_node(&gg, J, 0, 0, 0, 0, 1, 0);
+	gg_free(&gg);
+}
+
+/*
+ * A chain far deeper than any recursive implementation could stand,
+ * then the same chain closed into one big cycle.
+ */
+static void
+test_deep(void)
+{
+	static struct spec s[100000];
+	struct group_graph gg;
+	size_t i, n = sizeof(s) / sizeof(s[0]);
+
+	for (i = 0; i < n; i++) {
+		s[i].nsub = i + 1 < n;
+		s[i].sub[0] = (int)i + 1;
+		s[i].nusers = 1;
+		s[i].users[0] = (int32_t)i + 1;
+	}
+	build(&gg, s, n);
+	CHECK(gg_analyze(&gg) == 0);
+	CHECK(gg.nscc == n);
+	check_node(&gg, 0, n - 1, 0, n, n - 1, n, n);
+	check_node(&gg, n - 1, 0, 0, 1, 0, 1, 1);
+	gg_free(&gg);
+
+	s[n - 1].nsub = 1;
+	s[n - 1].sub[0] = 0;
+	build(&gg, s, n);
+	CHECK(gg_analyze(&gg) == 0);
+	CHECK(gg.nscc == 1);
+	check_node(&gg, 0, 0, 1, n, n, GG_UNBOUNDED, GG_UNBOUNDED);
+	check_node(&gg, n / 2, 0, 1, n, n, GG_UNBOUNDED, GG_UNBOUNDED);
+	gg_free(&gg);
+}
+
+int
+main(void)
+{
+	test_small();
+	test_deep();
+	CHECK_DONE("group_graph");
+}
+
+/*
+ * Local variables:
+ *  c-basic-offset: 8
+ * End:
+ */
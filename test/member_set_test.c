@@ -0,0 +1,238 @@
+/*
+ * member_set_test.c: member sets against plain sorted arrays
+ *
+ * The ids are chosen to cross container boundaries (around 0, -1 and
+ * multiples of 65536) and to fill some containers past MS_ARRAY_MAX, so
+ * that both representations and the conversions between them are used,
+ * and the set operations see containers present on one side only.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "member_set.h"
+#include "check.h"
+
+#define	MAXIDS	40000
+
+struct ref {
+	int32_t id[MAXIDS * 2];
+	size_t n;
+};
+
+static uint32_t seed = 12345;
+
+static uint32_t
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8);
+}
+
+static int
+cmp_i32(const void *a, const void *b)
+{
+	int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+static void
+ref_sort(struct ref *r)
+{
+	size_t i, j;
+
+	qsort(r->id, r->n, sizeof(r->id[0]), cmp_i32);
+	for (i = j = 0; i < r->n; i++)
+		if (j == 0 || r->id[j - 1] != r->id[i])
+			r->id[j++] = r->id[i];
+	r->n = j;
+}
+
+static int
+ref_has(const struct ref *r, int32_t id)
+{
+	return (bsearch(&id, r->id, r->n, sizeof(id), cmp_i32) != NULL);
+}
+
+/*
+ * Ids in a few clusters: a dense run that becomes a bitmap, sparse ids
+ * near the sign change and near a chunk boundary, and groups.
+ */
+static void
+ref_fill(struct ref *r, int32_t dense_start, size_t dense, size_t sparse)
+{
+	static const int32_t centers[] = { 0, -1, 65536, -65536, 131071 };
+	size_t i;
+
+	r->n = 0;
+	for (i = 0; i < dense; i++)
+		r->id[r->n++] = dense_start + (int32_t)i;
+	for (i = 0; i < sparse; i++)
+		r->id[r->n++] = centers[rnd() % 5] + (int32_t)(rnd() % 2000) -
+		    1000;
+	ref_sort(r);
+}
+
+static void
+check_equal(const struct member_set *ms, const struct ref *r)
+{
+	static int32_t out[MAXIDS * 2];
+	size_t n;
+
+	CHECK(ms_cardinality(ms) == r->n);
+	n = ms_to_array(ms, out);
+	CHECK(n == r->n);
+	CHECK(n == r->n && memcmp(out, r->id, n * sizeof(out[0])) == 0);
+}
+
+static int
+has_bitmap(const struct member_set *ms)
+{
+	size_t i;
+
+	for (i = 0; i < ms->nc; i++)
+		if (ms->c[i].is_bitmap)
+			return (1);
+	return (0);
+}
+
+static void
+test_build_and_convert(void)
+{
+	static struct ref r;
+	struct member_set ms;
+	size_t i;
+
+	ref_fill(&r, 200000, MS_ARRAY_MAX + 500, 3000);
+	ms_init(&ms);
+	CHECK(ms_build(&ms, r.id, r.n) == 0);
+	check_equal(&ms, &r);
+	CHECK(has_bitmap(&ms));
+	for (i = 0; i < r.n; i++)
+		CHECK(ms_contains(&ms, r.id[i]));
+	CHECK(!ms_contains(&ms, 199999));
+	CHECK(!ms_contains(&ms, INT32_MIN));
+
+	/* Shrinking the dense run turns its bitmap back into an array. */
+	for (i = 0; i < 600; i++)
+		CHECK(ms_remove(&ms, 200000 + (int32_t)i) == 0);
+	CHECK(!has_bitmap(&ms));
+	CHECK(!ms_contains(&ms, 200000));
+	CHECK(ms_contains(&ms, 200600));
+
+	/* ... and growing it again makes a bitmap of it once more. */
+	for (i = 0; i < 600; i++)
+		CHECK(ms_add(&ms, 200000 + (int32_t)i) == 0);
+	CHECK(has_bitmap(&ms));
+	check_equal(&ms, &r);
+
+	/* Removing everything leaves no containers behind. */
+	for (i = 0; i < r.n; i++)
+		CHECK(ms_remove(&ms, r.id[i]) == 0);
+	CHECK(ms.nc == 0);
+	CHECK(ms_cardinality(&ms) == 0);
+	ms_clear(&ms);
+}
+
+static void
+test_add_one_at_a_time(void)
+{
+	static struct ref r;
+	struct member_set ms, built;
+	size_t i;
+
+	ref_fill(&r, -70000, MS_ARRAY_MAX + 10, 2000);
+	ms_init(&ms);
+	ms_init(&built);
+	for (i = r.n; i-- > 0; )
+		CHECK(ms_add(&ms, r.id[i]) == 0);
+	CHECK(ms_add(&ms, r.id[0]) == 0);	/* already there */
+	check_equal(&ms, &r);
+	CHECK(ms_build(&built, r.id, r.n) == 0);
+	CHECK(ms_equal(&ms, &built));
+	ms_clear(&ms);
+	ms_clear(&built);
+}
+
+static void
+test_set_ops(void)
+{
+	static struct ref a, b, want;
+	struct member_set sa, sb, out, copy;
+	size_t i;
+
+	/* Overlapping dense runs, so some results are bitmaps. */
+	ref_fill(&a, 300000, MS_ARRAY_MAX + 2000, 4000);
+	ref_fill(&b, 300000 + MS_ARRAY_MAX, MS_ARRAY_MAX + 2000, 4000);
+	ms_init(&sa);
+	ms_init(&sb);
+	ms_init(&out);
+	ms_init(&copy);
+	CHECK(ms_build(&sa, a.id, a.n) == 0);
+	CHECK(ms_build(&sb, b.id, b.n) == 0);
+
+	want.n = 0;
+	for (i = 0; i < a.n; i++)
+		want.id[want.n++] = a.id[i];
+	for (i = 0; i < b.n; i++)
+		want.id[want.n++] = b.id[i];
+	ref_sort(&want);
+	ms_clear(&out);
+	CHECK(ms_union(&out, &sa, &sb) == 0);
+	check_equal(&out, &want);
+
+	want.n = 0;
+	for (i = 0; i < a.n; i++)
+		if (ref_has(&b, a.id[i]))
+			want.id[want.n++] = a.id[i];
+	ms_clear(&out);
+	CHECK(ms_intersection(&out, &sa, &sb) == 0);
+	check_equal(&out, &want);
+
+	want.n = 0;
+	for (i = 0; i < a.n; i++)
+		if (!ref_has(&b, a.id[i]))
+			want.id[want.n++] = a.id[i];
+	ms_clear(&out);
+	CHECK(ms_difference(&out, &sa, &sb) == 0);
+	check_equal(&out, &want);
+
+	/* With an empty set, and with itself. */
+	ms_clear(&sb);
+	ms_clear(&out);
+	CHECK(ms_union(&out, &sa, &sb) == 0);
+	CHECK(ms_equal(&out, &sa));
+	ms_clear(&out);
+	CHECK(ms_intersection(&out, &sa, &sb) == 0);
+	CHECK(ms_cardinality(&out) == 0);
+	ms_clear(&out);
+	CHECK(ms_difference(&out, &sa, &sa) == 0);
+	CHECK(ms_cardinality(&out) == 0);
+
+	CHECK(ms_copy(&copy, &sa) == 0);
+	CHECK(ms_equal(&copy, &sa));
+	CHECK(ms_remove(&copy, a.id[0]) == 0);
+	CHECK(!ms_equal(&copy, &sa));
+	CHECK(ms_contains(&sa, a.id[0]));
+
+	ms_clear(&sa);
+	ms_clear(&out);
+	ms_clear(&copy);
+}
+
+int
+main(void)
+{
+	test_build_and_convert();
+	test_add_one_at_a_time();
+	test_set_ops();
+	CHECK_DONE("member_set");
+}
+
+/*
+ * Local variables:
+ *  c-basic-offset: 8
+ * End:
+ */
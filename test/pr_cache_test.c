@@ -0,0 +1,174 @@
+/*
+ * pr_cache_test.c: pr_cache_save() and pr_cache_load()
+ *
+ * The cache is filled by noting calls as though they had been made, then
+ * written out, cleared, and read back in; what it holds afterwards is
+ * checked by asking it to serve calls.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pr_cache.h"
+#include "pr_call_fixture.h"
+#include "check.h"
+
+static char path[] = "/tmp/pr_cache_test.XXXXXX";
+
+static void
+note_sname(const char *name, afs_int32 id)
+{
+	struct pr_call c;
+
+	pr_cache_note(call_sname(&c, name, &id));
+}
+
+static void
+note_entry(afs_int32 id, const char *name, afs_int32 owner)
+{
+	struct pr_call c;
+	struct prcheckentry e;
+
+	make_entry(&e, id, name, owner);
+	pr_cache_note(call_listentry(&c, id, &e));
+}
+
+/* Whether the cache knows "name", and if so as "id". */
+static int
+knows(const char *name, afs_int32 id)
+{
+	struct pr_call c;
+	afs_int32 got = 0;
+
+	return (pr_cache_serve(call_sname(&c, name, &got)) && got == id);
+}
+
+static void
+check_held(unsigned long names, unsigned long entries)
+{
+	struct pr_cache_stats st;
+
+	pr_cache_get_stats(&st);
+	CHECK(st.names == names);
+	CHECK(st.entries == entries);
+}
+
+static void
+test_round_trip(void)
+{
+	struct pr_call c;
+	struct prcheckentry e;
+	prname name;
+
+	pr_cache_start();
+	note_sname("Alice", 5);
+	note_entry(5, "alice", -204);
+	note_sname("system:administrators", -204);
+	note_entry(-300, "alice:staff", 5);
+	check_held(3, 2);
+	CHECK(pr_cache_save(path) == 0);
+
+	pr_cache_clear();
+	check_held(0, 0);
+	CHECK(!knows("alice", 5));
+
+	CHECK(pr_cache_load(path) == 0);
+	check_held(3, 2);
+	/* Names are looked up without regard to case. */
+	CHECK(knows("ALICE", 5));
+	CHECK(knows("system:administrators", -204));
+	CHECK(pr_cache_serve(call_sid(&c, -300, name)));
+	CHECK(strcmp(name, "alice:staff") == 0);
+	memset(&e, 0, sizeof(e));
+	CHECK(pr_cache_serve(call_listentry(&c, -300, &e)));
+	CHECK(e.id == -300 && e.flags == 0x60 && e.owner == 5);
+	CHECK(e.creator == 1 && e.ngroups == 20 && e.nusers == -1);
+	CHECK(e.count == 3 && strcmp(e.name, "alice:staff") == 0);
+	/* A mapping without an entry comes back without one. */
+	CHECK(!pr_cache_serve(call_listentry(&c, -204, &e)));
+
+	/* Loading a file again adds nothing new. */
+	CHECK(pr_cache_load(path) == 0);
+	check_held(3, 2);
+	pr_cache_clear();
+}
+
+/* What is forgotten, or too old, is not saved. */
+static void
+test_not_saved(void)
+{
+	struct pr_call c;
+	struct prcheckentry e;
+
+	note_sname("alice", 5);
+	note_entry(5, "alice", -204);
+	pr_cache_forget(5);
+	CHECK(pr_cache_save(path) == 0);
+	pr_cache_clear();
+	CHECK(pr_cache_load(path) == 0);
+	check_held(1, 0);
+	CHECK(knows("alice", 5));
+	CHECK(!pr_cache_serve(call_listentry(&c, 5, &e)));
+	pr_cache_clear();
+
+	note_sname("alice", 5);
+	pr_cache_set_max_age(0);
+	CHECK(pr_cache_save(path) == 0);
+	pr_cache_set_max_age(PR_CACHE_MAX_AGE);
+	pr_cache_clear();
+	CHECK(pr_cache_load(path) == 0);
+	check_held(0, 0);
+}
+
+/*
+ * A cache that cannot be read, or is damaged, is refused whole: it adds
+ * nothing, not even the records before the damage.
+ */
+static void
+test_refused(void)
+{
+	FILE *f;
+
+	CHECK(pr_cache_load("/nonexistent/cache") == ENOENT);
+	CHECK(pr_cache_save("/nonexistent/cache") == ENOENT);
+
+	note_sname("alice", 5);
+	note_sname("bob", 6);
+	CHECK(pr_cache_save(path) == 0);
+	pr_cache_clear();
+	if ((f = fopen(path, "r+b")) != NULL) {
+		putc('x', f);
+		fclose(f);
+	}
+	CHECK(pr_cache_load(path) == -1);
+	check_held(0, 0);
+
+	note_sname("alice", 5);
+	note_sname("bob", 6);
+	CHECK(pr_cache_save(path) == 0);
+	pr_cache_clear();
+	CHECK(truncate(path, 40) == 0);
+	CHECK(pr_cache_load(path) == -1);
+	check_held(0, 0);
+	CHECK(!knows("alice", 5));
+}
+
+int
+main(void)
+{
+	CHECK_SCRATCH(path);
+	test_round_trip();
+	test_not_saved();
+	test_refused();
+	unlink(path);
+	CHECK_DONE("pr_cache");
+}
+
+/*
+ * Local variables:
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -0,0 +1,56 @@
+/*
+ * pr_call_fixture.c: see pr_call_fixture.h
+ */
+
+#include <string.h>
+
+#include "pr_call_fixture.h"
+
+struct pr_call *
+call_sname(struct pr_call *c, const char *name, afs_int32 *idp)
+{
+	pr_call_init(c, PR_OP_SNAMETOID);
+	strcpy(c->name, name);
+	c->idp = idp;
+	return (c);
+}
+
+struct pr_call *
+call_sid(struct pr_call *c, afs_int32 id, char *namep)
+{
+	pr_call_init(c, PR_OP_SIDTONAME);
+	c->id = id;
+	c->namep = namep;
+	return (c);
+}
+
+struct pr_call *
+call_listentry(struct pr_call *c, afs_int32 id, struct prcheckentry *e)
+{
+	pr_call_init(c, PR_OP_LISTENTRY);
+	c->id = id;
+	c->entry = e;
+	return (c);
+}
+
+/* An entry with the fields the tests look at filled in. */
+void
+make_entry(struct prcheckentry *e, afs_int32 id, const char *name,
+    afs_int32 owner)
+{
+	memset(e, 0, sizeof(*e));
+	e->id = id;
+	e->flags = 0x60;
+	e->owner = owner;
+	e->creator = 1;
+	e->ngroups = 20;
+	e->nusers = -1;
+	e->count = 3;
+	strcpy(e->name, name);
+}
+
+/*
+ * Local variables:
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -0,0 +1,25 @@
+/*
+ * pr_call_fixture.h: calls for the C tests to note and serve
+ *
+ * Each function sets up "c" as the rpc_*() wrapper for the same call
+ * would, with its results going to the caller's storage, and returns
+ * it.  A test then fills in the results and hands the call to
+ * pr_cache_note() or pr_trace_note() as though it had been made, or asks
+ * pr_cache_serve() or pr_trace_serve() to answer it, all without a
+ * ptserver.
+ */
+
+#ifndef PR_CALL_FIXTURE_H
+#define PR_CALL_FIXTURE_H
+
+#include "pr_call.h"
+
+struct pr_call	*call_sname(struct pr_call *c, const char *name,
+		    afs_int32 *idp);
+struct pr_call	*call_sid(struct pr_call *c, afs_int32 id, char *namep);
+struct pr_call	*call_listentry(struct pr_call *c, afs_int32 id,
+		    struct prcheckentry *e);
+void		make_entry(struct prcheckentry *e, afs_int32 id,
+		    const char *name, afs_int32 owner);
+
+#endif /* PR_CALL_FIXTURE_H */
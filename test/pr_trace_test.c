@@ -0,0 +1,269 @@
+/*
+ * pr_trace_test.c: traces written by pr_trace_note() and read back by
+ * pr_trace_serve()
+ *
+ * Calls are recorded by handing pr_trace_note() calls with their
+ * results already filled in, as pr_call_run() would after making them,
+ * so nothing here talks to a ptserver.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pr_trace.h"
+#include "pr_call_fixture.h"
+#include "check.h"
+
+static char path[] = "/tmp/pr_trace_test.XXXXXX";
+
+static void
+note_sname(const char *name, afs_int32 id, afs_int32 error)
+{
+	struct pr_call c;
+
+	call_sname(&c, name, &id);
+	c.error = error;
+	pr_trace_note(&c, 0, 0.001);
+}
+
+static void
+note_sid(afs_int32 id, const char *name)
+{
+	struct pr_call c;
+	prname out;
+
+	strcpy(out, name);
+	pr_trace_note(call_sid(&c, id, out), 0, 0.001);
+}
+
+static void
+note_nametoid(const char *a, const char *b, afs_int32 ida, afs_int32 idb)
+{
+	struct pr_call c;
+	prname in[2];
+	afs_int32 out[2];
+	namelist names;
+	idlist ids;
+
+	pr_call_init(&c, PR_OP_NAMETOID);
+	strcpy(in[0], a);
+	strcpy(in[1], b);
+	names.namelist_len = 2;
+	names.namelist_val = in;
+	out[0] = ida;
+	out[1] = idb;
+	ids.idlist_len = 2;
+	ids.idlist_val = out;
+	c.names = &names;
+	c.ids = &ids;
+	pr_trace_note(&c, 0, 0.001);
+}
+
+static void
+note_listentry(afs_int32 id, const char *name)
+{
+	struct pr_call c;
+	struct prcheckentry e;
+
+	make_entry(&e, id, name, -204);
+	pr_trace_note(call_listentry(&c, id, &e), 0, 0.001);
+}
+
+/* Replay pr_SNameToId(name); returns the error and sets *id. */
+static afs_int32
+serve_sname(const char *name, afs_int32 *id)
+{
+	struct pr_call c;
+
+	*id = 0;
+	CHECK(pr_trace_serve(call_sname(&c, name, id)) == 1);
+	return (c.error);
+}
+
+static afs_int32
+serve_sid(afs_int32 id, char *name)
+{
+	struct pr_call c;
+
+	CHECK(pr_trace_serve(call_sid(&c, id, name)) == 1);
+	return (c.error);
+}
+
+static afs_int32
+serve_nametoid(const char *a, const char *b, idlist *ids)
+{
+	struct pr_call c;
+	prname in[2];
+	namelist names;
+
+	pr_call_init(&c, PR_OP_NAMETOID);
+	strcpy(in[0], a);
+	strcpy(in[1], b);
+	names.namelist_len = 2;
+	names.namelist_val = in;
+	ids->idlist_len = 0;
+	ids->idlist_val = NULL;
+	c.names = &names;
+	c.ids = ids;
+	CHECK(pr_trace_serve(&c) == 1);
+	return (c.error);
+}
+
+static int
+file_contains(const char *s)
+{
+	char buf[65536];
+	size_t n, len = strlen(s), i;
+	FILE *f;
+
+	if ((f = fopen(path, "rb")) == NULL)
+		return (-1);
+	n = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+	for (i = 0; i + len <= n; i++)
+		if (memcmp(buf + i, s, len) == 0)
+			return (1);
+	return (0);
+}
+
+static void
+test_plain(void)
+{
+	struct pr_trace_stats st;
+	struct pr_call c;
+	struct prcheckentry e;
+	afs_int32 id;
+
+	CHECK(pr_trace_record(path, 0, NULL) == 0);
+	note_sname("alice", 5, 0);
+	note_sname("alice", 6, 0);
+	note_sname("nobody", 0, 267268);
+	note_listentry(5, "alice");
+	pr_trace_stop();
+	CHECK(file_contains("alice") == 1);
+
+	CHECK(pr_trace_replay(path, 0, NULL) == 0);
+	CHECK(pr_trace_replaying());
+	/* Repeated calls get the answers in order, then the last again. */
+	CHECK(serve_sname("alice", &id) == 0 && id == 5);
+	CHECK(serve_sname("alice", &id) == 0 && id == 6);
+	CHECK(serve_sname("alice", &id) == 0 && id == 6);
+	CHECK(serve_sname("nobody", &id) == 267268);
+	CHECK(serve_sname("carol", &id) == ENOENT);
+
+	CHECK(pr_trace_serve(call_listentry(&c, 5, &e)) == 1 && c.error == 0);
+	CHECK(e.id == 5 && e.owner == -204 && e.creator == 1);
+	CHECK(e.ngroups == 20 && e.count == 3);
+	CHECK(strcmp(e.name, "alice") == 0);
+
+	pr_trace_get_stats(&st);
+	CHECK(st.calls[PR_OP_SNAMETOID] == 4);
+	CHECK(st.calls[PR_OP_LISTENTRY] == 1);
+	CHECK(st.missing == 1);
+	pr_trace_stop();
+	CHECK(!pr_trace_replaying());
+}
+
+static void
+test_anonymized(void)
+{
+	prname name, hashed;
+	char longkey[100];
+	idlist ids;
+	afs_int32 id;
+
+	/* Anonymizing takes a key. */
+	CHECK(pr_trace_record(path, 1, NULL) == EINVAL);
+	CHECK(pr_trace_record(path, 1, "") == EINVAL);
+
+	CHECK(pr_trace_record(path, 1, "sekrit") == 0);
+	note_sname("alice", 5, 0);
+	note_sid(5, "alice");
+	note_nametoid("alice:staff", "system:anyuser", -300, -101);
+	/* Even a name that looks like a hash is hashed when recording. */
+	note_sname("X0123456789ABCDEF", 7, 0);
+	pr_trace_stop();
+	CHECK(file_contains("alice") == 0);
+	CHECK(file_contains("staff") == 0);
+	CHECK(file_contains("X0123456789ABCDEF") == 0);
+	CHECK(file_contains("system:anyuser") == 1);
+
+	/* With the key, names are hashed as they were when recorded... */
+	CHECK(pr_trace_replay(path, 0, "sekrit") == 0);
+	CHECK(serve_sname("alice", &id) == 0 && id == 5);
+	CHECK(serve_sname("Alice", &id) == 0 && id == 5);
+	CHECK(serve_sid(5, name) == 0);
+	CHECK(name[0] == 'X' && strlen(name) == 17);
+	/* ... and names that came out of the trace are left alone. */
+	strcpy(hashed, name);
+	CHECK(serve_sname(hashed, &id) == 0 && id == 5);
+	CHECK(serve_nametoid("alice:staff", "system:anyuser", &ids) == 0);
+	CHECK(ids.idlist_len == 2 && ids.idlist_val[0] == -300 &&
+	    ids.idlist_val[1] == -101);
+	free(ids.idlist_val);
+	pr_trace_stop();
+
+	/* Without it, or with another, calls by name are not found. */
+	CHECK(pr_trace_replay(path, 0, NULL) == 0);
+	CHECK(serve_sname("alice", &id) == ENOENT);
+	CHECK(serve_sid(5, name) == 0 && strcmp(name, hashed) == 0);
+	pr_trace_stop();
+	CHECK(pr_trace_replay(path, 0, "other") == 0);
+	CHECK(serve_sname("alice", &id) == ENOENT);
+	pr_trace_stop();
+
+	/* A key longer than an HMAC block works the same way. */
+	memset(longkey, 'k', sizeof(longkey) - 1);
+	longkey[sizeof(longkey) - 1] = '\0';
+	CHECK(pr_trace_record(path, 1, longkey) == 0);
+	note_sname("alice", 5, 0);
+	pr_trace_stop();
+	CHECK(pr_trace_replay(path, 0, longkey) == 0);
+	CHECK(serve_sname("alice", &id) == 0 && id == 5);
+	pr_trace_stop();
+	longkey[0] = 'j';
+	CHECK(pr_trace_replay(path, 0, longkey) == 0);
+	CHECK(serve_sname("alice", &id) == ENOENT);
+	pr_trace_stop();
+}
+
+static void
+test_bad_files(void)
+{
+	FILE *f;
+
+	CHECK(pr_trace_replay("/nonexistent/trace", 0, NULL) == ENOENT);
+	if ((f = fopen(path, "wb")) != NULL) {
+		fputs("AFSPRC01 not a trace", f);
+		fclose(f);
+	}
+	CHECK(pr_trace_replay(path, 0, NULL) == -1);
+	CHECK(!pr_trace_replaying());
+
+	/* A truncated trace is rejected too. */
+	CHECK(pr_trace_record(path, 0, NULL) == 0);
+	note_sname("alice", 5, 0);
+	pr_trace_stop();
+	CHECK(truncate(path, 20) == 0);
+	CHECK(pr_trace_replay(path, 0, NULL) == -1);
+}
+
+int
+main(void)
+{
+	CHECK_SCRATCH(path);
+	test_plain();
+	test_anonymized();
+	test_bad_files();
+	unlink(path);
+	CHECK_DONE("pr_trace");
+}
+
+/*
+ * Local variables:
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -0,0 +1,115 @@
+# privacy_flags_test.rb: AFS::PrivacyFlags against the Ruby code that the
+# C versions replaced.  Run by "make check" in the build directory, with
+# the extension loaded from there.
+require 'minitest/autorun'
+require 'afs'
+
+class PrivacyFlagsTest < Minitest::Test
+  include AFS::PrivacyFlags
+
+  # The Ruby implementation as it was before the conversion to C, but
+  # for the exception: it named AFS::AFSLibraryError, which never existed.
+  module Reference
+    include AFS::PrivacyFlags
+
+    def self.pf_to_s(ival)
+      rv = "-----"
+      if ((ival & STATUS_ANY) != 0)
+	rv[0] = "S"
+      elsif ((ival & STATUS_MEM) != 0)
+	rv[0] = "s"
+      end
+      if ((ival & OWNED_ANY) != 0)
+	rv[1] = "O"
+      end
+      if ((ival & MEMBER_ANY) != 0)
+	rv[2] = "M"
+      elsif ((ival & MEMBER_MEM) != 0)
+	rv[2] = "m"
+      end
+      if ((ival & ADD_ANY) != 0)
+	rv[3] = "A"
+      elsif ((ival & ADD_MEM) != 0)
+	rv[3] = "a"
+      end
+      if ((ival & REMOVE_MEM) != 0)
+	rv[4] = "r"
+      end
+      return rv
+    end
+
+    def self.s_to_pf(sval)
+      rv = 0
+      sval.each_byte do |x|
+	case x.chr
+	when 'S'
+	  rv |= STATUS_ANY
+	when 's'
+	  rv |= STATUS_MEM
+	when 'O'
+	  rv |= OWNED_ANY
+	when 'M'
+	  rv |= MEMBER_ANY
+	when 'm'
+	  rv |= MEMBER_MEM
+	when 'A'
+	  rv |= ADD_ANY
+	when 'a'
+	  rv |= ADD_MEM
+	when 'r'
+	  rv |= REMOVE_MEM
+	when '-'
+	  nil
+	else
+	  raise AFS::LibraryError, "invalid privacy flag '#{x.chr}'"
+	end
+      end
+      return rv
+    end
+  end
+
+  FLAGS = (0..0xff).to_a
+  STRINGS = FLAGS.map { |f| Reference.pf_to_s(f) }.uniq +
+    ["", "-", "S", "rAmOs", "SsMmAa", "--r--", "---------", "OOO"]
+
+  def test_pf_to_s
+    FLAGS.each do |f|
+      assert_equal(Reference.pf_to_s(f), AFS::PrivacyFlags.pf_to_s(f),
+		   "flags #{f}")
+      assert_equal(Reference.pf_to_s(f), pf_to_s(f), "flags #{f}")
+    end
+  end
+
+  def test_s_to_pf
+    STRINGS.each do |s|
+      assert_equal(Reference.s_to_pf(s), AFS::PrivacyFlags.s_to_pf(s),
+		   "string #{s.inspect}")
+      assert_equal(Reference.s_to_pf(s), s_to_pf(s), "string #{s.inspect}")
+    end
+  end
+
+  def test_round_trip
+    FLAGS.each do |f|
+      s = AFS::PrivacyFlags.pf_to_s(f)
+      assert_equal(s, AFS::PrivacyFlags.pf_to_s(AFS::PrivacyFlags.s_to_pf(s)))
+    end
+  end
+
+  def test_invalid
+    ["x", "S-M-?", "S M", "\0"].each do |s|
+      e = assert_raises(AFS::LibraryError) { AFS::PrivacyFlags.s_to_pf(s) }
+      assert_match(/invalid privacy flag/, e.message)
+    end
+  end
+
+  def test_many
+    assert_equal(FLAGS.map { |f| Reference.pf_to_s(f) },
+		 AFS::PrivacyFlags.pf_to_s_many(FLAGS))
+    assert_equal(FLAGS.map { |f| Reference.pf_to_s(f) },
+		 AFS::PrivacyFlags.pf_to_s_many(FLAGS.pack("C*")))
+    assert_equal(STRINGS.map { |s| Reference.s_to_pf(s) },
+		 AFS::PrivacyFlags.s_to_pf_many(STRINGS))
+    assert_equal(STRINGS.map { |s| Reference.s_to_pf(s) }.pack("C*"),
+		 AFS::PrivacyFlags.s_to_pf_many(STRINGS, true).b)
+  end
+end